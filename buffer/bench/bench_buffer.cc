@@ -0,0 +1,315 @@
+/*
+ * file   bench_buffer.cc
+ * brief  Throughput and handoff latency benchmark for the buffers in buffer/.
+ *
+ *        Producer and consumer threads are pinned to CPUs, every message carries
+ *        the TSC of its push and the consumer records push-to-pop latency. The
+ *        sweep covers element sizes, capacities and producer/consumer counts, and
+ *        prints one JSON object per run (JSON lines) so runs of different buffer
+ *        variants and different commits can be compared with any tool.
+ *
+ *        g++ -std=c++17 -O3 -pthread bench_buffer.cc -o bench_buffer
+ *        ./bench_buffer [messages-per-run] [buffer-name-filter] > result.jsonl
+ *
+ *    Author: anhthd
+ */
+
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+
+#include "../circular/circular.hh"
+#include "../ring/buffer_ring.hh"
+#include "../ring/multicast_ring.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::buffer;
+
+/*******************************************************************************
+ * Clock: TSC where available, calibrated once against steady_clock.
+ *******************************************************************************/
+static inline std::uint64_t ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return (std::uint64_t)chrono::duration_cast<chrono::nanoseconds>(
+    chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+static double ns_per_tick() {
+#if defined(__x86_64__) || defined(__i386__)
+  auto t0 = chrono::steady_clock::now();
+  auto c0 = ticks();
+  std::this_thread::sleep_for(chrono::milliseconds(50));
+  auto c1 = ticks();
+  auto t1 = chrono::steady_clock::now();
+  return (double)chrono::duration_cast<chrono::nanoseconds>(t1 - t0).count() /
+         (double)(c1 - c0);
+#else
+  return 1.0;
+#endif
+}
+
+static void pin(unsigned idx_) {
+  static const unsigned ncpu = std::max(1u, std::thread::hardware_concurrency());
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(idx_ % ncpu, &set);
+  (void)pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+
+/// Spin a little then yield, so oversubscribed runs still make progress.
+static inline void backoff(unsigned& spins_) {
+  if (++spins_ > 64) {
+    sched_yield();
+    spins_ = 0;
+  }
+}
+
+template <std::size_t N>
+struct payload {
+  static_assert(N >= 16, "payload carries at least a timestamp and a sequence");
+  std::uint64_t tsc;
+  std::uint64_t seq;
+  char          pad[N - 16];
+};
+
+/*******************************************************************************
+ * Adapters: every buffer variant exposes the same producer/consumer interface.
+ *******************************************************************************/
+template <typename T>
+struct circular_adapter {
+  static constexpr const char* name = "circular";
+  static constexpr bool multi_producer = true;
+  static constexpr bool multi_consumer = true;
+  static constexpr bool broadcast = false;
+
+  circular<T> _buf;
+  explicit circular_adapter(std::size_t capacity_): _buf{capacity_} { }
+
+  /// circular never blocks the producer, the oldest element is dropped instead.
+  bool push(const T& v_) { _buf.push(v_); return true; }
+  bool pop(unsigned, T& out_) {
+    auto v = _buf.pop();
+    if (!v) return false;
+    out_ = *v;
+    return true;
+  }
+};
+
+template <typename T>
+struct buffer_ring_adapter {
+  static constexpr const char* name = "buffer_ring";
+  static constexpr bool multi_producer = false;
+  static constexpr bool multi_consumer = false;
+  static constexpr bool broadcast = false;
+
+  buffer_ring<T> _buf;
+  explicit buffer_ring_adapter(std::size_t capacity_): _buf{capacity_} { }
+
+  bool push(const T& v_) { return _buf.push(v_); }
+  bool pop(unsigned, T& out_) {
+    T* p = _buf.front();
+    if (!p) return false;
+    out_ = *p;
+    _buf.pop_front();
+    return true;
+  }
+};
+
+template <typename T>
+struct multicast_ring_adapter {
+  static constexpr const char* name = "multicast_ring";
+  static constexpr bool multi_producer = true;
+  static constexpr bool multi_consumer = true;
+  static constexpr bool broadcast = true;
+
+  multicast_ring<T> _buf;
+  std::vector<typename multicast_ring<T>::consumer*> _consumers;
+
+  multicast_ring_adapter(std::size_t capacity_, unsigned consumers_): _buf{capacity_} {
+    for (unsigned i = 0; i < consumers_; ++i) _consumers.push_back(&_buf.add_consumer());
+  }
+
+  bool push(const T& v_) {
+    _buf.publish_with([&v_](T& slot_) { slot_ = v_; });
+    return true;
+  }
+  bool pop(unsigned c_, T& out_) {
+    return 1 == _consumers[c_]->poll([&out_](const T& v_, std::uint64_t) { out_ = v_; }, 1);
+  }
+};
+
+/*******************************************************************************
+ * Runner
+ *******************************************************************************/
+struct result {
+  std::uint64_t sent{0};
+  std::uint64_t received{0};
+  std::uint64_t dropped{0};   ///< Overwritten before being consumed
+  double        seconds{0};
+  std::vector<std::uint64_t> lat;   ///< Sampled latencies, in ticks
+};
+
+static constexpr std::uint64_t LAT_SAMPLE_EVERY = 16;
+
+template <typename Adapter, typename T>
+static result run(Adapter& buf_, unsigned producers_, unsigned consumers_,
+                  std::uint64_t messages_) {
+  result r;
+  std::atomic<unsigned> ready{0};
+  std::atomic<bool> go{false};
+  std::atomic<unsigned> producers_done{0};
+  std::vector<std::vector<std::uint64_t>> lat(consumers_);
+  std::vector<std::uint64_t> received(consumers_, 0);
+  const std::uint64_t per_producer = messages_ / producers_;
+  const std::uint64_t expected = per_producer * producers_;   // per broadcast consumer
+
+  std::vector<std::thread> threads;
+  for (unsigned p = 0; p < producers_; ++p) {
+    threads.emplace_back([&, p]() {
+      pin(p);
+      ready++;
+      while (!go.load(std::memory_order_acquire)) { }
+      T v{};
+      for (std::uint64_t i = 0; i < per_producer; ++i) {
+        v.seq = i;
+        v.tsc = ticks();
+        unsigned spins = 0;
+        while (!buf_.push(v)) backoff(spins);
+      }
+      producers_done++;
+    });
+  }
+  for (unsigned c = 0; c < consumers_; ++c) {
+    lat[c].reserve(expected / LAT_SAMPLE_EVERY + 1);
+    threads.emplace_back([&, c]() {
+      pin(producers_ + c);
+      ready++;
+      while (!go.load(std::memory_order_acquire)) { }
+      T v{};
+      std::uint64_t n = 0;
+      unsigned spins = 0;
+      for (;;) {
+        if (buf_.pop(c, v)) {
+          if (n++ % LAT_SAMPLE_EVERY == 0) lat[c].push_back(ticks() - v.tsc);
+          spins = 0;
+          if (Adapter::broadcast && n == expected) break;
+          continue;
+        }
+        if (!Adapter::broadcast && producers_done.load() == producers_) {
+          // Drain whatever is left, then stop.
+          while (buf_.pop(c, v)) n++;
+          break;
+        }
+        backoff(spins);
+      }
+      received[c] = n;
+    });
+  }
+
+  while (ready.load() < producers_ + consumers_) std::this_thread::yield();
+  auto t0 = chrono::steady_clock::now();
+  go.store(true, std::memory_order_release);
+  for (auto& t : threads) t.join();
+  auto t1 = chrono::steady_clock::now();
+
+  r.sent = per_producer * producers_;
+  for (unsigned c = 0; c < consumers_; ++c) {
+    r.received += received[c];
+    r.lat.insert(r.lat.end(), lat[c].begin(), lat[c].end());
+  }
+  r.dropped = r.sent * (Adapter::broadcast ? consumers_ : 1) - r.received;
+  r.seconds = chrono::duration<double>(t1 - t0).count();
+  return r;
+}
+
+static double percentile(std::vector<std::uint64_t>& v_, double p_) {
+  if (v_.empty()) return 0;
+  std::size_t idx = std::min(v_.size() - 1, (std::size_t)(p_ * (double)v_.size()));
+  std::nth_element(v_.begin(), v_.begin() + (long)idx, v_.end());
+  return (double)v_[idx];
+}
+
+static void report(const char* name_, std::size_t elem_size_, std::size_t capacity_,
+                   unsigned producers_, unsigned consumers_, result& r_, double npt_) {
+  const double p50 = percentile(r_.lat, 0.50) * npt_;
+  const double p99 = percentile(r_.lat, 0.99) * npt_;
+  const double p999 = percentile(r_.lat, 0.999) * npt_;
+  const double max = r_.lat.empty() ? 0 :
+                     (double)*std::max_element(r_.lat.begin(), r_.lat.end()) * npt_;
+  printf("{\"buffer\":\"%s\",\"elem_size\":%zu,\"capacity\":%zu,\"producers\":%u,"
+         "\"consumers\":%u,\"sent\":%llu,\"received\":%llu,\"dropped\":%llu,"
+         "\"seconds\":%.6f,"
+         "\"throughput_msg_s\":%.0f,\"lat_p50_ns\":%.0f,\"lat_p99_ns\":%.0f,"
+         "\"lat_p999_ns\":%.0f,\"lat_max_ns\":%.0f}\n",
+         name_, elem_size_, capacity_, producers_, consumers_,
+         (unsigned long long)r_.sent, (unsigned long long)r_.received,
+         (unsigned long long)r_.dropped, r_.seconds,
+         (double)r_.received / r_.seconds, p50, p99, p999, max);
+  fflush(stdout);
+}
+
+template <template <typename> class Adapter, std::size_t N>
+static void sweep(std::uint64_t messages_, double npt_) {
+  using T = payload<N>;
+  using A = Adapter<T>;
+  static const unsigned counts[] = {1, 2, 4};
+  static const std::size_t capacities[] = {64, 1024, 16384};
+
+  for (std::size_t cap : capacities) {
+    for (unsigned p : counts) {
+      for (unsigned c : counts) {
+        if ((p > 1 && !A::multi_producer) || (c > 1 && !A::multi_consumer)) continue;
+        result r;
+        if constexpr (A::broadcast) {
+          A buf(cap, c);
+          r = run<A, T>(buf, p, c, messages_);
+        } else {
+          A buf(cap);
+          r = run<A, T>(buf, p, c, messages_);
+        }
+        report(A::name, N, cap, p, c, r, npt_);
+      }
+    }
+  }
+}
+
+template <template <typename> class Adapter>
+static void sweep_sizes(std::uint64_t messages_, double npt_) {
+  sweep<Adapter, 16>(messages_, npt_);
+  sweep<Adapter, 64>(messages_, npt_);
+  sweep<Adapter, 256>(messages_, npt_);
+  sweep<Adapter, 1024>(messages_, npt_);
+}
+
+int main(int argc, char** argv)
+{
+  std::uint64_t messages = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 200000;
+  std::string filter = (argc > 2) ? argv[2] : "";
+  const double npt = ns_per_tick();
+
+  auto enabled = [&filter](const char* name_) {
+    return filter.empty() || std::string(name_).find(filter) != std::string::npos;
+  };
+
+  if (enabled("circular")) sweep_sizes<circular_adapter>(messages, npt);
+  if (enabled("buffer_ring")) sweep_sizes<buffer_ring_adapter>(messages, npt);
+  if (enabled("multicast_ring")) sweep_sizes<multicast_ring_adapter>(messages, npt);
+  return 0;
+}
@@ -0,0 +1,181 @@
+/**************************************************************************************
+* Flight Recorder (Overwrite-only Circular Buffer)
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: flight_recorder.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * The flight recorder keeps the last N events pushed by a single writer thread, the
+ * oldest event is overwritten when the buffer is full. It is meant for diagnostics
+ * of hot threads, so unlike `circular` there is no mutex:
+ *
+ *  - push is wait-free: a handful of plain stores guarded by a per-slot sequence
+ *    counter (a seqlock per slot), no read-modify-write, no allocation.
+ *  - any number of readers can take a snapshot at any time. A reader never blocks
+ *    nor slows down the writer; it validates each slot against its sequence counter
+ *    and skips the slots the writer overwrote while they were being read.
+ *
+ * Every event gets a sequence number (0, 1, 2, ...) so a snapshot is an ordered,
+ * gap-aware view of the most recent events.
+ *
+ * The data type _T must be trivially copyable, it is copied in and out bytewise.
+ */
+#ifndef FLIGHT_RECORDER_H_
+#define FLIGHT_RECORDER_H_
+
+#include <new>
+#include <atomic>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+template <typename _T>
+class flight_recorder
+{
+  static_assert(std::is_trivially_copyable<_T>::value,
+                "flight_recorder data type must be trivially copyable");
+
+public:
+  /**
+   * Construct a recorder of capacity_ events, rounded up to a power of two.
+   */
+  explicit flight_recorder(std::size_t capacity_) {
+    if (!capacity_) {
+      throw std::invalid_argument("Flight recorder capacity cannot be Zero!");
+    }
+    std::size_t c = 1;
+    while (c < capacity_) c <<= 1;
+    _mask = c - 1;
+    _slots = new slot[c];
+  }
+
+  ~flight_recorder() {
+    delete[] _slots;
+  }
+
+  flight_recorder(flight_recorder&&) = delete;
+  flight_recorder(const flight_recorder&) = delete;
+  flight_recorder& operator=(flight_recorder&&) = delete;
+  flight_recorder& operator=(const flight_recorder&) = delete;
+
+  /**
+   * Get the number of events the recorder keeps.
+   */
+  std::size_t get_capacity() const noexcept {
+    return _mask + 1;
+  }
+
+  /**
+   * Get the total number of events pushed so far (including overwritten ones).
+   */
+  std::uint64_t count() const noexcept {
+    return _next.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Writer: record a new event, overwriting the oldest one if the buffer is full.
+   * Must only be called by a single thread.
+   *
+   * @param[in] value_ New event.
+   */
+  void push(const _T& value_) noexcept {
+    const std::uint64_t seq = _next.load(std::memory_order_relaxed);
+    slot& s = _slots[seq & _mask];
+
+    std::uint64_t words[WORDS] = {};
+    memcpy(words, &value_, sizeof(_T));
+
+    s._seq.store(2 * seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i = 0; i < WORDS; ++i) {
+      s._words[i].store(words[i], std::memory_order_relaxed);
+    }
+    s._seq.store(2 * seq + 2, std::memory_order_release);
+    _next.store(seq + 1, std::memory_order_release);
+  }
+
+  /**
+   * Reader: visit a consistent copy of every event still in the buffer, oldest first.
+   * Events overwritten by the writer during the visit are skipped. Neither allocates
+   * nor blocks, so it can also be used from a signal handler.
+   *
+   * @param[in] fn_ Callable as fn_(std::uint64_t seq, const _T& event).
+   * @return Number of visited events.
+   */
+  template <typename F>
+  std::size_t visit(F&& fn_) const {
+    const std::uint64_t end = _next.load(std::memory_order_acquire);
+    const std::uint64_t cap = _mask + 1;
+    std::uint64_t seq = (end > cap) ? end - cap : 0;
+
+    std::size_t n = 0;
+    for (; seq < end; ++seq) {
+      const slot& s = _slots[seq & _mask];
+      const std::uint64_t s1 = s._seq.load(std::memory_order_acquire);
+      if (s1 != 2 * seq + 2) continue;
+
+      std::uint64_t words[WORDS];
+      for (std::size_t i = 0; i < WORDS; ++i) {
+        words[i] = s._words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (s._seq.load(std::memory_order_relaxed) != s1) continue;
+
+      typename std::aligned_storage<sizeof(_T), alignof(_T)>::type value;
+      memcpy(&value, words, sizeof(_T));
+      fn_(seq, *std::launder(reinterpret_cast<const _T*>(&value)));
+      ++n;
+    }
+    return n;
+  }
+
+  /**
+   * Reader: take a snapshot of the events still in the buffer, oldest first.
+   *
+   * @return Pairs of (sequence number, event).
+   */
+  std::vector<std::pair<std::uint64_t, _T>> snapshot() const {
+    std::vector<std::pair<std::uint64_t, _T>> ret;
+    ret.reserve(get_capacity());
+    visit([&ret](std::uint64_t seq_, const _T& value_) {
+      ret.emplace_back(seq_, value_);
+    });
+    return ret;
+  }
+
+private:
+  static constexpr std::size_t WORDS = (sizeof(_T) + 7) / 8;
+
+  struct slot {
+    std::atomic<std::uint64_t> _seq{0};            ///< Odd while being written
+    std::atomic<std::uint64_t> _words[WORDS]{};
+  };
+
+  slot*                       _slots{nullptr};
+  std::size_t                 _mask{0};
+  std::atomic<std::uint64_t>  _next{0};
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* FLIGHT_RECORDER_H_ */
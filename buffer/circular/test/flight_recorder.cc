@@ -0,0 +1,69 @@
+/*
+ * file   flight_recorder.cc
+ * brief  One thread records events into a flight_recorder while another thread keeps
+ *        taking snapshots and checks that every event it sees is consistent.
+ *
+ *    Author: anhthd
+ */
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../flight_recorder.hh"
+
+using namespace std;
+
+struct event {
+  std::uint64_t id;
+  std::uint64_t a;
+  std::uint64_t b;
+  std::uint64_t sum;
+};
+
+int main(int argc, char** argv)
+{
+  anhthd::cpplibs::buffer::flight_recorder<event> fr(100);
+  cout << "Current capacity: " << fr.get_capacity() << endl;
+  cout << "================================================" << endl;
+
+  for (std::uint64_t i = 0; i < 200; ++i) {
+    fr.push(event{i, i, 2 * i, 3 * i});
+  }
+  auto snap = fr.snapshot();
+  cout << "Pushed: " << fr.count() << ", kept: " << snap.size()
+       << ", oldest: " << snap.front().second.id
+       << ", newest: " << snap.back().second.id << endl;
+  cout << "================================================" << endl;
+
+  std::atomic<bool> stop{false};
+  std::thread writer([&fr, &stop]() {
+    std::uint64_t i = 200;
+    while (!stop.load(std::memory_order_relaxed)) {
+      fr.push(event{i, i, 2 * i, 3 * i});
+      ++i;
+    }
+  });
+
+  std::size_t snapshots = 0, seen = 0, torn = 0;
+  while (snapshots < 2000) {
+    std::uint64_t last = 0;
+    bool first = true;
+    fr.visit([&](std::uint64_t seq_, const event& e_) {
+      if (e_.id != seq_ || e_.a + e_.b != e_.sum || (!first && seq_ <= last)) ++torn;
+      last = seq_;
+      first = false;
+      ++seen;
+    });
+    ++snapshots;
+  }
+  stop = true;
+  writer.join();
+
+  cout << "Snapshots: " << snapshots << ", events seen: " << seen
+       << ", inconsistent: " << torn << endl;
+  return torn ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,86 @@
+/*
+ * file   window.cc
+ * brief  Compare window_stats and window_aggregate against rescanning the last N
+ *        samples.
+ *
+ *    Author: anhthd
+ */
+
+#include <deque>
+#include <cmath>
+#include <string>
+#include <cstdio>
+#include <random>
+#include <cstdlib>
+#include <iostream>
+#include <algorithm>
+
+#include "../window.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::buffer;
+
+struct gcd_op {
+  std::uint64_t operator()(std::uint64_t a_, std::uint64_t b_) const {
+    while (b_) { auto t = a_ % b_; a_ = b_; b_ = t; }
+    return a_;
+  }
+};
+
+/// Non-commutative: keeps the first (oldest) and the last (newest) sample.
+struct first_last_op {
+  std::pair<int, int> operator()(std::pair<int, int> a_, std::pair<int, int> b_) const {
+    return {a_.first, b_.second};
+  }
+};
+
+int main(int argc, char** argv)
+{
+  const std::size_t N = 100;
+  window_stats<double> ws(N);
+  window_stats<int> wi(N);
+  window_aggregate<std::uint64_t, gcd_op> wg(N);
+  window_aggregate<std::pair<int, int>, first_last_op> wf(N);
+  cout << "Current capacity: " << ws.get_capacity() << endl;
+  cout << "================================================" << endl;
+
+  std::mt19937_64 rng(42);
+  std::uniform_real_distribution<double> ud(-1e6, 1e6);
+  std::deque<double> ref;
+  std::deque<std::uint64_t> refg;
+  std::size_t errors = 0;
+
+  for (int i = 0; i < 1000000; ++i) {
+    double v = ud(rng);
+    std::uint64_t g = 6 * (1 + rng() % 1000);
+    ws.push(v);
+    wi.push((int)v);
+    wg.push(g);
+    wf.push({i, i});
+    ref.push_back(v);
+    refg.push_back(g);
+    if (ref.size() > N) { ref.pop_front(); refg.pop_front(); }
+
+    if (i % 997 == 0) {
+      double s = 0;
+      long long si = 0;
+      std::uint64_t gg = 0;
+      for (auto x : ref) { s += x; si += (int)x; }
+      for (auto x : refg) gg = gcd_op{}(gg, x);
+      if (std::fabs(ws.sum() - s) > 1e-6 ||
+          *ws.min() != *std::min_element(ref.begin(), ref.end()) ||
+          *ws.max() != *std::max_element(ref.begin(), ref.end()) ||
+          wi.sum() != si || *wg.query() != gg ||
+          wf.query()->first != i + 1 - (int)ref.size() || wf.query()->second != i) {
+        ++errors;
+      }
+    }
+  }
+
+  cout << "Current size: " << ws.size() << endl;
+  cout << "sum: " << ws.sum() << ", mean: " << *ws.mean() << ", min: " << *ws.min()
+       << ", max: " << *ws.max() << endl;
+  cout << "gcd: " << *wg.query() << endl;
+  cout << "errors: " << errors << endl;
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
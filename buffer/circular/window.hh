@@ -0,0 +1,293 @@
+/**************************************************************************************
+* Sliding Window Aggregates over a Circular Buffer
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: window.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * Windowed aggregates over the last N samples of a stream, with the same overwrite
+ * semantic as `circular`: push as often as we want, the oldest sample falls out of
+ * the window once N samples are in.
+ *
+ * Every query is O(1) and every push is O(1) amortized; nothing is rescanned and
+ * nothing is allocated after construction.
+ *
+ * window_stats<_T>: sum, mean, min and max.
+ *  - sum/mean: running sum with Kahan compensation for floating point types, and a
+ *    full recomputation every N pushes so rounding error cannot build up.
+ *  - min/max: monotonic deques of sample indices.
+ *
+ * window_aggregate<_T, _Op>: any associative operation _Op (i.e. gcd, bitwise or,
+ * matrix product...), evaluated with two-stack aggregation: the front stack keeps
+ * suffix aggregates of the older samples, the back stack a running aggregate of
+ * the newer ones, query() combines both. _Op does not need an inverse nor to be
+ * commutative.
+ *
+ * The data type _T must be default constructible and copyable.
+ */
+#ifndef WINDOW_H_
+#define WINDOW_H_
+
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+namespace detail {
+/**
+ * Fixed capacity ring of _T (deque without allocation), used as storage for
+ * the window and as the monotonic deques.
+ */
+template <typename _T>
+class fixed_ring
+{
+public:
+  explicit fixed_ring(std::size_t capacity_): _cap{capacity_}, _data{new _T[capacity_]} { }
+
+  std::size_t size() const noexcept { return _size; }
+  bool empty() const noexcept { return !_size; }
+
+  _T& front() noexcept { return _data[_first]; }
+  _T& back() noexcept { return _data[(_first + _size - 1) % _cap]; }
+  const _T& front() const noexcept { return _data[_first]; }
+  const _T& back() const noexcept { return _data[(_first + _size - 1) % _cap]; }
+
+  /// i-th element from the front
+  const _T& operator[](std::size_t i_) const noexcept { return _data[(_first + i_) % _cap]; }
+
+  void push_back(const _T& v_) noexcept {
+    _data[(_first + _size) % _cap] = v_;
+    ++_size;
+  }
+  void pop_front() noexcept {
+    _first = (_first + 1 == _cap) ? 0 : _first + 1;
+    --_size;
+  }
+  void pop_back() noexcept { --_size; }
+  void clear() noexcept { _first = _size = 0; }
+
+private:
+  std::size_t           _cap;
+  std::unique_ptr<_T[]> _data;
+  std::size_t           _first{0};
+  std::size_t           _size{0};
+};
+};  // namespace detail
+
+template <typename _T>
+class window_stats
+{
+  static_assert(std::is_arithmetic<_T>::value, "window_stats requires an arithmetic type");
+
+public:
+  using sum_t = typename std::conditional<std::is_floating_point<_T>::value, _T,
+                typename std::conditional<std::is_signed<_T>::value,
+                                          std::int64_t, std::uint64_t>::type>::type;
+
+  /**
+   * Construct a window over the last capacity_ samples.
+   */
+  explicit window_stats(std::size_t capacity_):
+    _cap{_check(capacity_)}, _samples{capacity_}, _min{capacity_}, _max{capacity_} { }
+
+  window_stats(window_stats&&) = delete;
+  window_stats(const window_stats&) = delete;
+  window_stats& operator=(window_stats&&) = delete;
+  window_stats& operator=(const window_stats&) = delete;
+
+  std::size_t get_capacity() const noexcept { return _cap; }
+  std::size_t size() const noexcept { return _samples.size(); }
+
+  /**
+   * Push a new sample, evicting the oldest one if the window is full.
+   *
+   * @param[in] value_ New sample.
+   */
+  void push(_T value_) noexcept {
+    if (_samples.size() == _cap) {
+      const _T old = _samples.front();
+      _samples.pop_front();
+      _sub(static_cast<sum_t>(old));
+      if (!_min.empty() && _min.front().first == _pos - _cap) _min.pop_front();
+      if (!_max.empty() && _max.front().first == _pos - _cap) _max.pop_front();
+    }
+    _samples.push_back(value_);
+    _add(static_cast<sum_t>(value_));
+
+    while (!_min.empty() && !(_min.back().second < value_)) _min.pop_back();
+    _min.push_back({_pos, value_});
+    while (!_max.empty() && !(value_ < _max.back().second)) _max.pop_back();
+    _max.push_back({_pos, value_});
+
+    if (++_pos % _cap == 0) _recompute();
+  }
+
+  sum_t sum() const noexcept { return _sum; }
+
+  std::optional<double> mean() const noexcept {
+    if (!size()) return std::nullopt;
+    return static_cast<double>(_sum) / static_cast<double>(size());
+  }
+
+  std::optional<_T> min() const noexcept {
+    if (_min.empty()) return std::nullopt;
+    return _min.front().second;
+  }
+
+  std::optional<_T> max() const noexcept {
+    if (_max.empty()) return std::nullopt;
+    return _max.front().second;
+  }
+
+  void clear() noexcept {
+    _samples.clear();
+    _min.clear();
+    _max.clear();
+    _sum = _comp = sum_t{};
+  }
+
+private:
+  static std::size_t _check(std::size_t capacity_) {
+    if (!capacity_) {
+      throw std::invalid_argument("Window capacity cannot be Zero!");
+    }
+    return capacity_;
+  }
+
+  /**
+   * Kahan summation for floating point, plain (exact) summation for integers.
+   */
+  void _add(sum_t v_) noexcept {
+    if constexpr (std::is_floating_point<_T>::value) {
+      const sum_t y = v_ - _comp;
+      const sum_t t = _sum + y;
+      _comp = (t - _sum) - y;
+      _sum = t;
+    } else {
+      _sum += v_;
+    }
+  }
+
+  void _sub(sum_t v_) noexcept {
+    if constexpr (std::is_floating_point<_T>::value) {
+      _add(-v_);
+    } else {
+      _sum -= v_;
+    }
+  }
+
+  /**
+   * Periodic compensation: rebuild the sum from the samples currently in the window.
+   * Runs once every capacity pushes, so it is O(1) amortized.
+   */
+  void _recompute() noexcept {
+    if constexpr (std::is_floating_point<_T>::value) {
+      _sum = _comp = sum_t{};
+      for (std::size_t i = 0; i < _samples.size(); ++i) {
+        _add(static_cast<sum_t>(_samples[i]));
+      }
+    }
+  }
+
+  std::size_t                                       _cap;
+  detail::fixed_ring<_T>                            _samples;
+  detail::fixed_ring<std::pair<std::uint64_t, _T>>  _min;   ///< Increasing values
+  detail::fixed_ring<std::pair<std::uint64_t, _T>>  _max;   ///< Decreasing values
+  std::uint64_t _pos{0};    ///< Index of the next sample
+  sum_t         _sum{};
+  sum_t         _comp{};    ///< Kahan compensation
+};
+
+template <typename _T, typename _Op>
+class window_aggregate
+{
+public:
+  /**
+   * Construct a window over the last capacity_ samples aggregated with op_.
+   *
+   * @param[in] capacity_ Window size.
+   * @param[in] op_ Associative binary operation, op_(older, newer).
+   */
+  window_aggregate(std::size_t capacity_, _Op op_ = _Op{}):
+    _capacity{capacity_}, _op{std::move(op_)}, _front_agg{capacity_}, _back{capacity_} {
+    if (!capacity_) {
+      throw std::invalid_argument("Window capacity cannot be Zero!");
+    }
+  }
+
+  window_aggregate(window_aggregate&&) = delete;
+  window_aggregate(const window_aggregate&) = delete;
+  window_aggregate& operator=(window_aggregate&&) = delete;
+  window_aggregate& operator=(const window_aggregate&) = delete;
+
+  std::size_t get_capacity() const noexcept { return _capacity; }
+  std::size_t size() const noexcept { return _front_agg.size() + _back.size(); }
+
+  /**
+   * Push a new sample, evicting the oldest one if the window is full.
+   */
+  void push(const _T& value_) {
+    if (size() == _capacity) _evict();
+    _back_agg = _back.empty() ? value_ : _op(_back_agg, value_);
+    _back.push_back(value_);
+  }
+
+  /**
+   * Aggregate of all samples in the window, oldest to newest.
+   */
+  std::optional<_T> query() const {
+    if (_front_agg.empty() && _back.empty()) return std::nullopt;
+    if (_front_agg.empty()) return _back_agg;
+    if (_back.empty()) return _front_agg.back();
+    return _op(_front_agg.back(), _back_agg);
+  }
+
+private:
+  /**
+   * Drop the oldest sample. When the front stack is empty, the back stack is flipped
+   * into it by computing suffix aggregates: each sample is moved once per window,
+   * hence O(1) amortized.
+   */
+  void _evict() {
+    if (_front_agg.empty()) {
+      // Front stack top must be the oldest sample, so fill it newest first.
+      _T agg = _back.back();
+      _front_agg.push_back(agg);
+      for (std::size_t i = _back.size() - 1; i-- > 0;) {
+        agg = _op(_back[i], agg);
+        _front_agg.push_back(agg);
+      }
+      _back.clear();
+    }
+    _front_agg.pop_back();
+  }
+
+  std::size_t             _capacity;
+  _Op                     _op;
+  detail::fixed_ring<_T>  _front_agg;   ///< Stack of suffix aggregates, top = oldest
+  detail::fixed_ring<_T>  _back;        ///< Newer samples, oldest first
+  _T                      _back_agg{};  ///< Aggregate of _back
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* WINDOW_H_ */
@@ -16,23 +16,250 @@
 * You should have received a copy of the GNU General Public License along with this
 * program. If not, see <https://www.gnu.org/licenses/>.
 **************************************************************************************/
+
+/**
+ * The buffer ring is a fixed capacity, single-producer/single-consumer lock-free
+ * queue. Unlike `circular`, push never overwrites: it fails when the ring is full.
+ *
+ * The ring keeps all of its state in one contiguous region,
+ *
+ *   [ control | slot 0 | slot 1 | ... | slot capacity-1 ]
+ *
+ * and the control block holds only indices, never pointers. So the region is
+ * position independent: it can be allocated on the heap by the ring itself, or it
+ * can be provided by the user, i.e. a shared memory mapping seen at different
+ * addresses by different processes (see shm_ring.hh).
+ */
 #ifndef BUFFER_RING_H_
 #define BUFFER_RING_H_
 
+#include <new>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+
+#ifndef CPPLIBS_CACHELINE_SIZE
+#define CPPLIBS_CACHELINE_SIZE 64
+#endif
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
 template <typename T>
 class buffer_ring
 {
+  static_assert(std::atomic<std::uint64_t>::is_always_lock_free,
+                "buffer_ring requires address-free 64-bit atomics");
+
 public:
-  buffer_ring() = default;
-  ~buffer_ring() = default;
+  /**
+   * Control block at the beginning of the ring region.
+   */
+  struct control {
+    std::uint64_t _magic;
+    std::uint64_t _capacity;
+    std::uint64_t _slot_size;
+
+    alignas(CPPLIBS_CACHELINE_SIZE)
+    std::atomic<std::uint64_t> _head;   ///< Next position to write, producer owned
+    alignas(CPPLIBS_CACHELINE_SIZE)
+    std::atomic<std::uint64_t> _tail;   ///< Next position to read, consumer owned
+  };
+
+  /**
+   * Get the number of bytes a ring of capacity_ slots needs.
+   * capacity_ is rounded up to a power of two.
+   */
+  static std::size_t footprint(std::size_t capacity_) {
+    return _slots_offset() + _round_up(capacity_) * sizeof(slot_t);
+  }
+
+  /**
+   * Initialize a ring of capacity_ slots in the user provided region region_,
+   * which must be at least footprint(capacity_) bytes and cache line aligned.
+   * Any previous content of the region is discarded.
+   */
+  static void format(void* region_, std::size_t capacity_) {
+    control* ctl = static_cast<control*>(region_);
+    ctl->_magic = 0;
+    std::atomic_thread_fence(std::memory_order_release);
+    ctl->_capacity = _round_up(capacity_);
+    ctl->_slot_size = sizeof(slot_t);
+    new (&ctl->_head) std::atomic<std::uint64_t>{0};
+    new (&ctl->_tail) std::atomic<std::uint64_t>{0};
+    std::atomic_thread_fence(std::memory_order_release);
+    ctl->_magic = MAGIC;
+  }
+
+  /**
+   * Check whether region_ holds a ring formatted for the same element type.
+   */
+  static bool is_formatted(const void* region_) noexcept {
+    const control* ctl = static_cast<const control*>(region_);
+    return ctl->_magic == MAGIC && ctl->_slot_size == sizeof(slot_t);
+  }
+
+  /**
+   * Construct a heap allocated ring of capacity_ slots (rounded up to a power of two).
+   */
+  explicit buffer_ring(std::size_t capacity_): _owned{true} {
+    if (!capacity_) {
+      throw std::invalid_argument("Buffer ring capacity cannot be Zero!");
+    }
+    _ctl = static_cast<control*>(::operator new(footprint(capacity_),
+                                     std::align_val_t{CPPLIBS_CACHELINE_SIZE}));
+    format(_ctl, capacity_);
+    _attach();
+  }
+
+  /**
+   * Construct a view of a ring previously formatted in region_ with format().
+   * The view does not own the region nor the elements in it.
+   */
+  explicit buffer_ring(void* region_): _owned{false} {
+    if (!region_ || !is_formatted(region_)) {
+      throw std::invalid_argument("Region does not hold a formatted buffer ring!");
+    }
+    _ctl = static_cast<control*>(region_);
+    _attach();
+  }
+
+  ~buffer_ring() {
+    if (!_owned) return;
+    while (pop()) { }
+    ::operator delete(_ctl, std::align_val_t{CPPLIBS_CACHELINE_SIZE});
+  }
 
   buffer_ring(buffer_ring&&) = delete;
   buffer_ring(const buffer_ring&) = delete;
   buffer_ring& operator=(buffer_ring&&) = delete;
   buffer_ring& operator=(const buffer_ring&) = delete;
 
+  /**
+   * Get the maximum number of elements the ring can hold.
+   */
+  std::size_t capacity() const noexcept {
+    return _mask + 1;
+  }
+
+  /**
+   * Get the current number of elements. Exact only if called by producer or consumer
+   * while the other side is idle.
+   */
+  std::size_t size() const noexcept {
+    return static_cast<std::size_t>(_ctl->_head.load(std::memory_order_acquire) -
+                                    _ctl->_tail.load(std::memory_order_acquire));
+  }
+
+  bool empty() const noexcept {
+    return size() == 0;
+  }
+
+  /**
+   * Producer: construct a new element in place at the back of the ring.
+   *
+   * @return false if the ring is full, args_ are left untouched then.
+   */
+  template <typename ... Args>
+  bool emplace(Args&& ... args_) {
+    const std::uint64_t head = _ctl->_head.load(std::memory_order_relaxed);
+    if (head - _tail_cache > _mask) {
+      _tail_cache = _ctl->_tail.load(std::memory_order_acquire);
+      if (head - _tail_cache > _mask) {
+        return false;
+      }
+    }
+    new (&_slots[head & _mask]) T(std::forward<Args>(args_)...);
+    _ctl->_head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+
+  /**
+   * Producer: push a value at the back of the ring.
+   *
+   * @return false if the ring is full.
+   */
+  bool push(const T& value_) {
+    return emplace(value_);
+  }
+
+  bool push(T&& value_) {
+    return emplace(std::move(value_));
+  }
+
+  /**
+   * Consumer: access the element at the front of the ring without removing it.
+   *
+   * @return nullptr if the ring is empty.
+   */
+  T* front() noexcept {
+    const std::uint64_t tail = _ctl->_tail.load(std::memory_order_relaxed);
+    if (tail == _head_cache) {
+      _head_cache = _ctl->_head.load(std::memory_order_acquire);
+      if (tail == _head_cache) {
+        return nullptr;
+      }
+    }
+    return std::launder(reinterpret_cast<T*>(&_slots[tail & _mask]));
+  }
+
+  /**
+   * Consumer: remove the element returned by front().
+   */
+  void pop_front() noexcept {
+    const std::uint64_t tail = _ctl->_tail.load(std::memory_order_relaxed);
+    std::launder(reinterpret_cast<T*>(&_slots[tail & _mask]))->~T();
+    _ctl->_tail.store(tail + 1, std::memory_order_release);
+  }
+
+  /**
+   * Consumer: pop the element at the front of the ring.
+   */
+  std::optional<T> pop() {
+    T* p = front();
+    if (!p) return std::nullopt;
+    std::optional<T> ret{std::move(*p)};
+    pop_front();
+    return ret;
+  }
+
 private:
+  using slot_t = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+  static constexpr std::uint64_t MAGIC = 0x676e6972667562ULL;  // "bufring"
+
+  static constexpr std::size_t _slots_offset() noexcept {
+    constexpr std::size_t a = alignof(slot_t) > CPPLIBS_CACHELINE_SIZE ?
+                              alignof(slot_t) : CPPLIBS_CACHELINE_SIZE;
+    return (sizeof(control) + a - 1) & ~(a - 1);
+  }
+
+  static std::size_t _round_up(std::size_t capacity_) noexcept {
+    std::size_t c = 1;
+    while (c < capacity_) c <<= 1;
+    return c;
+  }
+
+  void _attach() noexcept {
+    _mask = static_cast<std::size_t>(_ctl->_capacity) - 1;
+    _slots = reinterpret_cast<slot_t*>(reinterpret_cast<char*>(_ctl) + _slots_offset());
+    _head_cache = _ctl->_head.load(std::memory_order_acquire);
+    _tail_cache = _ctl->_tail.load(std::memory_order_acquire);
+  }
+
+  control*      _ctl{nullptr};
+  slot_t*       _slots{nullptr};
+  std::size_t   _mask{0};
+  bool          _owned{false};
 
+  /// Process local caches of the peer index, producer and consumer owned
+  alignas(CPPLIBS_CACHELINE_SIZE) std::uint64_t _tail_cache{0};
+  alignas(CPPLIBS_CACHELINE_SIZE) std::uint64_t _head_cache{0};
 };
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
 
 #endif /* BUFFER_RING_H_ */
@@ -0,0 +1,423 @@
+/**************************************************************************************
+* Coroutine Channel
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: channel.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * A bounded channel for C++20 coroutines, built on buffer_ring.
+ *
+ *   bool ok = co_await ch.send(x);     // suspends while the channel is full
+ *   std::optional<T> v = co_await ch.recv();  // suspends while it is empty
+ *
+ * send() returns false and recv() returns std::nullopt once the channel is closed
+ * (recv() still drains the elements sent before close()).
+ *
+ * Suspended senders and receivers are queued intrusively through their awaiters,
+ * which live in the coroutine frames. When a sender meets a suspended receiver the
+ * value is handed over directly into the receiver's awaiter, and the receiver is
+ * scheduled on the executor through an intrusive run queue, so a message costs no
+ * allocation whether it goes through the ring or not.
+ *
+ * Executors:
+ *  - single_thread_executor: run() resumes the scheduled coroutines on the calling
+ *    thread until there is nothing left to run.
+ *  - thread_pool_executor: N worker threads resume the scheduled coroutines.
+ *
+ * Coroutines are written with the `task` return type and started with spawn():
+ *
+ *   task producer(channel<int>& ch_) { for (...) co_await ch_.send(i); }
+ *   single_thread_executor ex;
+ *   channel<int> ch(ex, 64);
+ *   ex.spawn(producer(ch));
+ *   ex.run();
+ */
+#ifndef CHANNEL_H_
+#define CHANNEL_H_
+
+#if __cplusplus < 202002L
+#error "channel.hh requires C++20 coroutines"
+#endif
+
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <utility>
+#include <optional>
+#include <exception>
+#include <coroutine>
+#include <condition_variable>
+
+#include "buffer_ring.hh"
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+/**
+ * Intrusive run queue node: a suspended coroutine ready to be resumed.
+ */
+struct work_item {
+  std::coroutine_handle<> _handle{};
+  work_item*              _next{nullptr};
+};
+
+class executor;
+
+/**
+ * Detached coroutine. It starts suspended and runs once spawned on an executor,
+ * its frame is destroyed when it completes.
+ */
+class task
+{
+public:
+  struct promise_type: work_item {
+    task get_return_object() noexcept {
+      return task{std::coroutine_handle<promise_type>::from_promise(*this)};
+    }
+    std::suspend_always initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept { }
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+
+  task(task&& other_) noexcept: _handle{std::exchange(other_._handle, nullptr)} { }
+
+  ~task() {
+    if (_handle) _handle.destroy();
+  }
+
+  task(const task&) = delete;
+  task& operator=(task&&) = delete;
+  task& operator=(const task&) = delete;
+
+private:
+  explicit task(std::coroutine_handle<promise_type> handle_) noexcept:
+    _handle{handle_} { }
+
+  std::coroutine_handle<promise_type> _handle;
+
+  friend class executor;
+};
+
+class executor
+{
+public:
+  executor() = default;
+  virtual ~executor() = default;
+
+  executor(executor&&) = delete;
+  executor(const executor&) = delete;
+  executor& operator=(executor&&) = delete;
+  executor& operator=(const executor&) = delete;
+
+  /**
+   * Queue a suspended coroutine to be resumed. Must not allocate.
+   */
+  virtual void schedule(work_item* item_) noexcept = 0;
+
+  /**
+   * Start a task on this executor. The executor takes ownership of its frame.
+   */
+  void spawn(task&& task_) noexcept {
+    auto& promise = task_._handle.promise();
+    promise._handle = std::exchange(task_._handle, nullptr);
+    schedule(&promise);
+  }
+};
+
+/**
+ * Intrusive FIFO of work items.
+ */
+class work_queue
+{
+public:
+  void push(work_item* item_) noexcept {
+    item_->_next = nullptr;
+    if (_tail) _tail->_next = item_;
+    else _head = item_;
+    _tail = item_;
+  }
+
+  work_item* pop() noexcept {
+    work_item* item = _head;
+    if (item) {
+      _head = item->_next;
+      if (!_head) _tail = nullptr;
+    }
+    return item;
+  }
+
+  bool empty() const noexcept {
+    return _head == nullptr;
+  }
+
+private:
+  work_item* _head{nullptr};
+  work_item* _tail{nullptr};
+};
+
+class single_thread_executor: public executor
+{
+public:
+  void schedule(work_item* item_) noexcept override {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _queue.push(item_);
+  }
+
+  /**
+   * Resume scheduled coroutines on the calling thread until none is left.
+   *
+   * @return Number of resumptions.
+   */
+  std::size_t run() {
+    std::size_t n = 0;
+    for (;;) {
+      work_item* item;
+      {
+        std::lock_guard<std::mutex> lk(_mtx);
+        item = _queue.pop();
+      }
+      if (!item) return n;
+      item->_handle.resume();
+      ++n;
+    }
+  }
+
+private:
+  std::mutex  _mtx;
+  work_queue  _queue;
+};
+
+class thread_pool_executor: public executor
+{
+public:
+  explicit thread_pool_executor(std::size_t nthreads_) {
+    if (!nthreads_) nthreads_ = 1;
+    for (std::size_t i = 0; i < nthreads_; ++i) {
+      _threads.emplace_back([this]() { _worker(); });
+    }
+  }
+
+  /**
+   * Stop the workers once the run queue is empty and join them.
+   */
+  ~thread_pool_executor() {
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _stop = true;
+    }
+    _cv.notify_all();
+    for (auto& t : _threads) t.join();
+  }
+
+  void schedule(work_item* item_) noexcept override {
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _queue.push(item_);
+    }
+    _cv.notify_one();
+  }
+
+private:
+  void _worker() {
+    for (;;) {
+      work_item* item;
+      {
+        std::unique_lock<std::mutex> lk(_mtx);
+        _cv.wait(lk, [this]() { return _stop || !_queue.empty(); });
+        item = _queue.pop();
+        if (!item) return;
+      }
+      item->_handle.resume();
+    }
+  }
+
+  std::mutex                _mtx;
+  std::condition_variable   _cv;
+  work_queue                _queue;
+  bool                      _stop{false};
+  std::vector<std::thread>  _threads;
+};
+
+template <typename T>
+class channel
+{
+public:
+  class send_awaiter;
+  class recv_awaiter;
+
+  /**
+   * Construct a channel of capacity_ elements (rounded up to a power of two) whose
+   * suspended senders and receivers are resumed on ex_.
+   */
+  channel(executor& ex_, std::size_t capacity_):
+    _ex{ex_}, _ring{capacity_} { }
+
+  ~channel() = default;
+
+  channel(channel&&) = delete;
+  channel(const channel&) = delete;
+  channel& operator=(channel&&) = delete;
+  channel& operator=(const channel&) = delete;
+
+  std::size_t capacity() const noexcept {
+    return _ring.capacity();
+  }
+
+  /**
+   * co_await ch.send(v): true once v is in the channel, false if it is closed.
+   */
+  send_awaiter send(T value_) {
+    return send_awaiter{*this, std::move(value_)};
+  }
+
+  /**
+   * co_await ch.recv(): the next element, std::nullopt if closed and drained.
+   */
+  recv_awaiter recv() noexcept {
+    return recv_awaiter{*this};
+  }
+
+  /**
+   * Close the channel and wake up every suspended sender and receiver.
+   */
+  void close() noexcept {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _closed = true;
+    while (auto* s = _pop(_senders)) {
+      s->_ok = false;
+      _ex.schedule(s);
+    }
+    while (auto* r = _pop(_receivers)) {
+      _ex.schedule(r);
+    }
+  }
+
+  class send_awaiter: public work_item
+  {
+  public:
+    send_awaiter(channel& ch_, T&& value_): _ch{ch_}, _value{std::move(value_)} { }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle_) {
+      std::lock_guard<std::mutex> lk(_ch._mtx);
+      if (_ch._closed) {
+        _ok = false;
+        return false;
+      }
+      if (auto* r = _pop(_ch._receivers)) {
+        r->_value.emplace(std::move(_value));
+        _ch._ex.schedule(r);
+        return false;
+      }
+      if (_ch._ring.push(std::move(_value))) {
+        return false;
+      }
+      _handle = handle_;
+      _push(_ch._senders, this);
+      return true;
+    }
+
+    bool await_resume() const noexcept { return _ok; }
+
+  private:
+    channel&  _ch;
+    T         _value;
+    bool      _ok{true};
+
+    friend class channel;
+  };
+
+  class recv_awaiter: public work_item
+  {
+  public:
+    explicit recv_awaiter(channel& ch_) noexcept: _ch{ch_} { }
+
+    bool await_ready() const noexcept { return false; }
+
+    bool await_suspend(std::coroutine_handle<> handle_) {
+      std::lock_guard<std::mutex> lk(_ch._mtx);
+      if (T* front = _ch._ring.front()) {
+        _value.emplace(std::move(*front));
+        _ch._ring.pop_front();
+        if (auto* s = _pop(_ch._senders)) {
+          (void)_ch._ring.push(std::move(s->_value));
+          _ch._ex.schedule(s);
+        }
+        return false;
+      }
+      if (auto* s = _pop(_ch._senders)) {
+        _value.emplace(std::move(s->_value));
+        _ch._ex.schedule(s);
+        return false;
+      }
+      if (_ch._closed) {
+        return false;
+      }
+      _handle = handle_;
+      _push(_ch._receivers, this);
+      return true;
+    }
+
+    std::optional<T> await_resume() noexcept {
+      return std::move(_value);
+    }
+
+  private:
+    channel&          _ch;
+    std::optional<T>  _value;
+
+    friend class channel;
+  };
+
+private:
+  template <typename W>
+  struct waiters {
+    W* _head{nullptr};
+    W* _tail{nullptr};
+  };
+
+  template <typename W>
+  static void _push(waiters<W>& q_, W* w_) noexcept {
+    w_->_next = nullptr;
+    if (q_._tail) q_._tail->_next = w_;
+    else q_._head = w_;
+    q_._tail = w_;
+  }
+
+  template <typename W>
+  static W* _pop(waiters<W>& q_) noexcept {
+    W* w = q_._head;
+    if (w) {
+      q_._head = static_cast<W*>(w->_next);
+      if (!q_._head) q_._tail = nullptr;
+    }
+    return w;
+  }
+
+  executor&               _ex;
+  std::mutex              _mtx;
+  buffer_ring<T>          _ring;
+  waiters<send_awaiter>   _senders;
+  waiters<recv_awaiter>   _receivers;
+  bool                    _closed{false};
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* CHANNEL_H_ */
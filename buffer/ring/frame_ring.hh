@@ -0,0 +1,236 @@
+/**************************************************************************************
+* Frame Ring (Variable-length Message Ring)
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: frame_ring.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * The frame ring is a single-producer/single-consumer byte ring which carries
+ * length-prefixed frames of variable size.
+ *
+ * Both sides work in place with a two-phase API, so a message is never copied into
+ * or out of an intermediate buffer and nothing is allocated per message:
+ *
+ *   producer: p = reserve(n); <write up to n bytes at p>; commit(m);   (m <= n)
+ *   consumer: f = peek(); <read f.size bytes at f.data>; release();
+ *
+ * Every frame starts with an 8-byte header and is padded to 8 bytes, so payloads are
+ * always 8-byte aligned. A frame never wraps around the end of the ring: when there
+ * is not enough contiguous room left, the producer writes a padding frame and starts
+ * over at offset 0. Hence the largest frame is max_frame_size(), half the capacity.
+ */
+#ifndef FRAME_RING_H_
+#define FRAME_RING_H_
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#ifndef CPPLIBS_CACHELINE_SIZE
+#define CPPLIBS_CACHELINE_SIZE 64
+#endif
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+class frame_ring
+{
+public:
+  /**
+   * A frame as seen by the consumer. data is nullptr if the ring is empty.
+   */
+  struct frame {
+    void*       data;
+    std::size_t size;
+
+    explicit operator bool() const noexcept { return data != nullptr; }
+  };
+
+  /**
+   * Construct a ring of capacity_ bytes, rounded up to a power of two.
+   */
+  explicit frame_ring(std::size_t capacity_) {
+    if (capacity_ < 4 * HEADER_SIZE || capacity_ > (std::size_t(1) << 31)) {
+      throw std::invalid_argument("Frame ring capacity is out of range!");
+    }
+    _capacity = HEADER_SIZE;
+    while (_capacity < capacity_) _capacity <<= 1;
+    _mask = _capacity - 1;
+    _data = static_cast<char*>(::operator new(_capacity,
+                                              std::align_val_t{CPPLIBS_CACHELINE_SIZE}));
+  }
+
+  ~frame_ring() {
+    ::operator delete(_data, std::align_val_t{CPPLIBS_CACHELINE_SIZE});
+  }
+
+  frame_ring(frame_ring&&) = delete;
+  frame_ring(const frame_ring&) = delete;
+  frame_ring& operator=(frame_ring&&) = delete;
+  frame_ring& operator=(const frame_ring&) = delete;
+
+  /**
+   * Get the ring capacity in bytes.
+   */
+  std::size_t capacity() const noexcept {
+    return _capacity;
+  }
+
+  /**
+   * Get the largest payload a single frame can carry.
+   */
+  std::size_t max_frame_size() const noexcept {
+    return _capacity / 2 - HEADER_SIZE;
+  }
+
+  /**
+   * Check whether there is no committed frame left to consume.
+   */
+  bool empty() const noexcept {
+    return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+  }
+
+  /**
+   * Producer: reserve room for a frame of up to size_ bytes.
+   *
+   * @param[in] size_ Maximum number of payload bytes that will be written.
+   * @return Pointer to the payload area, or nullptr if the ring is currently full.
+   *         Throws std::length_error if size_ exceeds max_frame_size().
+   */
+  void* reserve(std::size_t size_) {
+    if (size_ > max_frame_size()) {
+      throw std::length_error("Frame is larger than the frame ring can carry!");
+    }
+
+    const std::uint64_t need = _align(HEADER_SIZE + size_);
+    const std::uint64_t head = _head.load(std::memory_order_relaxed);
+    const std::uint64_t contiguous = _capacity - (head & _mask);
+    const std::uint64_t skip = (need > contiguous) ? contiguous : 0;
+
+    if (head + skip + need - _tail_cache > _capacity) {
+      _tail_cache = _tail.load(std::memory_order_acquire);
+      if (head + skip + need - _tail_cache > _capacity) {
+        return nullptr;
+      }
+    }
+
+    if (skip) {
+      _write_header(head, PADDING, 0);
+    }
+    _reserved = head + skip;
+    _reserved_size = size_;
+    return _data + ((_reserved & _mask) + HEADER_SIZE);
+  }
+
+  /**
+   * Producer: publish the frame obtained by the last reserve().
+   *
+   * @param[in] size_ Number of payload bytes actually written, at most the reserved
+   *                  size. Committing zero bytes publishes an empty frame.
+   */
+  void commit(std::size_t size_) noexcept {
+    if (size_ > _reserved_size) size_ = _reserved_size;
+    _write_header(_reserved, DATA, static_cast<std::uint32_t>(size_));
+    _head.store(_reserved + _align(HEADER_SIZE + size_), std::memory_order_release);
+  }
+
+  /**
+   * Producer: copy size_ bytes into a new frame. Shortcut for reserve/memcpy/commit.
+   *
+   * @return false if the ring is currently full.
+   */
+  bool push(const void* data_, std::size_t size_) {
+    void* p = reserve(size_);
+    if (!p) return false;
+    memcpy(p, data_, size_);
+    commit(size_);
+    return true;
+  }
+
+  /**
+   * Consumer: look at the oldest committed frame without consuming it.
+   * The frame stays valid and unchanged until release() is called.
+   */
+  frame peek() noexcept {
+    std::uint64_t tail = _tail.load(std::memory_order_relaxed);
+    for (;;) {
+      if (tail == _head_cache) {
+        _head_cache = _head.load(std::memory_order_acquire);
+        if (tail == _head_cache) {
+          return frame{nullptr, 0};
+        }
+      }
+
+      header h;
+      memcpy(&h, _data + (tail & _mask), HEADER_SIZE);
+      if (h.type == PADDING) {
+        tail += _capacity - (tail & _mask);
+        _tail.store(tail, std::memory_order_release);
+        continue;
+      }
+      return frame{_data + ((tail & _mask) + HEADER_SIZE), h.size};
+    }
+  }
+
+  /**
+   * Consumer: drop the frame returned by the last successful peek().
+   */
+  void release() noexcept {
+    const std::uint64_t tail = _tail.load(std::memory_order_relaxed);
+    header h;
+    memcpy(&h, _data + (tail & _mask), HEADER_SIZE);
+    _tail.store(tail + _align(HEADER_SIZE + h.size), std::memory_order_release);
+  }
+
+private:
+  enum : std::uint32_t { DATA = 0x46524d45, PADDING = 0x50414444 };
+  struct header {
+    std::uint32_t size;
+    std::uint32_t type;
+  };
+  static constexpr std::size_t HEADER_SIZE = sizeof(header);
+
+  static constexpr std::uint64_t _align(std::uint64_t n_) noexcept {
+    return (n_ + (HEADER_SIZE - 1)) & ~std::uint64_t(HEADER_SIZE - 1);
+  }
+
+  void _write_header(std::uint64_t pos_, std::uint32_t type_, std::uint32_t size_) noexcept {
+    header h{size_, type_};
+    memcpy(_data + (pos_ & _mask), &h, HEADER_SIZE);
+  }
+
+  char*         _data{nullptr};
+  std::size_t   _capacity{0};
+  std::size_t   _mask{0};
+
+  /// Producer side
+  alignas(CPPLIBS_CACHELINE_SIZE)
+  std::atomic<std::uint64_t>  _head{0};
+  std::uint64_t               _tail_cache{0};
+  std::uint64_t               _reserved{0};
+  std::size_t                 _reserved_size{0};
+
+  /// Consumer side
+  alignas(CPPLIBS_CACHELINE_SIZE)
+  std::atomic<std::uint64_t>  _tail{0};
+  std::uint64_t               _head_cache{0};
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* FRAME_RING_H_ */
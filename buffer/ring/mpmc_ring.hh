@@ -0,0 +1,185 @@
+/**************************************************************************************
+* MPMC Ring (Bounded Multi-producer/Multi-consumer Queue)
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: mpmc_ring.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * The mpmc ring is a bounded lock-free queue for any number of producers and
+ * consumers (D. Vyukov's bounded MPMC queue): every slot carries a sequence number
+ * telling whether it is free for the producer of a given position or filled for the
+ * consumer of that position. A push or a pop is one CAS on the shared index.
+ *
+ * Slots are preallocated and reused, and the in-place API lets a producer fill a
+ * slot and a consumer read it where they are, so large elements are never copied:
+ *
+ *   q.try_emplace_with([](T& slot_) { ... fill ... });
+ *   q.try_consume([](T& slot_) { ... read ... });
+ *
+ * A slot is claimed before the in-place function runs and handed over after, so the
+ * function must not throw (checked at compile time): a slot left claimed would stall
+ * the queue for good.
+ *
+ * The data type T must be default constructible, and nothrow move assignable for
+ * try_push() and try_pop().
+ */
+#ifndef MPMC_RING_H_
+#define MPMC_RING_H_
+
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <utility>
+#include <stdexcept>
+#include <type_traits>
+
+#ifndef CPPLIBS_CACHELINE_SIZE
+#define CPPLIBS_CACHELINE_SIZE 64
+#endif
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+template <typename T>
+class mpmc_ring
+{
+public:
+  /**
+   * Construct a queue of capacity_ slots, rounded up to a power of two.
+   */
+  explicit mpmc_ring(std::size_t capacity_) {
+    if (capacity_ < 2) {
+      throw std::invalid_argument("MPMC ring capacity must be at least 2!");
+    }
+    std::size_t c = 1;
+    while (c < capacity_) c <<= 1;
+    _mask = c - 1;
+    _cells.reset(new cell[c]);
+    for (std::size_t i = 0; i < c; ++i) {
+      _cells[i]._seq.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  ~mpmc_ring() = default;
+
+  mpmc_ring(mpmc_ring&&) = delete;
+  mpmc_ring(const mpmc_ring&) = delete;
+  mpmc_ring& operator=(mpmc_ring&&) = delete;
+  mpmc_ring& operator=(const mpmc_ring&) = delete;
+
+  std::size_t capacity() const noexcept {
+    return _mask + 1;
+  }
+
+  /**
+   * Approximate number of elements, exact only when the queue is quiescent.
+   */
+  std::size_t size() const noexcept {
+    const std::uint64_t e = _enqueue.load(std::memory_order_acquire);
+    const std::uint64_t d = _dequeue.load(std::memory_order_acquire);
+    return e > d ? static_cast<std::size_t>(e - d) : 0;
+  }
+
+  /**
+   * Producer: claim a free slot and let fn_(T&) fill it in place.
+   *
+   * @return false if the queue is full, fn_ is not called then.
+   */
+  template <typename F>
+  bool try_emplace_with(F&& fn_) {
+    static_assert(std::is_nothrow_invocable_v<F&, T&>, "The slot filler must be noexcept");
+    std::uint64_t pos = _enqueue.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;) {
+      c = &_cells[pos & _mask];
+      const std::uint64_t seq = c->_seq.load(std::memory_order_acquire);
+      const std::int64_t dif = static_cast<std::int64_t>(seq - pos);
+      if (dif == 0) {
+        if (_enqueue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _enqueue.load(std::memory_order_relaxed);
+      }
+    }
+    fn_(c->_value);
+    c->_seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_push(const T& value_) {
+    T copy(value_);   // May throw, before a slot is claimed
+    return try_push(std::move(copy));
+  }
+
+  bool try_push(T&& value_) {
+    return try_emplace_with([&value_](T& slot_) noexcept(std::is_nothrow_move_assignable_v<T>) {
+      slot_ = std::move(value_);
+    });
+  }
+
+  /**
+   * Consumer: take the oldest element and let fn_(T&) read it in place.
+   *
+   * @return false if the queue is empty, fn_ is not called then.
+   */
+  template <typename F>
+  bool try_consume(F&& fn_) {
+    static_assert(std::is_nothrow_invocable_v<F&, T&>, "The slot reader must be noexcept");
+    std::uint64_t pos = _dequeue.load(std::memory_order_relaxed);
+    cell* c;
+    for (;;) {
+      c = &_cells[pos & _mask];
+      const std::uint64_t seq = c->_seq.load(std::memory_order_acquire);
+      const std::int64_t dif = static_cast<std::int64_t>(seq - (pos + 1));
+      if (dif == 0) {
+        if (_dequeue.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (dif < 0) {
+        return false;
+      } else {
+        pos = _dequeue.load(std::memory_order_relaxed);
+      }
+    }
+    fn_(c->_value);
+    c->_seq.store(pos + _mask + 1, std::memory_order_release);
+    return true;
+  }
+
+  bool try_pop(T& out_) {
+    return try_consume([&out_](T& slot_) noexcept(std::is_nothrow_move_assignable_v<T>) {
+      out_ = std::move(slot_);
+    });
+  }
+
+private:
+  struct cell {
+    std::atomic<std::uint64_t>  _seq;
+    T                           _value{};
+  };
+
+  std::unique_ptr<cell[]>     _cells;
+  std::size_t                 _mask{0};
+
+  alignas(CPPLIBS_CACHELINE_SIZE)
+  std::atomic<std::uint64_t>  _enqueue{0};
+  alignas(CPPLIBS_CACHELINE_SIZE)
+  std::atomic<std::uint64_t>  _dequeue{0};
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* MPMC_RING_H_ */
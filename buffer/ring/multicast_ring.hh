@@ -0,0 +1,249 @@
+/**************************************************************************************
+* Multicast Ring (Disruptor-style Broadcast Ring)
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: multicast_ring.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * The multicast ring delivers every event to every consumer. There is one shared
+ * array of preallocated slots; an event is written once in place by a producer and
+ * read in place by all consumers, nothing is copied nor allocated per event.
+ *
+ *  - Each event gets a sequence number 0, 1, 2, ... Producers (any number) claim a
+ *    sequence, fill its slot and publish it.
+ *  - Each consumer has its own cursor: the sequence of the next event it will read.
+ *  - A producer never overwrites a slot until all consumers moved past it, i.e. the
+ *    producers gate on the slowest consumer.
+ *  - A consumer may depend on other consumers (a barrier): it only sees an event
+ *    once all of its dependencies are done with it, so i.e. "persist" can run after
+ *    "validate" on the same event without another queue in between.
+ *
+ * Consumers must be added before the first event is claimed.
+ *
+ *   multicast_ring<event> r(1024);
+ *   auto& log     = r.add_consumer();
+ *   auto& persist = r.add_consumer({&log});
+ *   r.publish_with([](event& e_) { e_.x = 42; });
+ *   persist.poll([](const event& e_, std::uint64_t seq_) { ... });
+ */
+#ifndef MULTICAST_RING_H_
+#define MULTICAST_RING_H_
+
+#include <sched.h>
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <initializer_list>
+
+#ifndef CPPLIBS_CACHELINE_SIZE
+#define CPPLIBS_CACHELINE_SIZE 64
+#endif
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+template <typename T>
+class multicast_ring
+{
+public:
+  /**
+   * A consumer of the ring: its own cursor plus the cursors it depends on.
+   */
+  class consumer
+  {
+  public:
+    consumer(multicast_ring& ring_, std::vector<const consumer*>&& deps_):
+      _ring{ring_}, _deps{std::move(deps_)} { }
+
+    consumer(consumer&&) = delete;
+    consumer(const consumer&) = delete;
+    consumer& operator=(consumer&&) = delete;
+    consumer& operator=(const consumer&) = delete;
+
+    /**
+     * Get the sequence of the next event this consumer will read.
+     */
+    std::uint64_t cursor() const noexcept {
+      return _cursor.load(std::memory_order_acquire);
+    }
+
+    /**
+     * Process, in place, every event currently available to this consumer.
+     *
+     * @param[in] fn_ Callable as fn_(const T& event, std::uint64_t seq).
+     * @param[in] max_ Maximum number of events to process in this batch.
+     * @return Number of processed events.
+     */
+    template <typename F>
+    std::size_t poll(F&& fn_, std::size_t max_ = std::numeric_limits<std::size_t>::max()) {
+      const std::uint64_t begin = _cursor.load(std::memory_order_relaxed);
+      std::uint64_t limit = begin + max_;
+      if (limit < begin) limit = std::numeric_limits<std::uint64_t>::max();
+      for (const consumer* d : _deps) {
+        const std::uint64_t c = d->cursor();
+        if (c < limit) limit = c;
+      }
+
+      std::uint64_t end = begin;
+      while (end < limit && _ring._is_published(end)) ++end;
+      for (std::uint64_t seq = begin; seq < end; ++seq) {
+        fn_(static_cast<const T&>(_ring._slots[seq & _ring._mask]), seq);
+      }
+      if (end != begin) {
+        _cursor.store(end, std::memory_order_release);
+      }
+      return static_cast<std::size_t>(end - begin);
+    }
+
+  private:
+    multicast_ring&                   _ring;
+    std::vector<const consumer*>      _deps;
+    alignas(CPPLIBS_CACHELINE_SIZE)
+    std::atomic<std::uint64_t>        _cursor{0};
+
+    friend class multicast_ring;
+  };
+
+  /**
+   * Construct a ring of capacity_ preallocated slots, rounded up to a power of two.
+   * T must be default constructible, the slots are reused for the ring's lifetime.
+   */
+  explicit multicast_ring(std::size_t capacity_) {
+    if (!capacity_) {
+      throw std::invalid_argument("Multicast ring capacity cannot be Zero!");
+    }
+    std::size_t c = 1;
+    while (c < capacity_) c <<= 1;
+    _mask = c - 1;
+    _slots.reset(new T[c]);
+    _published.reset(new std::atomic<std::uint64_t>[c]);
+    for (std::size_t i = 0; i < c; ++i) {
+      _published[i].store(NONE, std::memory_order_relaxed);
+    }
+  }
+
+  ~multicast_ring() = default;
+
+  multicast_ring(multicast_ring&&) = delete;
+  multicast_ring(const multicast_ring&) = delete;
+  multicast_ring& operator=(multicast_ring&&) = delete;
+  multicast_ring& operator=(const multicast_ring&) = delete;
+
+  std::size_t capacity() const noexcept {
+    return _mask + 1;
+  }
+
+  /**
+   * Add a consumer. It sees an event only after all of deps_ are done with it.
+   * Must be called before any event is claimed.
+   *
+   * @param[in] deps_ Consumers of this ring the new consumer depends on.
+   */
+  consumer& add_consumer(std::initializer_list<const consumer*> deps_ = {}) {
+    if (_claim.load(std::memory_order_relaxed)) {
+      throw std::logic_error("Consumers must be added before publishing events!");
+    }
+    for (const consumer* d : deps_) {
+      if (!d || &d->_ring != this) {
+        throw std::invalid_argument("Consumer dependency is not a consumer of this ring!");
+      }
+    }
+    _consumers.emplace_back(
+      std::make_unique<consumer>(*this, std::vector<const consumer*>(deps_)));
+    return *_consumers.back();
+  }
+
+  /**
+   * Producer: claim the next sequence. Waits while the slowest consumer is a full
+   * ring behind. The slot must then be filled through operator[] and published.
+   */
+  std::uint64_t claim() noexcept {
+    const std::uint64_t seq = _claim.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t wrap = seq - _mask;   // first sequence not in the same slot
+    if (seq > _mask &&
+        _gating_cache.load(std::memory_order_acquire) < wrap) {
+      unsigned spins = 0;
+      std::uint64_t gate;
+      while ((gate = _min_cursor()) < wrap) {
+        if (++spins > 64) { sched_yield(); spins = 0; }
+      }
+      _gating_cache.store(gate, std::memory_order_release);
+    }
+    return seq;
+  }
+
+  /**
+   * Producer: access the slot of a claimed sequence.
+   */
+  T& operator[](std::uint64_t seq_) noexcept {
+    return _slots[seq_ & _mask];
+  }
+
+  /**
+   * Producer: make a claimed and filled sequence visible to consumers.
+   */
+  void publish(std::uint64_t seq_) noexcept {
+    _published[seq_ & _mask].store(seq_, std::memory_order_release);
+  }
+
+  /**
+   * Producer: claim a slot, let fn_(T&) fill it in place, then publish it.
+   *
+   * @return The published sequence.
+   */
+  template <typename F>
+  std::uint64_t publish_with(F&& fn_) {
+    const std::uint64_t seq = claim();
+    fn_(_slots[seq & _mask]);
+    publish(seq);
+    return seq;
+  }
+
+private:
+  static constexpr std::uint64_t NONE = std::numeric_limits<std::uint64_t>::max();
+
+  bool _is_published(std::uint64_t seq_) const noexcept {
+    return _published[seq_ & _mask].load(std::memory_order_acquire) == seq_;
+  }
+
+  std::uint64_t _min_cursor() const noexcept {
+    std::uint64_t m = NONE;
+    for (const auto& c : _consumers) {
+      const std::uint64_t v = c->cursor();
+      if (v < m) m = v;
+    }
+    return m;
+  }
+
+  std::unique_ptr<T[]>                          _slots;
+  std::unique_ptr<std::atomic<std::uint64_t>[]> _published;
+  std::vector<std::unique_ptr<consumer>>        _consumers;
+  std::size_t                                   _mask{0};
+
+  alignas(CPPLIBS_CACHELINE_SIZE)
+  std::atomic<std::uint64_t>  _claim{0};        ///< Next sequence to claim
+  alignas(CPPLIBS_CACHELINE_SIZE)
+  std::atomic<std::uint64_t>  _gating_cache{0}; ///< Last known slowest consumer
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* MULTICAST_RING_H_ */
@@ -0,0 +1,247 @@
+/**************************************************************************************
+* Shared Memory Buffer Ring
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: shm_ring.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * The shared memory ring places a buffer_ring into a shared memory object, so two
+ * processes on the same host exchange elements without a syscall or a copy through
+ * the kernel per message.
+ *
+ * The shared memory object is either a named POSIX shared memory object (shm_open)
+ * or any shareable file descriptor, i.e. from memfd_create passed to a child process
+ * or over a Unix domain socket. Its layout is
+ *
+ *   [ shm header | buffer_ring region ]
+ *
+ * Attach/detach semantics:
+ *  - Attaching is serialized with flock() on the object. The first process to attach
+ *    formats the ring. A process dying while formatting releases the lock and the
+ *    next one formats again, because the ring magic is written last.
+ *  - Each side (producer, consumer) is claimed by the pid of the attached process.
+ *    A side claimed by a live process, the calling one included, cannot be claimed
+ *    again: one shm_ring per side. A side claimed by a dead process is taken over,
+ *    so a crashed peer can simply be restarted.
+ *  - A producer dying in the middle of a push never publishes a partial element. A
+ *    consumer dying in the middle of a pop gets that element delivered again.
+ *
+ * Elements are copied bytewise across processes, so T must be trivially copyable.
+ */
+#ifndef SHM_RING_H_
+#define SHM_RING_H_
+
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <atomic>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include "buffer_ring.hh"
+
+namespace anhthd {
+namespace cpplibs {
+namespace buffer {
+template <typename T>
+class shm_ring
+{
+  static_assert(std::is_trivially_copyable<T>::value,
+                "shm_ring elements must be trivially copyable");
+  static_assert(std::atomic<pid_t>::is_always_lock_free,
+                "shm_ring requires address-free pid atomics");
+
+public:
+  enum class role {
+    ePRODUCER = 0,
+    eCONSUMER = 1
+  };
+
+  /**
+   * Attach to the named shared memory object name_ (i.e. "/my-ring"), creating it
+   * with room for capacity_ elements if it does not exist yet.
+   *
+   * @param[in] name_ POSIX shared memory object name
+   * @param[in] capacity_ Ring capacity, must match the existing ring if any
+   * @param[in] role_ Side of the ring this process is going to use
+   */
+  shm_ring(const std::string& name_, std::size_t capacity_, role role_):
+    _role{role_} {
+    int fd = shm_open(name_.c_str(), O_RDWR | O_CREAT, 0600);
+    if (fd < 0) {
+      _throw_errno("Cannot open shared memory object " + name_);
+    }
+    _attach(fd, capacity_);
+  }
+
+  /**
+   * Attach to the shared memory object referred by fd_, i.e. a memfd_create()
+   * descriptor inherited from the parent process. The descriptor is duplicated, the
+   * caller keeps ownership of fd_.
+   */
+  shm_ring(int fd_, std::size_t capacity_, role role_):
+    _role{role_} {
+    int fd = dup(fd_);
+    if (fd < 0) {
+      _throw_errno("Cannot duplicate shared memory descriptor");
+    }
+    _attach(fd, capacity_);
+  }
+
+  /**
+   * Detach: release the claimed side and unmap the ring. The shared memory object
+   * survives, use unlink() to remove a named one.
+   */
+  ~shm_ring() {
+    if (_hdr) {
+      pid_t self = getpid();
+      (void)_hdr->_owner[(int)_role].compare_exchange_strong(self, 0);
+    }
+    delete _ring;
+    if (_region != MAP_FAILED) munmap(_region, _size);
+    if (_fd >= 0) close(_fd);
+  }
+
+  shm_ring(shm_ring&&) = delete;
+  shm_ring(const shm_ring&) = delete;
+  shm_ring& operator=(shm_ring&&) = delete;
+  shm_ring& operator=(const shm_ring&) = delete;
+
+  /**
+   * Remove the named shared memory object. Attached processes keep their mapping.
+   */
+  static bool unlink(const std::string& name_) noexcept {
+    return 0 == shm_unlink(name_.c_str());
+  }
+
+  /**
+   * Get the number of bytes the shared memory object needs for capacity_ elements.
+   */
+  static std::size_t footprint(std::size_t capacity_) {
+    return sizeof(header) + buffer_ring<T>::footprint(capacity_);
+  }
+
+  /**
+   * Check whether the other side of the ring is attached by a live process.
+   */
+  bool peer_attached() const noexcept {
+    return _alive(_hdr->_owner[1 - (int)_role].load(std::memory_order_acquire));
+  }
+
+  /**
+   * Access the underlying ring. Only the operations of the claimed side may be used.
+   */
+  buffer_ring<T>& ring() noexcept {
+    return *_ring;
+  }
+
+  bool push(const T& value_) {
+    return _ring->push(value_);
+  }
+
+  std::optional<T> pop() {
+    return _ring->pop();
+  }
+
+private:
+  struct alignas(CPPLIBS_CACHELINE_SIZE) header {
+    std::atomic<pid_t> _owner[2];   ///< Pid of the producer/consumer, 0 if none
+  };
+
+  static bool _alive(pid_t pid_) noexcept {
+    return pid_ > 0 && (0 == kill(pid_, 0) || errno == EPERM);
+  }
+
+  [[noreturn]] static void _throw_errno(const std::string& what_) {
+    std::stringstream ss;
+    ss << what_ << ": " << strerror(errno);
+    throw std::runtime_error(ss.str());
+  }
+
+  void _attach(int fd_, std::size_t capacity_) {
+    _fd = fd_;
+    _size = footprint(capacity_);
+
+    if (flock(_fd, LOCK_EX) < 0) {
+      close(_fd);
+      _throw_errno("Cannot lock shared memory object");
+    }
+    try {
+      _map_and_claim(capacity_);
+    } catch (...) {
+      (void)flock(_fd, LOCK_UN);
+      if (_region != MAP_FAILED) munmap(_region, _size);
+      close(_fd);
+      delete _ring;
+      throw;
+    }
+    (void)flock(_fd, LOCK_UN);
+  }
+
+  void _map_and_claim(std::size_t capacity_) {
+    struct stat st;
+    if (fstat(_fd, &st) < 0) {
+      _throw_errno("Cannot stat shared memory object");
+    }
+    bool fresh = (st.st_size == 0);
+    if (fresh && ftruncate(_fd, (off_t)_size) < 0) {
+      _throw_errno("Cannot size shared memory object");
+    }
+    if (!fresh && (std::size_t)st.st_size != _size) {
+      throw std::runtime_error("Shared memory ring exists with a different capacity");
+    }
+
+    _region = mmap(nullptr, _size, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+    if (_region == MAP_FAILED) {
+      _throw_errno("Cannot map shared memory object");
+    }
+
+    void* rr = static_cast<char*>(_region) + sizeof(header);
+    if (!buffer_ring<T>::is_formatted(rr)) {
+      new (_region) header{};
+      buffer_ring<T>::format(rr, capacity_);
+    }
+    _hdr = static_cast<header*>(_region);
+
+    auto& owner = _hdr->_owner[(int)_role];
+    pid_t prev = owner.load(std::memory_order_acquire);
+    if (_alive(prev)) {
+      throw std::runtime_error("Shared memory ring side is attached by a live process");
+    }
+    owner.store(getpid(), std::memory_order_release);
+    _ring = new buffer_ring<T>(rr);
+  }
+
+  role            _role;
+  int             _fd{-1};
+  std::size_t     _size{0};
+  void*           _region{MAP_FAILED};
+  header*         _hdr{nullptr};
+  buffer_ring<T>* _ring{nullptr};
+};
+};  // namespace buffer
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* SHM_RING_H_ */
@@ -0,0 +1,179 @@
+/*
+ * file   bench_shm_ring.cc
+ * brief  Compare the throughput of shm_ring against a pipe and a Unix domain socket
+ *        for local IPC between a parent (producer) and a child (consumer) process.
+ *
+ *        g++ -std=c++17 -O3 -pthread bench_shm_ring.cc -o bench_shm_ring
+ *        ./bench_shm_ring [messages]
+ *
+ *    Author: anhthd
+ */
+
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "../shm_ring.hh"
+
+using namespace std;
+using namespace std::chrono;
+using anhthd::cpplibs::buffer::shm_ring;
+
+struct message {
+  std::uint64_t seq;
+  std::int64_t  sent_ns;
+  char          payload[48];
+};
+
+using ring_t = shm_ring<message>;
+
+static std::int64_t now_ns() {
+  return duration_cast<nanoseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Spin a little, then give the CPU away, so the benchmark stays meaningful when
+ * producer and consumer share a core.
+ */
+static void backoff(unsigned& spins_) {
+  if (++spins_ > 64) {
+    sched_yield();
+    spins_ = 0;
+  }
+}
+
+static bool read_full(int fd_, void* buf_, size_t len_) {
+  char* p = static_cast<char*>(buf_);
+  while (len_) {
+    ssize_t rc = read(fd_, p, len_);
+    if (rc <= 0) return false;
+    p += rc;
+    len_ -= (size_t)rc;
+  }
+  return true;
+}
+
+static bool write_full(int fd_, const void* buf_, size_t len_) {
+  const char* p = static_cast<const char*>(buf_);
+  while (len_) {
+    ssize_t rc = write(fd_, p, len_);
+    if (rc <= 0) return false;
+    p += rc;
+    len_ -= (size_t)rc;
+  }
+  return true;
+}
+
+/**
+ * The child consumes N messages and reports the mean one-way latency through a pipe.
+ */
+static void report(const char* name_, std::uint64_t n_, std::int64_t elapsed_ns_,
+                   int result_fd_) {
+  double mean_lat = 0;
+  if (!read_full(result_fd_, &mean_lat, sizeof(mean_lat))) mean_lat = -1;
+  printf("%-12s messages=%llu  throughput=%.2f Mmsg/s  %.1f ns/msg  "
+         "mean latency=%.0f ns\n", name_, (unsigned long long)n_,
+         (double)n_ * 1e3 / (double)elapsed_ns_, (double)elapsed_ns_ / (double)n_,
+         mean_lat);
+}
+
+static void bench_stream(const char* name_, int rfd_, int wfd_, std::uint64_t n_) {
+  int res[2];
+  if (pipe(res) < 0) return;
+
+  pid_t child = fork();
+  if (child == 0) {
+    close(wfd_);
+    double lat = 0;
+    message m;
+    for (std::uint64_t i = 0; i < n_; ++i) {
+      if (!read_full(rfd_, &m, sizeof(m)) || m.seq != i) _exit(EXIT_FAILURE);
+      lat += (double)(now_ns() - m.sent_ns);
+    }
+    lat /= (double)n_;
+    (void)write_full(res[1], &lat, sizeof(lat));
+    _exit(EXIT_SUCCESS);
+  }
+
+  close(rfd_);
+  auto start = now_ns();
+  message m{};
+  for (std::uint64_t i = 0; i < n_; ++i) {
+    m.seq = i;
+    m.sent_ns = now_ns();
+    if (!write_full(wfd_, &m, sizeof(m))) break;
+  }
+  report(name_, n_, now_ns() - start, res[0]);
+  close(wfd_);
+  waitpid(child, nullptr, 0);
+  close(res[0]);
+  close(res[1]);
+}
+
+static void bench_shm(std::uint64_t n_) {
+  int res[2];
+  if (pipe(res) < 0) return;
+  int fd = memfd_create("bench_shm_ring", 0);
+  if (fd < 0) return;
+
+  pid_t child = fork();
+  if (child == 0) {
+    ring_t consumer(fd, 4096, ring_t::role::eCONSUMER);
+    auto& r = consumer.ring();
+    double lat = 0;
+    for (std::uint64_t i = 0; i < n_; ++i) {
+      message* m;
+      unsigned spins = 0;
+      while (!(m = r.front())) backoff(spins);
+      if (m->seq != i) _exit(EXIT_FAILURE);
+      lat += (double)(now_ns() - m->sent_ns);
+      r.pop_front();
+    }
+    lat /= (double)n_;
+    (void)write_full(res[1], &lat, sizeof(lat));
+    _exit(EXIT_SUCCESS);
+  }
+
+  {
+    ring_t producer(fd, 4096, ring_t::role::ePRODUCER);
+    auto& r = producer.ring();
+    auto start = now_ns();
+    message m{};
+    for (std::uint64_t i = 0; i < n_; ++i) {
+      m.seq = i;
+      m.sent_ns = now_ns();
+      unsigned spins = 0;
+      while (!r.push(m)) backoff(spins);
+    }
+    report("shm_ring", n_, now_ns() - start, res[0]);
+  }
+  waitpid(child, nullptr, 0);
+  close(fd);
+  close(res[0]);
+  close(res[1]);
+}
+
+int main(int argc, char** argv)
+{
+  std::uint64_t n = (argc > 1) ? strtoull(argv[1], nullptr, 10) : 2000000;
+  printf("message size: %zu bytes\n", sizeof(message));
+
+  bench_shm(n);
+
+  int p[2];
+  if (0 == pipe(p)) bench_stream("pipe", p[0], p[1], n);
+
+  int s[2];
+  if (0 == socketpair(AF_UNIX, SOCK_STREAM, 0, s)) bench_stream("unix_socket", s[0], s[1], n);
+
+  return 0;
+}
@@ -0,0 +1,81 @@
+/*
+ * file   test_channel.cc
+ * brief  Producer/consumer coroutines exchanging values through a channel, on the
+ *        single-threaded executor and on a thread pool.
+ *
+ *        g++ -std=c++20 -pthread test_channel.cc
+ *
+ *    Author: anhthd
+ */
+
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../channel.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::buffer;
+
+static task producer(channel<std::uint64_t>& ch_, std::uint64_t from_, std::uint64_t n_,
+                     std::atomic<int>& done_) {
+  for (std::uint64_t i = from_; i < from_ + n_; ++i) {
+    if (!co_await ch_.send(i)) break;
+  }
+  done_++;
+}
+
+static task consumer(channel<std::uint64_t>& ch_, std::atomic<std::uint64_t>& sum_,
+                     std::atomic<std::uint64_t>& count_, std::atomic<int>& done_) {
+  while (auto v = co_await ch_.recv()) {
+    sum_ += *v;
+    count_++;
+  }
+  done_++;
+}
+
+int main(int argc, char** argv)
+{
+  const std::uint64_t N = 100000;
+  {
+    single_thread_executor ex;
+    channel<std::uint64_t> ch(ex, 16);
+    std::atomic<std::uint64_t> sum{0}, count{0};
+    std::atomic<int> pdone{0}, cdone{0};
+
+    ex.spawn(consumer(ch, sum, count, cdone));
+    ex.spawn(producer(ch, 1, N, pdone));
+    std::size_t resumes = ex.run();
+    ch.close();
+    ex.run();
+
+    cout << "single_thread_executor: capacity " << ch.capacity() << ", received "
+         << count << ", sum " << sum << " (expected " << N * (N + 1) / 2 << "), "
+         << resumes << " resumptions" << endl;
+    if (sum != N * (N + 1) / 2 || cdone != 1) return EXIT_FAILURE;
+  }
+  cout << "================================================" << endl;
+  {
+    const int P = 4, C = 4;
+    std::atomic<std::uint64_t> sum{0}, count{0};
+    std::atomic<int> pdone{0}, cdone{0};
+    thread_pool_executor ex(4);
+    channel<std::uint64_t> ch(ex, 8);
+
+    for (int c = 0; c < C; ++c) ex.spawn(consumer(ch, sum, count, cdone));
+    for (int p = 0; p < P; ++p) ex.spawn(producer(ch, 1 + p * N, N, pdone));
+    while (pdone.load() < P) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    ch.close();
+    while (cdone.load() < C) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+
+    const std::uint64_t M = P * N;
+    cout << "thread_pool_executor: received " << count << ", sum "
+         << sum << " (expected " << M * (M + 1) / 2 << ")" << endl;
+    if (count != M || sum != M * (M + 1) / 2) return EXIT_FAILURE;
+  }
+  return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * file   test_frame_ring.cc
+ * brief  Push variable-length frames through frame_ring from one thread and verify
+ *        them in place on another thread.
+ *
+ *    Author: anhthd
+ */
+
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#include "../frame_ring.hh"
+
+using namespace std;
+using anhthd::cpplibs::buffer::frame_ring;
+
+static size_t frame_size(size_t i) {
+  return 16 + (i * 7919) % 4096;
+}
+
+int main(int argc, char** argv)
+{
+  frame_ring fr(64 * 1024);
+  cout << "Capacity: " << fr.capacity() << endl;
+  cout << "Max frame size: " << fr.max_frame_size() << endl;
+  cout << "================================================" << endl;
+
+  const size_t N = 200000;
+  std::thread producer([&fr, N]() {
+    for (size_t i = 0; i < N; ++i) {
+      const size_t n = frame_size(i);
+      char* p = nullptr;
+      while (!(p = static_cast<char*>(fr.reserve(n)))) std::this_thread::yield();
+      memcpy(p, &i, sizeof(i));
+      memset(p + sizeof(i), (int)(i & 0xff), n - sizeof(i));
+      fr.commit(n);
+    }
+  });
+
+  size_t errors = 0;
+  for (size_t i = 0; i < N; ++i) {
+    frame_ring::frame f;
+    while (!(f = fr.peek())) std::this_thread::yield();
+    const char* p = static_cast<const char*>(f.data);
+    size_t seq;
+    memcpy(&seq, p, sizeof(seq));
+    if (seq != i || f.size != frame_size(i) ||
+        (unsigned char)p[f.size - 1] != (i & 0xff)) {
+      ++errors;
+    }
+    fr.release();
+  }
+  producer.join();
+
+  cout << "Frames: " << N << ", errors: " << errors << endl;
+  cout << "Empty: " << std::boolalpha << fr.empty() << endl;
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
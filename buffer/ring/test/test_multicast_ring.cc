@@ -0,0 +1,71 @@
+/*
+ * file   test_multicast_ring.cc
+ * brief  Two producers publish into a multicast_ring read by three consumers, one
+ *        of them gated behind another one.
+ *
+ *    Author: anhthd
+ */
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../multicast_ring.hh"
+
+using namespace std;
+using anhthd::cpplibs::buffer::multicast_ring;
+
+struct event {
+  std::uint64_t producer;
+  std::uint64_t value;
+};
+
+int main(int argc, char** argv)
+{
+  const std::uint64_t N = 500000;   // per producer
+  multicast_ring<event> ring(256);
+  auto& logging = ring.add_consumer();
+  auto& metrics = ring.add_consumer();
+  auto& persist = ring.add_consumer({&logging});
+  cout << "Capacity: " << ring.capacity() << endl;
+  cout << "================================================" << endl;
+
+  std::thread producers[2];
+  for (std::uint64_t p = 0; p < 2; ++p) {
+    producers[p] = std::thread([&ring, p, N]() {
+      for (std::uint64_t i = 0; i < N; ++i) {
+        ring.publish_with([p, i](event& e_) { e_.producer = p; e_.value = i; });
+      }
+    });
+  }
+
+  std::atomic<std::size_t> errors{0};
+  auto run = [&errors, N](multicast_ring<event>::consumer& c_,
+                          const multicast_ring<event>::consumer* dep_) {
+    std::uint64_t next[2] = {0, 0};
+    std::uint64_t seen = 0;
+    while (seen < 2 * N) {
+      std::size_t n = c_.poll([&](const event& e_, std::uint64_t seq_) {
+        if (e_.value != next[e_.producer]++) ++errors;
+        if (dep_ && dep_->cursor() <= seq_) ++errors;
+      });
+      if (!n) std::this_thread::yield();
+      seen += n;
+    }
+  };
+
+  std::thread t1(run, std::ref(logging), nullptr);
+  std::thread t2(run, std::ref(metrics), nullptr);
+  std::thread t3(run, std::ref(persist), &logging);
+  for (auto& p : producers) p.join();
+  t1.join();
+  t2.join();
+  t3.join();
+
+  cout << "Events: " << 2 * N << ", cursors: " << logging.cursor() << " "
+       << metrics.cursor() << " " << persist.cursor() << ", errors: " << errors << endl;
+  return errors ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,99 @@
+/*
+ * file   test_shm_ring.cc
+ * brief  Exchange elements between two processes through a named shm_ring, then
+ *        check that a crashed consumer can be replaced.
+ *
+ *    Author: anhthd
+ */
+
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "../shm_ring.hh"
+
+using namespace std;
+using anhthd::cpplibs::buffer::shm_ring;
+
+struct message {
+  std::uint64_t seq;
+  char          text[56];
+};
+
+using ring_t = shm_ring<message>;
+
+int main(int argc, char** argv)
+{
+  const std::string name = "/cpplibs-test-shm-ring-" + std::to_string(getpid());
+  const std::uint64_t N = 1000000;
+  int failures = 0;
+
+  pid_t child = fork();
+  if (child == 0) {
+    ring_t consumer(name, 1024, ring_t::role::eCONSUMER);
+    std::uint64_t expected = 0;
+    while (expected < N) {
+      auto m = consumer.pop();
+      if (!m) continue;
+      if (m->seq != expected++) _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+
+  {
+    ring_t producer(name, 1024, ring_t::role::ePRODUCER);
+    for (std::uint64_t i = 0; i < N; ++i) {
+      message m{i, "hello from the other side"};
+      while (!producer.push(m)) { }
+    }
+    int status = 0;
+    waitpid(child, &status, 0);
+    const bool exchanged = WIFEXITED(status) && !WEXITSTATUS(status);
+    failures += !exchanged;
+    cout << "Exchanged " << N << " messages: " << (exchanged ? "OK" : "FAILED") << endl;
+    cout << "================================================" << endl;
+
+    /// The producer side is taken, by this very process
+    try {
+      ring_t twin(name, 1024, ring_t::role::ePRODUCER);
+      ++failures;
+      cout << "Second producer in the same process attached: FAILED" << endl;
+    } catch (const std::runtime_error& e) {
+      cout << "Second producer in the same process rejected: " << e.what() << endl;
+    }
+
+    /// A consumer killed while attached, must be replaceable
+    child = fork();
+    if (child == 0) {
+      ring_t consumer(name, 1024, ring_t::role::eCONSUMER);
+      pause();
+      _exit(EXIT_SUCCESS);
+    }
+    while (!producer.peer_attached()) usleep(1000);
+    try {
+      ring_t twin(name, 1024, ring_t::role::eCONSUMER);
+      ++failures;
+      cout << "Second live consumer attached: FAILED" << endl;
+    } catch (const std::runtime_error& e) {
+      cout << "Second live consumer rejected: " << e.what() << endl;
+    }
+    kill(child, SIGKILL);
+    waitpid(child, &status, 0);
+    failures += producer.peer_attached();
+    cout << "Consumer crashed, peer attached: " << std::boolalpha
+         << producer.peer_attached() << endl;
+
+    ring_t replacement(name, 1024, ring_t::role::eCONSUMER);
+    failures += !producer.peer_attached();
+    cout << "Replacement consumer attached: " << producer.peer_attached() << endl;
+  }
+
+  ring_t::unlink(name);
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
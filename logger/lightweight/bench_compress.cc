@@ -0,0 +1,112 @@
+/*
+ * file   bench_compress.cc
+ * brief  Throughput of the rotated-file compression, and its effect on the latency
+ *        of foreground logging.
+ *
+ *        g++ -std=c++17 -O2 -pthread bench_compress.cc -o bench_compress
+ *        ./bench_compress [megabytes] [messages] [directory]
+ *
+ *        Add -DLOG_COMPRESS_ZLIB and -lz to measure gzip instead of LZ4.
+ *
+ *    Author: anhthd
+ */
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+/**
+ * Per-call latency of n_ messages into a rotating log file, compressed or not.
+ */
+static void latency(const std::string& dir_, int n_, bool compress_) {
+  const std::string file = dir_ + "/bench_compress.log";
+  const std::string ext = compress::file_codec::extension();
+  for (int i = 0; i <= 4; ++i) {
+    const std::string b = i ? backup_name(fs::path(file.c_str()), i) : file;
+    (void)std::remove(b.c_str());
+    (void)std::remove((b + ext).c_str());
+  }
+
+  std::vector<std::int64_t> ns(n_);
+  std::shared_ptr<backup_compressor> gz;
+  {
+    logger lg;
+    lg.set_log_level(LogLevel::eINFO);
+    lg.set_log_file(fs::path(file.c_str()), 8 << 20, 4, compress_);
+    if (compress_) gz = lg.compressor();
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < n_; ++i) {
+      const auto t0 = std::chrono::steady_clock::now();
+      lg.print_log(LogLevel::eINFO, "bench", "request %d done in %d ms, user %s",
+                   i, i % 97, "someone@example.com");
+      ns[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count();
+    }
+    const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    std::sort(ns.begin(), ns.end());
+    auto pct = [&ns](double p_) { return ns[std::min(ns.size() - 1, (std::size_t)(p_ * ns.size()))]; };
+    printf("logging compression=%s messages=%d seconds=%.3f p50=%lld p99=%lld p99.9=%lld "
+           "max=%lld ns\n", compress_ ? ext.c_str() + 1 : "off", n_, sec, (long long)pct(0.5),
+           (long long)pct(0.99), (long long)pct(0.999), (long long)ns.back());
+  }
+  if (gz) {
+    gz->wait_idle();
+    const auto st = gz->get_stats();
+    printf("background files=%llu in=%llu out=%llu ratio=%.2f busy=%.3f s\n",
+           (unsigned long long)st._files, (unsigned long long)st._bytes_in,
+           (unsigned long long)st._bytes_out,
+           st._bytes_out ? (double)st._bytes_in / st._bytes_out : 0.0, st._seconds);
+  }
+}
+
+int main(int argc, char** argv)
+{
+  const int mb = (argc > 1) ? atoi(argv[1]) : 64;
+  const int n = (argc > 2) ? atoi(argv[2]) : 500000;
+  const std::string dir = (argc > 3) ? argv[3] : "/tmp";
+
+  // Codec throughput on log-like text.
+  const std::string in_path = dir + "/bench_compress.in";
+  const std::string out_path = in_path + compress::file_codec::extension();
+  {
+    FILE* f = fopen(in_path.c_str(), "w");
+    if (!f) return 1;
+    for (long i = 0; ftell(f) < (long)mb << 20; ++i) {
+      fprintf(f, "19-10-2026 10:%02ld:%02ld.%06ld |    INFO | server.cc:%ld | request %ld "
+              "done in %ld ms, user %s\n", i / 60000 % 60, i / 1000 % 60, i % 1000000,
+              40 + i % 7, i, i % 97, (i % 3) ? "someone@example.com" : "other@example.org");
+    }
+    fclose(f);
+  }
+  compress::file_codec codec;
+  const int in = ::open(in_path.c_str(), O_RDONLY);
+  const int out = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  std::uint64_t bytes = 0;
+  const auto t0 = std::chrono::steady_clock::now();
+  const bool ok = codec.compress(in, out, bytes);
+  const double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+  const long packed = ::lseek(out, 0, SEEK_END);
+  ::close(in);
+  ::close(out);
+  printf("codec=%s ok=%d in=%llu out=%ld ratio=%.2f seconds=%.3f throughput=%.1f MB/s\n",
+         compress::file_codec::extension() + 1, ok, (unsigned long long)bytes, packed,
+         packed ? (double)bytes / packed : 0.0, sec, bytes / sec / (1 << 20));
+  (void)std::remove(in_path.c_str());
+  (void)std::remove(out_path.c_str());
+
+  latency(dir, n, false);
+  latency(dir, n, true);
+  return 0;
+}
@@ -0,0 +1,196 @@
+/*
+ * file   bench_logger.cc
+ * brief  Logger benchmark suite: per-call latency percentiles and aggregate
+ *        throughput, 1 to N threads, for every sink type.
+ *
+ *        g++ -std=c++17 -O2 -pthread bench_logger.cc -o bench_logger
+ *        ./bench_logger [messages-per-thread] [mode|all] [log-file] [max-threads]
+ *
+ *        null: sync call sites, a stream that drops the lines (formatting cost).
+ *        console: sync call sites, console_stream; stdout goes to /dev/null so the
+ *        terminal speed is not measured.
+ *        file: sync call sites, the default file_stream.
+ *        async: async call sites, file_stream written by the backend thread. The
+ *        throughput includes draining the queue.
+ *        writev: sync call sites, the log file is a batched writev_stream.
+ *        mmap: sync call sites, the log file is a memory-mapped mmap_stream.
+ *        binary: BIN_INFO call sites, the backend writes a binary log to be read
+ *        with log_decoder.
+ *        filtered: DEBUG call sites below the INFO level. The latency of a call is
+ *        the mean of a batch of 100 calls, one call being below the timer
+ *        resolution.
+ *
+ *        all (default) runs every mode, each in its own process.
+ *
+ *        One JSON object per line on stdout, i.e. to be compared between commits:
+ *        {"mode":"file","threads":4,"messages":80000,"seconds":0.123,
+ *         "throughput":650000,"p50_ns":900,"p99_ns":4000,"p999_ns":9000,"max_ns":80000}
+ *        Latencies include the timer overhead, reported once as mode "timer".
+ *
+ *    Author: anhthd
+ */
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "binary_log.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+using bench_clock = std::chrono::steady_clock;
+
+static const char* MODES[] = {"null", "console", "file", "async", "writev", "mmap", "binary",
+                              "filtered"};
+
+/**
+ * Drops the lines.
+ */
+class null_stream: public log_stream
+{
+public:
+  void print_log(const std::string_view& msg_) override {
+    (void)msg_;
+  }
+};
+
+static std::int64_t elapsed_ns(bench_clock::time_point t0_) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(bench_clock::now() - t0_).count();
+}
+
+static void report(FILE* out_, const std::string& mode_, int threads_, long messages_,
+                   double seconds_, std::vector<std::int64_t>& ns_) {
+  std::sort(ns_.begin(), ns_.end());
+  auto pct = [&ns_](double p_) {
+    return ns_.empty() ? 0 : ns_[std::min(ns_.size() - 1, (std::size_t)(p_ * ns_.size()))];
+  };
+  fprintf(out_, "{\"mode\":\"%s\",\"threads\":%d,\"messages\":%ld,\"seconds\":%.6f,"
+          "\"throughput\":%.0f,\"p50_ns\":%lld,\"p99_ns\":%lld,\"p999_ns\":%lld,"
+          "\"max_ns\":%lld}\n", mode_.c_str(), threads_, messages_, seconds_,
+          messages_ / seconds_, (long long)pct(0.5), (long long)pct(0.99),
+          (long long)pct(0.999), (long long)(ns_.empty() ? 0 : ns_.back()));
+  fflush(out_);
+}
+
+/**
+ * Cost of reading the clock twice, the floor of every latency.
+ */
+static void timer_overhead(FILE* out_, int n_) {
+  std::vector<std::int64_t> ns(n_);
+  const auto start = bench_clock::now();
+  for (int i = 0; i < n_; ++i) {
+    const auto t0 = bench_clock::now();
+    ns[i] = elapsed_ns(t0);
+  }
+  const double sec = std::chrono::duration<double>(bench_clock::now() - start).count();
+  report(out_, "timer", 1, n_, sec, ns);
+}
+
+/**
+ * Messages of thread t_, timed one by one.
+ */
+static void produce(const std::string& mode_, int t_, int n_, std::int64_t* ns_) {
+  if (mode_ == "binary") {
+    for (int i = 0; i < n_; ++i) {
+      const auto t0 = bench_clock::now();
+      BIN_INFO("thread %d message %d value %f", t_, i, i * 0.5);
+      ns_[i] = elapsed_ns(t0);
+    }
+  } else if (mode_ == "filtered") {
+    constexpr int BATCH = 100;
+    for (int i = 0; i < n_; ++i) {
+      const auto t0 = bench_clock::now();
+      for (int j = 0; j < BATCH; ++j) {
+        DEBUG("thread %d message %d value %f", t_, i, j * 0.5);
+      }
+      ns_[i] = elapsed_ns(t0) / BATCH;
+    }
+  } else {
+    for (int i = 0; i < n_; ++i) {
+      const auto t0 = bench_clock::now();
+      INFO("thread %d message %d value %f", t_, i, i * 0.5);
+      ns_[i] = elapsed_ns(t0);
+    }
+  }
+}
+
+static int run(FILE* out_, const std::string& mode_, int n_, const std::string& file_,
+               int max_threads_) {
+  (void)std::remove(file_.c_str());
+  LOGGER.set_log_level(LogLevel::eINFO);
+  if (mode_ == "null" || mode_ == "filtered") {
+    LOGGER.add_stream(std::make_unique<null_stream>());
+  } else if (mode_ == "console") {
+    const int devnull = ::open("/dev/null", O_WRONLY);
+    if (devnull < 0 || ::dup2(devnull, STDOUT_FILENO) < 0) return 1;
+    ::close(devnull);
+    LOGGER.enable_console();
+  } else if (mode_ == "writev") {
+    LOGGER.add_stream(std::make_unique<writev_stream>(fs::path(file_.c_str())));
+  } else if (mode_ == "mmap") {
+    LOGGER.add_stream(std::make_unique<mmap_stream>(fs::path(file_.c_str()), 1ull << 30));
+  } else if (mode_ == "file" || mode_ == "async") {
+    LOGGER.set_log_file(fs::path(file_.c_str()), 0x7fffffff, 1);
+  } else if (mode_ != "binary") {
+    fprintf(stderr, "Unknown mode %s\n", mode_.c_str());
+    return 1;
+  }
+  if (mode_ == "async") LOGGER.enable_async();
+  if (mode_ == "binary") BINLOGGER.enable(fs::path(file_.c_str()));
+
+  std::vector<std::int64_t> ns((std::size_t)n_ * max_threads_);
+  for (int threads = 1; threads <= max_threads_; threads *= 2) {
+    std::vector<std::thread> ts;
+    const auto t0 = bench_clock::now();
+    for (int t = 0; t < threads; ++t) {
+      ts.emplace_back(produce, mode_, t, n_, &ns[(std::size_t)t * n_]);
+    }
+    for (auto& th : ts) th.join();
+    if (mode_ == "async" || mode_ == "writev") LOGGER.flush();
+    if (mode_ == "binary") BINLOGGER.flush();
+    const double sec = std::chrono::duration<double>(bench_clock::now() - t0).count();
+    std::vector<std::int64_t> all(ns.begin(), ns.begin() + (std::size_t)threads * n_);
+    const long messages = (long)threads * n_ * (mode_ == "filtered" ? 100 : 1);
+    report(out_, mode_, threads, messages, sec, all);
+  }
+  if (mode_ == "binary") BINLOGGER.disable();
+  return 0;
+}
+
+int main(int argc, char** argv)
+{
+  const int n = (argc > 1) ? atoi(argv[1]) : 20000;
+  const std::string mode = (argc > 2) ? argv[2] : "all";
+  const std::string file = (argc > 3) ? argv[3] : "/tmp/bench_logger.log";
+  const int max_threads = (argc > 4) ? atoi(argv[4]) : 32;
+
+  // Results go to the original stdout, the console mode takes fd 1 over.
+  FILE* out = fdopen(::dup(STDOUT_FILENO), "w");
+  if (!out || n <= 0 || max_threads <= 0) return 1;
+  if (mode != "all") return run(out, mode, n, file, max_threads);
+
+  timer_overhead(out, n);
+  int failed = 0;
+  for (const char* m : MODES) {
+    // A process per mode: LOGGER is a singleton and its streams cannot be removed.
+    const pid_t pid = fork();
+    if (pid == 0) {
+      _exit(run(out, m, n, file, max_threads));
+    }
+    int status = 0;
+    waitpid(pid, &status, 0);
+    failed += !(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+  }
+  (void)std::remove(file.c_str());
+  return failed ? 1 : 0;
+}
@@ -0,0 +1,855 @@
+/**************************************************************************************
+* Lightweight Logger - Deferred Binary Logging
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: binary_log.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * Binary mode of the lightweight logger, for call sites where even a vsnprintf is
+ * too expensive. Nothing is formatted at the call site:
+ *
+ *  - Every BIN_* call site owns a static descriptor (level, file, line, format) and
+ *    gets a small integer ID the first time it logs.
+ *  - The call site writes the ID, a timestamp and the raw argument bytes into a
+ *    frame_ring of its own thread. No lock, no allocation, no formatting.
+ *  - A backend thread drains the thread buffers and either
+ *     * appends compact records to a binary file (IDs, timestamp deltas and
+ *       integers as varints, the format strings once per call site), to be turned
+ *       into text offline by log_decoder, or
+ *     * formats them to text and hands them over to a logger.
+ *
+ *   binary::get_binary_instance().enable(filesystem::path("app.blog"));
+ *   BIN_INFO("order %d filled at %f", id, px);
+ *   $ ./log_decoder app.blog
+ *
+ * Supported arguments: integers, enums, floating point, C strings, std::string,
+ * std::string_view and pointers. Formats use printf conversions (with `*` widths);
+ * the length modifiers are ignored since the argument types are recorded.
+ */
+#ifndef BINARY_LOG_H_
+#define BINARY_LOG_H_
+
+#include <stdio.h>
+#include <string.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <condition_variable>
+
+#include "logger.hh"
+#include "thread_rings.hh"
+#include "../../buffer/ring/frame_ring.hh"
+
+namespace anhthd {
+namespace cpplibs {
+namespace logger {
+namespace lightweight {
+namespace binary {
+#define MAX_BIN_ARGS 32
+
+enum class arg_type : char {
+  eINT      = 'i',    ///< Signed integer, 8 bytes
+  eUINT     = 'u',    ///< Unsigned integer, 8 bytes
+  eDOUBLE   = 'f',    ///< Floating point, 8 bytes
+  eSTRING   = 's',    ///< 4-byte length then the characters
+  ePOINTER  = 'p'     ///< Address, 8 bytes
+};
+
+/**
+ * Static descriptor of a BIN_* call site. _id is 0 until the site first logs.
+ */
+struct call_site {
+  LogLevel    _lvl;
+  const char* _file;    ///< Base name
+  int         _line;
+  const char* _fmt;
+  mutable std::atomic<std::uint32_t> _id{0};
+};
+
+/**
+ * How an argument of type T is recorded in a thread buffer.
+ */
+template <typename T, typename = void>
+struct arg_codec;
+
+template <typename T>
+struct arg_codec<T, std::enable_if_t<std::is_integral<T>::value>> {
+  static constexpr arg_type type = std::is_signed<T>::value ? arg_type::eINT : arg_type::eUINT;
+  static std::size_t size(T) noexcept { return 8; }
+  static char* write(char* p_, T v_) noexcept {
+    if constexpr (std::is_signed<T>::value) {
+      const std::int64_t w = v_;
+      memcpy(p_, &w, 8);
+    } else {
+      const std::uint64_t w = v_;
+      memcpy(p_, &w, 8);
+    }
+    return p_ + 8;
+  }
+};
+
+template <typename T>
+struct arg_codec<T, std::enable_if_t<std::is_enum<T>::value>> {
+  using base = arg_codec<std::underlying_type_t<T>>;
+  static constexpr arg_type type = base::type;
+  static std::size_t size(T) noexcept { return 8; }
+  static char* write(char* p_, T v_) noexcept {
+    return base::write(p_, static_cast<std::underlying_type_t<T>>(v_));
+  }
+};
+
+template <typename T>
+struct arg_codec<T, std::enable_if_t<std::is_floating_point<T>::value>> {
+  static constexpr arg_type type = arg_type::eDOUBLE;
+  static std::size_t size(T) noexcept { return 8; }
+  static char* write(char* p_, T v_) noexcept {
+    const double w = v_;
+    memcpy(p_, &w, 8);
+    return p_ + 8;
+  }
+};
+
+struct string_codec {
+  static constexpr arg_type type = arg_type::eSTRING;
+  static std::size_t size(std::string_view v_) noexcept { return 4 + v_.size(); }
+  static char* write(char* p_, std::string_view v_) noexcept {
+    const std::uint32_t n = static_cast<std::uint32_t>(v_.size());
+    memcpy(p_, &n, 4);
+    memcpy(p_ + 4, v_.data(), n);
+    return p_ + 4 + n;
+  }
+};
+
+template <>
+struct arg_codec<const char*> {
+  static constexpr arg_type type = arg_type::eSTRING;
+  static std::size_t size(const char* v_) noexcept {
+    return string_codec::size(v_ ? v_ : "(null)");
+  }
+  static char* write(char* p_, const char* v_) noexcept {
+    return string_codec::write(p_, v_ ? v_ : "(null)");
+  }
+};
+
+template <> struct arg_codec<char*>: arg_codec<const char*> { };
+template <> struct arg_codec<std::string>: string_codec { };
+template <> struct arg_codec<std::string_view>: string_codec { };
+
+template <typename T>
+struct arg_codec<T*, std::enable_if_t<!std::is_same<std::remove_cv_t<T>, char>::value>> {
+  static constexpr arg_type type = arg_type::ePOINTER;
+  static std::size_t size(T*) noexcept { return 8; }
+  static char* write(char* p_, T* v_) noexcept {
+    const std::uint64_t w = reinterpret_cast<std::uintptr_t>(v_);
+    memcpy(p_, &w, 8);
+    return p_ + 8;
+  }
+};
+
+/**
+ * Argument type signature of a call site, i.e. "isf" for (int, const char*, double).
+ */
+template <typename... A>
+struct signature {
+  static constexpr char value[] = {static_cast<char>(arg_codec<std::decay_t<A>>::type)..., '\0'};
+};
+
+/**
+ * A decoded argument.
+ */
+struct arg_value {
+  arg_type          _type{arg_type::eINT};
+  union {
+    std::int64_t    _i;
+    std::uint64_t   _u{0};
+    double          _f;
+  };
+  std::string_view  _s{};
+};
+
+/**
+ * Format fmt_ with decoded arguments, printf style.
+ */
+inline std::string format(const char* fmt_, const arg_value* args_, std::size_t nargs_) {
+  std::string out;
+  std::size_t next = 0;
+  char spec[64];
+
+  auto append = [&out](const char* spec_, auto... v_) {
+    int n = snprintf(nullptr, 0, spec_, v_...);
+    if (n <= 0) return;
+    const std::size_t at = out.size();
+    out.resize(at + n + 1);
+    snprintf(&out[at], n + 1, spec_, v_...);
+    out.resize(at + n);
+  };
+  auto as_int = [](const arg_value& a_) -> long long {
+    return a_._type == arg_type::eDOUBLE ? (long long)a_._f : (long long)a_._i;
+  };
+
+  for (const char* p = fmt_; *p; ++p) {
+    if (*p != '%') {
+      out += *p;
+      continue;
+    }
+    if (p[1] == '%') {
+      out += '%';
+      ++p;
+      continue;
+    }
+
+    // %[flags][width][.precision][length]conversion
+    const char* start = p++;
+    std::size_t len = 0;
+    spec[len++] = '%';
+    while (*p && strchr("-+ #0", *p) && len < 16) spec[len++] = *p++;
+    for (int part = 0; part < 2; ++part) {
+      if (part == 1) {
+        if (*p != '.') break;
+        spec[len++] = *p++;
+      }
+      if (*p == '*') {
+        ++p;
+        const int w = next < nargs_ ? (int)as_int(args_[next++]) : 0;
+        len += snprintf(spec + len, 16, "%d", w);
+      }
+      while (*p >= '0' && *p <= '9' && len < 40) spec[len++] = *p++;
+    }
+    while (*p && strchr("hljztL", *p)) ++p;
+    const char conv = *p;
+    if (!conv || next >= nargs_) {
+      out.append(start, *p ? p - start + 1 : p - start);
+      if (!*p) break;
+      continue;
+    }
+
+    const arg_value& a = args_[next++];
+    if (strchr("di", conv)) {
+      memcpy(spec + len, "lld", 4);
+      append(spec, as_int(a));
+    } else if (strchr("ouxX", conv)) {
+      spec[len++] = 'l'; spec[len++] = 'l'; spec[len++] = conv; spec[len] = '\0';
+      append(spec, (unsigned long long)as_int(a));
+    } else if (conv == 'c') {
+      spec[len++] = 'c'; spec[len] = '\0';
+      append(spec, (int)as_int(a));
+    } else if (strchr("fFeEgGaA", conv)) {
+      spec[len++] = conv; spec[len] = '\0';
+      append(spec, a._type == arg_type::eDOUBLE ? a._f :
+                   a._type == arg_type::eINT ? (double)a._i : (double)a._u);
+    } else if (conv == 's' && a._type == arg_type::eSTRING) {
+      if (memchr(spec, '.', len)) {   // An explicit precision wins over the length
+        spec[len++] = 's'; spec[len] = '\0';
+        append(spec, std::string(a._s).c_str());
+      } else {
+        memcpy(spec + len, ".*s", 4);
+        append(spec, (int)a._s.size(), a._s.data());
+      }
+    } else if (conv == 'p') {
+      spec[len++] = 'p'; spec[len] = '\0';
+      append(spec, reinterpret_cast<void*>(static_cast<std::uintptr_t>(a._u)));
+    } else {
+      out.append(start, p - start + 1);   // Unsupported or mismatched conversion
+    }
+  }
+  return out;
+}
+
+/**
+ * Compact encoding of the binary log file.
+ */
+namespace wire {
+static constexpr char MAGIC[8] = {'L', 'W', 'B', 'L', 'O', 'G', '\0', '\1'};
+
+inline void put_varint(std::string& out_, std::uint64_t v_) {
+  while (v_ >= 0x80) {
+    out_ += static_cast<char>(v_ | 0x80);
+    v_ >>= 7;
+  }
+  out_ += static_cast<char>(v_);
+}
+
+inline std::uint64_t zigzag(std::int64_t v_) noexcept {
+  return (static_cast<std::uint64_t>(v_) << 1) ^ static_cast<std::uint64_t>(v_ >> 63);
+}
+
+inline std::int64_t unzigzag(std::uint64_t v_) noexcept {
+  return static_cast<std::int64_t>(v_ >> 1) ^ -static_cast<std::int64_t>(v_ & 1);
+}
+};  // namespace wire
+
+/**
+ * Reads back a binary log file written by binary_logger.
+ */
+class log_reader
+{
+public:
+  struct site {
+    LogLevel    _lvl{LogLevel::eINFO};
+    std::string _file;
+    int         _line{0};
+    std::string _fmt;
+    std::string _sig;
+    bool        _known{false};
+  };
+
+  struct entry {
+    const site*     _site{nullptr};
+    std::uint64_t   _ns{0};           ///< Nanoseconds since epoch
+    std::string     _msg;
+  };
+
+  explicit log_reader(const filesystem::path& file_) {
+    _f = fopen(file_.raw(), "rb");
+    if (!_f) {
+      throw std::runtime_error(std::string("Cannot open binary log ") + file_.raw());
+    }
+    char magic[sizeof(wire::MAGIC)];
+    if (fread(magic, 1, sizeof(magic), _f) != sizeof(magic) ||
+        memcmp(magic, wire::MAGIC, sizeof(magic))) {
+      fclose(_f);
+      throw std::runtime_error(std::string("Not a binary log ") + file_.raw());
+    }
+  }
+
+  ~log_reader() {
+    fclose(_f);
+  }
+
+  log_reader(log_reader&&) = delete;
+  log_reader(const log_reader&) = delete;
+  log_reader& operator=(log_reader&&) = delete;
+  log_reader& operator=(const log_reader&) = delete;
+
+  /**
+   * Read the next message.
+   *
+   * @return false at the end of the file. Throws std::runtime_error if corrupted.
+   */
+  bool next(entry& e_) {
+    for (;;) {
+      std::uint64_t id;
+      if (!_varint(id, true)) return false;
+      if (!id) {
+        _read_site();
+        continue;
+      }
+      if (id > _sites.size() || !_sites[id - 1]._known) {
+        throw std::runtime_error("Binary log refers to an unknown call site");
+      }
+      const site& s = _sites[id - 1];
+      std::uint64_t delta;
+      _varint(delta);
+      _ns += wire::unzigzag(delta);
+
+      arg_value args[MAX_BIN_ARGS];
+      std::size_t nargs = 0;
+      _strings.clear();
+      _strings.reserve(s._sig.size());
+      for (char t : s._sig) {
+        arg_value& a = args[nargs++];
+        a._type = static_cast<arg_type>(t);
+        std::uint64_t v = 0;
+        switch (a._type) {
+        case arg_type::eINT:      _varint(v); a._i = wire::unzigzag(v); break;
+        case arg_type::eUINT:
+        case arg_type::ePOINTER:  _varint(v); a._u = v; break;
+        case arg_type::eDOUBLE:   _read(&a._f, 8); break;
+        case arg_type::eSTRING:
+          _varint(v);
+          _strings.emplace_back(v, '\0');
+          _read(&_strings.back()[0], v);
+          a._s = _strings.back();
+          break;
+        default:
+          throw std::runtime_error("Binary log has an unknown argument type");
+        }
+      }
+      e_._site = &s;
+      e_._ns = _ns;
+      e_._msg = format(s._fmt.c_str(), args, nargs);
+      return true;
+    }
+  }
+
+private:
+  void _read(void* p_, std::size_t n_) {
+    if (n_ && fread(p_, 1, n_, _f) != n_) {
+      throw std::runtime_error("Binary log is truncated");
+    }
+  }
+
+  bool _varint(std::uint64_t& v_, bool eof_ok_ = false) {
+    v_ = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+      const int c = fgetc(_f);
+      if (c == EOF) {
+        if (eof_ok_ && !shift) return false;
+        throw std::runtime_error("Binary log is truncated");
+      }
+      v_ |= static_cast<std::uint64_t>(c & 0x7f) << shift;
+      if (!(c & 0x80)) return true;
+    }
+    throw std::runtime_error("Binary log has a bad varint");
+  }
+
+  std::string _read_string() {
+    std::uint64_t n;
+    _varint(n);
+    std::string s(n, '\0');
+    _read(&s[0], n);
+    return s;
+  }
+
+  void _read_site() {
+    std::uint64_t id, lvl, line;
+    _varint(id);
+    _varint(lvl);
+    _varint(line);
+    if (!id || id > (1u << 24)) {
+      throw std::runtime_error("Binary log has a bad call site");
+    }
+    if (id > _sites.size()) _sites.resize(id);
+    site& s = _sites[id - 1];
+    s._lvl = static_cast<LogLevel>(lvl);
+    s._line = static_cast<int>(line);
+    s._file = _read_string();
+    s._fmt = _read_string();
+    s._sig = _read_string();
+    s._known = true;
+    if (s._sig.size() > MAX_BIN_ARGS) {
+      throw std::runtime_error("Binary log call site has too many arguments");
+    }
+  }
+
+  FILE*                     _f{nullptr};
+  std::vector<site>         _sites;
+  std::vector<std::string>  _strings;   ///< Storage of the current string arguments
+  std::uint64_t             _ns{0};
+};
+
+/**
+ * Owns the thread buffers and the backend thread of the binary mode.
+ */
+class binary_logger
+{
+public:
+  binary_logger() = default;
+
+  ~binary_logger() {
+    disable();
+  }
+
+  binary_logger(binary_logger&&) = delete;
+  binary_logger(const binary_logger&) = delete;
+  binary_logger& operator=(binary_logger&&) = delete;
+  binary_logger& operator=(const binary_logger&) = delete;
+
+  /**
+   * Start the backend writing a binary log file, decoded later by log_decoder.
+   *
+   * @param[in] file_ Binary log file, truncated.
+   * @param[in] buffer_size_ Size in bytes of each thread buffer. A call site waits
+   *                         while the buffer of its thread is full.
+   */
+  void enable(const filesystem::path& file_, std::size_t buffer_size_ = 1 << 20) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (_backend.joinable()) {
+      throw std::logic_error("Binary logging is already enabled");
+    }
+    _out = fopen(file_.raw(), "wb");
+    if (!_out) {
+      throw std::runtime_error(std::string("Cannot open binary log ") + file_.raw());
+    }
+    setvbuf(_out, nullptr, _IOFBF, 1 << 20);
+    fwrite(wire::MAGIC, 1, sizeof(wire::MAGIC), _out);
+    _start(buffer_size_);
+  }
+
+  /**
+   * Start the backend formatting messages to text and writing them to target_.
+   * target_ must outlive the binary logger, or at least its disable(): the
+   * destructor disables. LOGGER outlives BINLOGGER.
+   */
+  void enable(logger& target_, std::size_t buffer_size_ = 1 << 20) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (_backend.joinable()) {
+      throw std::logic_error("Binary logging is already enabled");
+    }
+    _target = &target_;
+    _start(buffer_size_);
+  }
+
+  /**
+   * Stop the backend once every pending message is written. Messages logged while
+   * disabled are dropped.
+   */
+  void disable() {
+    std::unique_lock<std::mutex> lk(_mtx);
+    if (!_backend.joinable()) return;
+    _enabled.store(false, std::memory_order_release);
+    _stop.store(true, std::memory_order_release);
+    lk.unlock();
+    _backend.join();
+    _drain_all();     // Messages committed while the backend was exiting
+    _flush_output();
+    const std::uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+    if (dropped && _target) {
+      _target->print_log(LogLevel::eWARNING, "binary", std::string_view(
+                           "Dropped " + std::to_string(dropped) + " messages larger than a frame"));
+    }
+    _buffers.close();   // The next enable() hands out new buffers
+    lk.lock();
+    if (_out) fclose(_out);
+    _out = nullptr;
+    _target = nullptr;
+    _written_sites = 0;
+    _last_ns = 0;
+    _flush_cv.notify_all();
+  }
+
+  bool enabled() const noexcept {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Messages dropped since enable() for not fitting in a thread buffer frame (half
+   * the buffer).
+   */
+  std::uint64_t dropped() const noexcept {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+  void set_log_level(LogLevel min_lvl_) noexcept {
+    _min_lvl.store(min_lvl_, std::memory_order_relaxed);
+  }
+
+  bool is_enabled_for(LogLevel lvl_) const noexcept {
+    return !(lvl_ < _min_lvl.load(std::memory_order_relaxed)) &&
+           _enabled.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Barrier: return once every message logged before the call is written out.
+   */
+  void flush() {
+    std::unique_lock<std::mutex> lk(_mtx);
+    if (!_backend.joinable()) return;
+    const std::uint64_t req = _flush_req.fetch_add(1, std::memory_order_acq_rel) + 1;
+    _flush_cv.wait(lk, [this, req]() {
+      return _flush_done >= req || !_backend.joinable() || _stop.load();
+    });
+  }
+
+  /**
+   * Call site: record one message. Only the ID, a timestamp and the raw argument
+   * bytes are copied. The arguments are checked against the format F::value() at
+   * compile time, see format.hh. A message larger than a frame of the thread
+   * buffer, i.e. with a huge string argument, is dropped and counted.
+   *
+   * @param[in] fmt_ The format literal, also carried by F and site_.
+   */
+  template <typename F, typename... A>
+  void log(const call_site& site_, const char* fmt_, const A&... args_) {
+    static_assert(sizeof...(A) <= MAX_BIN_ARGS, "Too many binary log arguments");
+    detail::validate<F, A...>();
+    (void)fmt_;
+    std::uint32_t id = site_._id.load(std::memory_order_acquire);
+    if (!id) id = _register(site_, signature<A...>::value);
+
+    const std::size_t size = HEADER + (std::size_t{0} + ... + arg_codec<std::decay_t<A>>::size(args_));
+    thread_buffer* tb = _buffers.local();
+    if (!tb || size > tb->_ring.max_frame_size()) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    char* p = static_cast<char*>(_reserve(*tb, size));
+    if (!p) return;
+
+    const std::uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+    memcpy(p, &id, 4);
+    memcpy(p + 8, &ns, 8);
+    char* q = p + HEADER;
+    ((q = arg_codec<std::decay_t<A>>::write(q, args_)), ...);
+    (void)q;
+    tb->_ring.commit(size);
+  }
+
+private:
+  static constexpr std::size_t HEADER = 16;   ///< u32 id, u32 pad, u64 ns
+
+  struct thread_buffer {
+    explicit thread_buffer(std::size_t size_): _ring{size_} { }
+    buffer::frame_ring  _ring;
+  };
+
+  struct site_def {
+    const call_site*  _site;
+    const char*       _sig;
+  };
+
+  void _start(std::size_t buffer_size_) {
+    _buffers.open(buffer_size_);
+    _dropped.store(0, std::memory_order_relaxed);
+    _stop.store(false, std::memory_order_relaxed);
+    _backend = std::thread([this]() { _run_backend(); });
+    _enabled.store(true, std::memory_order_release);
+  }
+
+  /**
+   * Reserve a frame in the thread buffer, waiting while it is full.
+   *
+   * @return nullptr if logging was disabled meanwhile.
+   */
+  void* _reserve(thread_buffer& tb_, std::size_t size_) {
+    unsigned spins = 0;
+    for (;;) {
+      if (void* p = tb_._ring.reserve(size_)) return p;
+      if (!_enabled.load(std::memory_order_relaxed)) return nullptr;
+      if (++spins < 64) continue;
+      std::this_thread::yield();
+    }
+  }
+
+  std::uint32_t _register(const call_site& site_, const char* sig_) {
+    std::lock_guard<std::mutex> lk(_sites_mtx);
+    std::uint32_t id = site_._id.load(std::memory_order_relaxed);
+    if (!id) {
+      _sites.push_back(site_def{&site_, sig_});
+      id = static_cast<std::uint32_t>(_sites.size());
+      site_._id.store(id, std::memory_order_release);
+    }
+    return id;
+  }
+
+  /**
+   * Backend thread: write the output out whenever the thread buffers all run
+   * empty. Exits once stopped and drained.
+   */
+  void _run_backend() {
+    bool dirty = false;
+    std::uint64_t req = 0;
+    run_backend(_stop, [this, &dirty, &req]() {
+      req = _flush_req.load(std::memory_order_acquire);
+      const std::size_t n = _drain_all();
+      dirty |= n != 0;
+      return n;
+    }, [this, &dirty, &req]() {
+      if (dirty) {
+        _flush_output();
+        dirty = false;
+      }
+      std::lock_guard<std::mutex> lk(_mtx);
+      if (_flush_done < req) {
+        _flush_done = req;
+        _flush_cv.notify_all();
+      }
+    });
+  }
+
+  /**
+   * Write every committed message.
+   */
+  std::size_t _drain_all() {
+    return _buffers.drain([this](thread_buffer& tb_) {
+      std::size_t n = 0;
+      while (auto f = tb_._ring.peek()) {
+        _write(static_cast<const char*>(f.data), f.size);
+        tb_._ring.release();
+        ++n;
+      }
+      return n;
+    });
+  }
+
+  /**
+   * Decode the raw arguments of a frame, using the signature of its call site.
+   */
+  static std::size_t _decode(const char* sig_, const char* p_, const char* end_,
+                             arg_value* args_) noexcept {
+    std::size_t n = 0;
+    for (; *sig_ && p_ < end_; ++sig_, ++n) {
+      arg_value& a = args_[n];
+      a._type = static_cast<arg_type>(*sig_);
+      if (a._type == arg_type::eSTRING) {
+        std::uint32_t len;
+        memcpy(&len, p_, 4);
+        a._s = std::string_view(p_ + 4, len);
+        p_ += 4 + len;
+      } else {
+        memcpy(&a._u, p_, 8);
+        p_ += 8;
+      }
+    }
+    return n;
+  }
+
+  void _write(const char* p_, std::size_t size_) {
+    std::uint32_t id;
+    std::uint64_t ns;
+    memcpy(&id, p_, 4);
+    memcpy(&ns, p_ + 8, 8);
+    const site_def& s = _site(id);
+
+    arg_value args[MAX_BIN_ARGS];
+    const std::size_t nargs = _decode(s._sig, p_ + HEADER, p_ + size_, args);
+
+    if (_target) {
+      char ctx[MAX_CTX_LENGTH];
+      snprintf(ctx, sizeof(ctx), "%s:%d", s._site->_file, s._site->_line);
+      try {
+        _target->print_log(s._site->_lvl, ctx, format(s._site->_fmt, args, nargs),
+                           static_cast<std::int64_t>(ns));
+      } catch (...) {
+        ; // A failing stream must not take the backend thread down.
+      }
+      return;
+    }
+
+    if (id > _written_sites) _write_sites(id);
+    _scratch.clear();
+    wire::put_varint(_scratch, id);
+    wire::put_varint(_scratch, wire::zigzag(static_cast<std::int64_t>(ns - _last_ns)));
+    _last_ns = ns;
+    for (std::size_t i = 0; i < nargs; ++i) {
+      const arg_value& a = args[i];
+      switch (a._type) {
+      case arg_type::eINT:    wire::put_varint(_scratch, wire::zigzag(a._i)); break;
+      case arg_type::eDOUBLE: _scratch.append(reinterpret_cast<const char*>(&a._f), 8); break;
+      case arg_type::eSTRING:
+        wire::put_varint(_scratch, a._s.size());
+        _scratch.append(a._s.data(), a._s.size());
+        break;
+      default:                wire::put_varint(_scratch, a._u); break;
+      }
+    }
+    fwrite(_scratch.data(), 1, _scratch.size(), _out);
+  }
+
+  const site_def& _site(std::uint32_t id_) {
+    if (id_ > _known_sites.size()) {
+      std::lock_guard<std::mutex> lk(_sites_mtx);
+      _known_sites.assign(_sites.begin(), _sites.end());
+    }
+    return _known_sites[id_ - 1];
+  }
+
+  /**
+   * Write the descriptors of the call sites up to id_ before their first message.
+   */
+  void _write_sites(std::uint32_t id_) {
+    std::lock_guard<std::mutex> lk(_sites_mtx);
+    for (; _written_sites < id_; ++_written_sites) {
+      const call_site& s = *_sites[_written_sites]._site;
+      const char* sig = _sites[_written_sites]._sig;
+      _scratch.clear();
+      wire::put_varint(_scratch, 0);
+      wire::put_varint(_scratch, _written_sites + 1);
+      wire::put_varint(_scratch, static_cast<std::uint64_t>(s._lvl));
+      wire::put_varint(_scratch, static_cast<std::uint64_t>(s._line));
+      for (const char* str : {s._file, s._fmt, sig}) {
+        const std::size_t n = strlen(str);
+        wire::put_varint(_scratch, n);
+        _scratch.append(str, n);
+      }
+      fwrite(_scratch.data(), 1, _scratch.size(), _out);
+    }
+  }
+
+  void _flush_output() {
+    if (_out) fflush(_out);
+    if (_target) _target->flush();
+  }
+
+  /// Call site IDs are process wide, shared by every binary_logger
+  static inline std::mutex            _sites_mtx;
+  static inline std::vector<site_def> _sites;
+
+  std::mutex                  _mtx;         ///< Configuration, flush requests
+  std::condition_variable     _flush_cv;
+  thread_rings<thread_buffer> _buffers;
+  std::atomic<LogLevel>       _min_lvl{LogLevel::eINFO};
+  std::atomic<bool>           _enabled{false};
+  std::atomic<bool>           _stop{false};
+  std::atomic<std::uint64_t>  _dropped{0};
+  std::atomic<std::uint64_t>  _flush_req{0};
+  std::uint64_t               _flush_done{0};
+  std::thread                 _backend;
+
+  /// Backend thread only
+  std::vector<site_def>       _known_sites; ///< Copy of _sites
+  FILE*                       _out{nullptr};
+  logger*                     _target{nullptr};
+  std::uint32_t               _written_sites{0};
+  std::uint64_t               _last_ns{0};
+  std::string                 _scratch;
+};
+
+/**
+ * The binary logger of the process. Unlike LOGGER it must be unique across
+ * translation units since call site IDs are process wide.
+ */
+inline binary_logger& get_binary_instance() {
+  get_instance();   // LOGGER, the usual target, outlives the binary logger
+  static binary_logger ins;
+  return ins;
+}
+};  // namespace binary
+
+#define BINLOGGER anhthd::cpplibs::logger::lightweight::binary::get_binary_instance()
+
+#define BIN_LOG_LEVEL(level, ...) \
+  do { \
+    if constexpr (static_cast<int>(level) >= LOG_MIN_LEVEL) { \
+      struct _log_format { \
+        static constexpr std::string_view value() { return LOG_FMT(__VA_ARGS__); } \
+      }; \
+      static const anhthd::cpplibs::logger::lightweight::binary::call_site _bin_site{ \
+        level, __FILENAME__, __LINE__, LOG_FMT(__VA_ARGS__)}; \
+      if (BINLOGGER.is_enabled_for(level)) { \
+        BINLOGGER.log<_log_format>(_bin_site, __VA_ARGS__); \
+      } \
+    } \
+  } while (0)
+
+#define BIN_TRACE(...) \
+  BIN_LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, __VA_ARGS__)
+#define BIN_DEBUG(...) \
+  BIN_LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, __VA_ARGS__)
+#define BIN_INFO(...) \
+  BIN_LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, __VA_ARGS__)
+#define BIN_WARNING(...) \
+  BIN_LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, __VA_ARGS__)
+#define BIN_ERROR(...) \
+  BIN_LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, __VA_ARGS__)
+#define BIN_FATAL(...) \
+  BIN_LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, __VA_ARGS__)
+};  // namespace lightweight
+};  // namespace logger
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* BINARY_LOG_H_ */
@@ -0,0 +1,532 @@
+/**************************************************************************************
+* Lightweight Logger - Compile-time Checked Formatting
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: format.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * printf-style formatting for the logging macros, with the format parsed at compile
+ * time and the arguments passed as a variadic template instead of C varargs.
+ *
+ * The format string literal is carried by a type F (F::value() is constexpr):
+ *  - parse<F>() splits it into literal and conversion pieces at compile time, so at
+ *    run time format_to() only appends literals and converts arguments.
+ *  - check<F, A...>() matches every conversion against the type of its argument,
+ *    format_to() turns a mismatch, a missing or an extra argument into a compile
+ *    error.
+ *  - Integers and floating point are converted with std::to_chars, strings and
+ *    pointers are appended directly. The output is a std::string, never truncated.
+ *
+ * Supported: flags "-+ #0", width and precision (also `*`), conversions
+ * d i o u x X c f F e E g G a A s p and %%. Length modifiers (l, ll, z...) are
+ * accepted and ignored, the argument type is known.
+ */
+#ifndef LIGHTWEIGHT_FORMAT_H_
+#define LIGHTWEIGHT_FORMAT_H_
+
+#include <array>
+#include <string>
+#include <cstdint>
+#include <cstdio>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+namespace anhthd {
+namespace cpplibs {
+namespace logger {
+namespace lightweight {
+namespace detail {
+enum class arg_kind : std::uint8_t {
+  eINTEGRAL,
+  eFLOATING,
+  eSTRING,
+  ePOINTER,
+  eUNSUPPORTED
+};
+
+template <typename T>
+constexpr arg_kind kind_of() {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_integral<U>::value || std::is_enum<U>::value) {
+    return arg_kind::eINTEGRAL;
+  } else if constexpr (std::is_floating_point<U>::value) {
+    return arg_kind::eFLOATING;
+  } else if constexpr (std::is_same<U, const char*>::value || std::is_same<U, char*>::value ||
+                       std::is_same<U, std::string>::value ||
+                       std::is_same<U, std::string_view>::value) {
+    return arg_kind::eSTRING;
+  } else if constexpr (std::is_pointer<U>::value || std::is_null_pointer<U>::value) {
+    return arg_kind::ePOINTER;
+  } else {
+    return arg_kind::eUNSUPPORTED;
+  }
+}
+
+enum class format_error {
+  eNONE,
+  eINCOMPLETE,        ///< Format ends inside a conversion
+  eBAD_CONVERSION,    ///< Unknown conversion character
+  eTOO_FEW_ARGS,
+  eTOO_MANY_ARGS,
+  eTYPE_MISMATCH,
+  eUNSUPPORTED_TYPE
+};
+
+struct piece {
+  enum class kind : std::uint8_t {
+    eLITERAL,         ///< _off/_len range of the format
+    eWIDTH_ARG,       ///< `*` width, taken from the next argument
+    ePRECISION_ARG,   ///< `*` precision, taken from the next argument
+    eARG
+  };
+
+  enum : std::uint8_t { eMINUS = 1, ePLUS = 2, eSPACE = 4, eHASH = 8, eZERO = 16 };
+
+  kind          _kind{kind::eLITERAL};
+  char          _conv{0};
+  std::uint8_t  _flags{0};
+  std::uint32_t _off{0};
+  std::uint32_t _len{0};
+  std::int32_t  _width{-1};       ///< -1 if none
+  std::int32_t  _precision{-1};   ///< -1 if none
+};
+
+/**
+ * Split fmt_ into pieces, calling emit_(const piece&) for each of them.
+ */
+template <typename E>
+constexpr format_error scan(std::string_view fmt_, E&& emit_) {
+  const std::size_t n = fmt_.size();
+  std::size_t lit = 0;
+  std::size_t i = 0;
+
+  auto literal = [&](std::size_t from_, std::size_t to_) {
+    if (to_ > from_) {
+      piece p{};
+      p._off = static_cast<std::uint32_t>(from_);
+      p._len = static_cast<std::uint32_t>(to_ - from_);
+      emit_(p);
+    }
+  };
+
+  while (i < n) {
+    if (fmt_[i] != '%') {
+      ++i;
+      continue;
+    }
+    if (i + 1 < n && fmt_[i + 1] == '%') {
+      literal(lit, i + 1);    // Keep one '%'
+      i += 2;
+      lit = i;
+      continue;
+    }
+    literal(lit, i);
+
+    piece p{};
+    p._kind = piece::kind::eARG;
+    std::size_t j = i + 1;
+    for (; j < n; ++j) {
+      const char c = fmt_[j];
+      if (c == '-') p._flags |= piece::eMINUS;
+      else if (c == '+') p._flags |= piece::ePLUS;
+      else if (c == ' ') p._flags |= piece::eSPACE;
+      else if (c == '#') p._flags |= piece::eHASH;
+      else if (c == '0') p._flags |= piece::eZERO;
+      else break;
+    }
+    for (int part = 0; part < 2; ++part) {
+      std::int32_t& v = part ? p._precision : p._width;
+      if (part) {
+        if (j >= n || fmt_[j] != '.') break;
+        ++j;
+        v = 0;
+      }
+      if (j < n && fmt_[j] == '*') {
+        piece star{};
+        star._kind = part ? piece::kind::ePRECISION_ARG : piece::kind::eWIDTH_ARG;
+        emit_(star);
+        ++j;
+        continue;
+      }
+      for (; j < n && fmt_[j] >= '0' && fmt_[j] <= '9'; ++j) {
+        v = (v < 0 ? 0 : v) * 10 + (fmt_[j] - '0');
+      }
+    }
+    while (j < n && (fmt_[j] == 'h' || fmt_[j] == 'l' || fmt_[j] == 'L' ||
+                     fmt_[j] == 'j' || fmt_[j] == 'z' || fmt_[j] == 't' || fmt_[j] == 'q')) {
+      ++j;
+    }
+    if (j >= n) return format_error::eINCOMPLETE;
+
+    p._conv = fmt_[j];
+    if (std::string_view("diouxXcfFeEgGaAsp").find(p._conv) == std::string_view::npos) {
+      return format_error::eBAD_CONVERSION;
+    }
+    emit_(p);
+    i = j + 1;
+    lit = i;
+  }
+  literal(lit, n);
+  return format_error::eNONE;
+}
+
+template <typename F>
+constexpr std::size_t count_pieces() {
+  std::size_t n = 0;
+  scan(F::value(), [&n](const piece&) { ++n; });
+  return n;
+}
+
+/**
+ * The pieces of F::value(), computed at compile time.
+ */
+template <typename F>
+constexpr std::array<piece, count_pieces<F>()> parse() {
+  std::array<piece, count_pieces<F>()> ret{};
+  std::size_t n = 0;
+  scan(F::value(), [&ret, &n](const piece& p_) { ret[n++] = p_; });
+  return ret;
+}
+
+/**
+ * Match the conversions of F::value() against the argument types A.
+ */
+template <typename F, typename... A>
+constexpr format_error check() {
+  constexpr arg_kind kinds[] = {kind_of<A>()..., arg_kind::eUNSUPPORTED};
+  constexpr std::size_t nargs = sizeof...(A);
+
+  format_error err = format_error::eNONE;
+  std::size_t next = 0;
+  const format_error serr = scan(F::value(), [&](const piece& p_) {
+    if (p_._kind == piece::kind::eLITERAL || err != format_error::eNONE) return;
+    if (next >= nargs) {
+      err = format_error::eTOO_FEW_ARGS;
+      return;
+    }
+    const arg_kind k = kinds[next++];
+    if (k == arg_kind::eUNSUPPORTED) {
+      err = format_error::eUNSUPPORTED_TYPE;
+      return;
+    }
+    bool ok = false;
+    if (p_._kind != piece::kind::eARG) {
+      ok = (k == arg_kind::eINTEGRAL);
+    } else if (std::string_view("diouxXc").find(p_._conv) != std::string_view::npos) {
+      ok = (k == arg_kind::eINTEGRAL);
+    } else if (p_._conv == 's') {
+      ok = (k == arg_kind::eSTRING);
+    } else if (p_._conv == 'p') {
+      ok = (k == arg_kind::ePOINTER || k == arg_kind::eSTRING);
+    } else {
+      ok = (k == arg_kind::eFLOATING);
+    }
+    if (!ok) err = format_error::eTYPE_MISMATCH;
+  });
+  if (serr != format_error::eNONE) return serr;
+  if (err != format_error::eNONE) return err;
+  return next < nargs ? format_error::eTOO_MANY_ARGS : format_error::eNONE;
+}
+
+/**
+ * Append s_ to out_, with zeros_ zeros (precision of an integer) after its first
+ * prefix_ characters (sign, 0x), padded to width_ according to the flags. Zero
+ * padding goes after the prefix too.
+ */
+inline void pad(std::string& out_, std::string_view s_, std::size_t prefix_,
+                std::uint8_t flags_, std::int32_t width_, bool zero_ok_,
+                std::size_t zeros_ = 0) {
+  const std::size_t w = width_ > 0 ? static_cast<std::size_t>(width_) : 0;
+  const std::size_t len = s_.size() + zeros_;
+  const std::size_t fill = w > len ? w - len : 0;
+  if (fill && !(flags_ & piece::eMINUS) && !((flags_ & piece::eZERO) && zero_ok_)) {
+    out_.append(fill, ' ');
+  }
+  out_.append(s_.substr(0, prefix_));
+  if (fill && !(flags_ & piece::eMINUS) && (flags_ & piece::eZERO) && zero_ok_) {
+    zeros_ += fill;
+  }
+  out_.append(zeros_, '0');
+  out_.append(s_.substr(prefix_));
+  if (fill && (flags_ & piece::eMINUS)) out_.append(fill, ' ');
+}
+
+template <typename T>
+void format_integral(std::string& out_, const piece& p_, std::uint8_t flags_,
+                     std::int32_t width_, std::int32_t prec_, T v_) {
+  using I = std::conditional_t<std::is_same<T, bool>::value, int, T>;
+  const I v = static_cast<I>(v_);
+
+  if (p_._conv == 'c') {
+    const char c = static_cast<char>(v);
+    pad(out_, std::string_view(&c, 1), 0, flags_, width_, false);
+    return;
+  }
+
+  using U = std::make_unsigned_t<I>;
+  char buf[96];
+  char* b = buf + 8;    // Room for the prefix
+  char* e = buf + sizeof(buf);
+  std::size_t prefix = 0;
+  bool negative = false;
+  U u;
+  int base = 10;
+
+  if (p_._conv == 'd' || p_._conv == 'i') {
+    negative = v < 0;
+    u = negative ? static_cast<U>(U(0) - static_cast<U>(v)) : static_cast<U>(v);
+  } else {
+    u = static_cast<U>(v);
+    base = (p_._conv == 'o') ? 8 : (p_._conv == 'u') ? 10 : 16;
+  }
+
+  char* d = b;
+  char* dend = d;
+  if (!(u == 0 && prec_ == 0)) {
+    dend = std::to_chars(d, e, u, base).ptr;
+  }
+  if (p_._conv == 'X') {
+    for (char* q = d; q < dend; ++q) if (*q >= 'a' && *q <= 'f') *q -= 'a' - 'A';
+  }
+  const bool zero_ok = prec_ < 0;
+  const std::int32_t ndig = static_cast<std::int32_t>(dend - d);
+  if (base == 8 && (flags_ & piece::eHASH) && (ndig == 0 || *d != '0') && prec_ <= ndig) {
+    prec_ = ndig + 1;
+  }
+  // Precision zeros go to out_ directly, as many as asked for.
+  const std::size_t zeros = prec_ > ndig ? static_cast<std::size_t>(prec_ - ndig) : 0;
+  if (base == 16 && (flags_ & piece::eHASH) && u != 0) {
+    *--d = p_._conv;
+    *--d = '0';
+    prefix = 2;
+  }
+  if (negative) *--d = '-', prefix = 1;
+  else if (base == 10 && (flags_ & piece::ePLUS) && p_._conv != 'u') *--d = '+', prefix = 1;
+  else if (base == 10 && (flags_ & piece::eSPACE) && p_._conv != 'u') *--d = ' ', prefix = 1;
+
+  pad(out_, std::string_view(d, dend - d), prefix, flags_, width_, zero_ok, zeros);
+}
+
+inline void format_floating(std::string& out_, const piece& p_, std::uint8_t flags_,
+                            std::int32_t width_, std::int32_t prec_, double v_) {
+  std::chars_format cf = std::chars_format::fixed;
+  switch (p_._conv) {
+  case 'e': case 'E': cf = std::chars_format::scientific; break;
+  case 'g': case 'G': cf = std::chars_format::general; break;
+  case 'a': case 'A': cf = std::chars_format::hex; break;
+  default: break;
+  }
+  const bool upper = (p_._conv >= 'A' && p_._conv <= 'Z');
+  const bool alt = (flags_ & piece::eHASH);
+  const std::int32_t prec = prec_ < 0 ? 6 : prec_;
+
+  char buf[512];
+  char* b = buf + 4;    // Room for the sign and 0x
+  char* const end = buf + sizeof(buf) - 1;    // Room for the point of `#`
+  std::to_chars_result r;
+  if (prec_ < 0 && cf == std::chars_format::hex) {
+    r = std::to_chars(b, end, v_, cf);
+  } else if (alt && cf == std::chars_format::general) {
+    // %#g keeps its trailing zeros: the style of %g, with P significant digits.
+    const std::int32_t sig = prec ? prec : 1;
+    r = std::to_chars(b, end, v_, std::chars_format::scientific, sig - 1);
+    const char* x = r.ec == std::errc{} ? std::char_traits<char>::find(b, r.ptr - b, 'e')
+                                        : nullptr;
+    int exp = 0;
+    if (x) std::from_chars(x + (x[1] == '+' ? 2 : 1), r.ptr, exp);
+    if (x && exp < sig && exp >= -4) {
+      r = std::to_chars(b, end, v_, std::chars_format::fixed, sig - 1 - exp);
+    }
+  } else {
+    r = std::to_chars(b, end, v_, cf, prec);
+  }
+  if (r.ec != std::errc{}) {
+    // Out of room (huge value in fixed notation): let the C library do it.
+    char spec[8];
+    std::size_t k = 0;
+    spec[k++] = '%';
+    if (alt) spec[k++] = '#';
+    spec[k++] = '.';
+    spec[k++] = '*';
+    spec[k++] = p_._conv;
+    spec[k] = '\0';
+    const int n = snprintf(nullptr, 0, spec, prec, v_);
+    std::string s(static_cast<std::size_t>(n), '\0');
+    snprintf(&s[0], s.size() + 1, spec, prec, v_);
+    pad(out_, s, (v_ < 0) ? 1 : 0, flags_, width_, true);
+    return;
+  }
+
+  char* d = b;
+  std::size_t prefix = 0;
+  const bool negative = (*d == '-');
+  if (negative) ++d;
+  const bool finite = (*d >= '0' && *d <= '9');
+  if (alt && finite && !std::char_traits<char>::find(d, r.ptr - d, '.')) {
+    // Alternate form: always a decimal point, before the exponent if any.
+    char* x = d;
+    while (x < r.ptr && *x != 'e' && *x != 'p') ++x;
+    std::char_traits<char>::move(x + 1, x, r.ptr - x);
+    *x = '.';
+    ++r.ptr;
+  }
+  if (upper) {
+    for (char* q = d; q < r.ptr; ++q) if (*q >= 'a' && *q <= 'z') *q -= 'a' - 'A';
+  }
+  if (cf == std::chars_format::hex && finite) {
+    *--d = upper ? 'X' : 'x';
+    *--d = '0';
+    prefix = 2;
+  }
+  if (negative) *--d = '-', ++prefix;
+  else if (flags_ & piece::ePLUS) *--d = '+', ++prefix;
+  else if (flags_ & piece::eSPACE) *--d = ' ', ++prefix;
+
+  pad(out_, std::string_view(d, r.ptr - d), prefix, flags_, width_, finite);
+}
+
+inline void format_string(std::string& out_, std::uint8_t flags_, std::int32_t width_,
+                          std::int32_t prec_, std::string_view s_) {
+  if (prec_ >= 0 && s_.size() > static_cast<std::size_t>(prec_)) {
+    s_ = s_.substr(0, prec_);
+  }
+  pad(out_, s_, 0, flags_, width_, false);
+}
+
+inline void format_pointer(std::string& out_, std::uint8_t flags_, std::int32_t width_,
+                           const void* p_) {
+  if (!p_) {
+    pad(out_, "(nil)", 0, flags_, width_, false);
+    return;
+  }
+  char buf[24] = {'0', 'x'};
+  char* e = std::to_chars(buf + 2, buf + sizeof(buf),
+                          reinterpret_cast<std::uintptr_t>(p_), 16).ptr;
+  pad(out_, std::string_view(buf, e - buf), 2, flags_, width_, false);
+}
+
+/**
+ * Walks the pieces while the arguments are folded over, one argument per
+ * non-literal piece.
+ */
+struct format_state {
+  std::string&      _out;
+  std::string_view  _fmt;
+  const piece*      _pieces;
+  std::size_t       _npieces;
+  std::size_t       _cur{0};
+  std::uint8_t      _flags{0};        ///< Extra flags from a negative `*` width
+  std::int32_t      _width{-1};       ///< From `*`
+  std::int32_t      _precision{-1};   ///< From `*`
+  bool              _star_precision{false};
+
+  void literals() {
+    while (_cur < _npieces && _pieces[_cur]._kind == piece::kind::eLITERAL) {
+      _out.append(_fmt.substr(_pieces[_cur]._off, _pieces[_cur]._len));
+      ++_cur;
+    }
+  }
+
+  template <typename T>
+  void emit(const T& v_) {
+    literals();
+    const piece& p = _pieces[_cur++];
+    using U = std::decay_t<T>;
+
+    if constexpr (std::is_integral<U>::value || std::is_enum<U>::value) {
+      if (p._kind == piece::kind::eWIDTH_ARG) {
+        long long w = static_cast<long long>(v_);
+        if (w < 0) {
+          _flags |= piece::eMINUS;
+          w = -w;
+        }
+        _width = static_cast<std::int32_t>(w);
+        return;
+      }
+      if (p._kind == piece::kind::ePRECISION_ARG) {
+        const long long pr = static_cast<long long>(v_);
+        _precision = pr < 0 ? -1 : static_cast<std::int32_t>(pr);
+        _star_precision = true;
+        return;
+      }
+    }
+
+    const std::uint8_t flags = p._flags | _flags;
+    const std::int32_t width = _width >= 0 ? _width : p._width;
+    const std::int32_t prec = _star_precision ? _precision : p._precision;
+    _flags = 0;
+    _width = _precision = -1;
+    _star_precision = false;
+
+    if constexpr (std::is_enum<U>::value) {
+      format_integral(_out, p, flags, width, prec, static_cast<std::underlying_type_t<U>>(v_));
+    } else if constexpr (std::is_integral<U>::value) {
+      format_integral(_out, p, flags, width, prec, v_);
+    } else if constexpr (std::is_floating_point<U>::value) {
+      format_floating(_out, p, flags, width, prec, static_cast<double>(v_));
+    } else if constexpr (kind_of<T>() == arg_kind::eSTRING) {
+      if constexpr (std::is_pointer<U>::value) {    // Also string literals, decayed
+        const char* v = v_;
+        if (p._conv == 'p') format_pointer(_out, flags, width, v);
+        else format_string(_out, flags, width, prec, v ? std::string_view(v) : "(null)");
+      } else {                                      // std::string, no copy
+        const std::string_view v(v_);
+        if (p._conv == 'p') format_pointer(_out, flags, width, v.data());
+        else format_string(_out, flags, width, prec, v);
+      }
+    } else if constexpr (std::is_null_pointer<U>::value) {
+      format_pointer(_out, flags, width, nullptr);
+    } else {
+      format_pointer(_out, flags, width, reinterpret_cast<const void*>(v_));
+    }
+  }
+};
+
+/**
+ * Fail to compile if the arguments A do not match the format F::value().
+ */
+template <typename F, typename... A>
+constexpr void validate() {
+  constexpr format_error err = check<F, A...>();
+  static_assert(err != format_error::eINCOMPLETE, "log format: incomplete conversion");
+  static_assert(err != format_error::eBAD_CONVERSION, "log format: unknown conversion");
+  static_assert(err != format_error::eTOO_FEW_ARGS, "log format: too few arguments");
+  static_assert(err != format_error::eTOO_MANY_ARGS, "log format: too many arguments");
+  static_assert(err != format_error::eTYPE_MISMATCH,
+                "log format: argument type does not match its conversion");
+  static_assert(err != format_error::eUNSUPPORTED_TYPE, "log format: unsupported argument type");
+}
+
+/**
+ * Append F::value() formatted with args_ to out_.
+ */
+template <typename F, typename... A>
+void format_to(std::string& out_, const A&... args_) {
+  validate<F, A...>();
+
+  static constexpr auto pieces = parse<F>();
+  format_state s{out_, F::value(), pieces.data(), pieces.size()};
+  (s.emit(args_), ...);
+  s.literals();
+}
+};  // namespace detail
+};  // namespace lightweight
+};  // namespace logger
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* LIGHTWEIGHT_FORMAT_H_ */
@@ -0,0 +1,48 @@
+/*
+ * file   log_decoder.cc
+ * brief  Turn a binary log file (see binary_log.hh) into text log lines.
+ *
+ *        g++ -std=c++17 -O2 -pthread log_decoder.cc -o log_decoder
+ *        ./log_decoder <binary-log-file> [min-level]
+ *
+ *    Author: anhthd
+ */
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "binary_log.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+int main(int argc, char** argv)
+{
+  if (argc < 2) {
+    fprintf(stderr, "usage: %s <binary-log-file> [min-level]\n", argv[0]);
+    return 2;
+  }
+  const int min_lvl = (argc > 2) ? atoi(argv[2]) : 0;
+
+  try {
+    binary::log_reader reader{fs::path(argv[1])};
+    binary::log_reader::entry e;
+    while (reader.next(e)) {
+      if ((int)e._site->_lvl < min_lvl) continue;
+      const std::string& file = e._site->_file;
+      const std::size_t slash = file.rfind('/');
+      const std::string ctx = file.substr(slash == std::string::npos ? 0 : slash + 1)
+                              + ":" + std::to_string(e._site->_line);
+      std::cout << log_formater::format(e._site->_lvl, ctx.c_str(), e._msg,
+                                        (std::int64_t)e._ns) << '\n';
+    }
+  } catch (const std::exception& err) {
+    std::cout.flush();
+    fprintf(stderr, "%s: %s\n", argv[1], err.what());
+    return 1;
+  }
+  return 0;
+}
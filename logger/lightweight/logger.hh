@@ -19,21 +19,52 @@
 #ifndef LIGHTWEIGHT_H_
 #define LIGHTWEIGHT_H_
 
+#include <time.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <stdarg.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <sys/inotify.h>
+#include <sched.h>
+#include <poll.h>
 
 #include <ctime>
 #include <mutex>
+#include <atomic>
 #include <string>
 #include <chrono>
 #include <memory>
-#include <iomanip>
+#include <thread>
+#include <deque>
+#include <vector>
+#include <fstream>
 #include <sstream>
+#include <algorithm>
+#include <functional>
+#include <charconv>
+#include <iostream>
 #include <stdexcept>
 #include <string_view>
-#include <unordered_map>
+#include <system_error>
+#include <condition_variable>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "format.hh"
+#include "compress.hh"
+#include "structured.hh"
+#include "thread_rings.hh"
 #include "../../filesystem/filesystem.hh"
+#include "../../buffer/ring/mpmc_ring.hh"
+#include "../../buffer/circular/flight_recorder.hh"
 
 using namespace std::chrono;
 
@@ -41,6 +72,15 @@ namespace anhthd {
 namespace cpplibs {
 namespace logger {
 namespace lightweight {
+enum class LogLevel {
+  eTRACE    = 0x01,
+  eDEBUG    = 0x02,
+  eINFO     = 0x04,
+  eWARNING  = 0x08,
+  eERROR    = 0x16,
+  eFATAL    = 0x32
+};
+
 class log_stream
 {
 public:
@@ -52,8 +92,32 @@ public:
   log_stream& operator=(log_stream&&) = delete;
   log_stream& operator=(const log_stream&) = delete;
 
+  /**
+   * Write one log line. The line may stay buffered until flush().
+   */
   virtual void print_log(const std::string_view& msg_) = 0;
 
+  /**
+   * Write one log line of level lvl_, the logger calls this one. Streams which
+   * decide by level when to write out override it.
+   */
+  virtual void write(LogLevel lvl_, const std::string_view& msg_) {
+    (void)lvl_;
+    print_log(msg_);
+  }
+
+  /**
+   * Push buffered log lines to the underlying device.
+   */
+  virtual void flush() { }
+
+  /**
+   * A stream with a flush policy of its own is not flushed after every line in
+   * synchronous mode, nor whenever the async backend runs idle. flush() still
+   * works as a barrier.
+   */
+  virtual bool has_flush_policy() const noexcept { return false; }
+
 private:
   std::mutex _lk;
 };
@@ -71,24 +135,238 @@ public:
 
   void print_log(const std::string_view& msg_) override {
     std::lock_guard<std::mutex> lk(_mtx);
-    std::cout << msg_ << std::endl;
+    std::cout << msg_ << '\n';
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> lk(_mtx);
+    std::cout.flush();
   }
 
 private:
   std::mutex  _mtx;
 };
 
-class file_stream: public log_stream
+/**
+ * Name of the i_-th rotated file of file_, i.e. "name.1".
+ */
+inline std::string backup_name(const filesystem::path& file_, unsigned i_) {
+  return std::string(file_.raw()).append(".").append(std::to_string(i_));
+}
+
+/**
+ * Shift name.1..name.N-1 to name.2..name.N, the oldest one dropped. Missing
+ * backups are fine, rename() then fails with ENOENT.
+ */
+inline void shift_backups(const filesystem::path& file_, unsigned nrt_) {
+  for (unsigned i = nrt_; i > 1; --i) {
+    (void)std::rename(backup_name(file_, i - 1).c_str(), backup_name(file_, i).c_str());
+  }
+}
+
+/**
+ * Compresses rotated log files on a background thread, see compress.hh for the
+ * codec: name.1 becomes name.1.lz4 (or name.1.gz), and the backups are shifted
+ * with their compressed names.
+ *
+ * The thread runs under SCHED_IDLE and the idle I/O class where permitted, so it
+ * only takes CPU time and disk bandwidth nobody else wants. It never takes a lock
+ * of the logger or its streams: submit() opens the new backup and queues the file
+ * descriptor. Once compressed, the backup is found again by its inode, whatever
+ * shifts happened meanwhile, and replaced by its compressed version. Only that
+ * last step and shift() share a (short) lock.
+ *
+ * On destruction the file in progress is finished, files still queued stay
+ * uncompressed.
+ */
+class backup_compressor
 {
 public:
-  file_stream(const filesystem::path& file_, std::uint32_t fsize_, std::uint8_t nrt_):
-    _file{file_}, _fsize{fsize_}, _nrt{nrt_} {
-    _fstream.open(_file.raw(), std::ios_base::app);
-    if (!_fstream.is_open()) {
-      std::stringstream ss;
-      ss << "Cannot open file stream at " << _file.raw();
-      throw std::runtime_error(ss.str());
+  struct stats {
+    std::uint64_t _files{0};
+    std::uint64_t _bytes_in{0};
+    std::uint64_t _bytes_out{0};
+    double        _seconds{0};    ///< Spent compressing
+  };
+
+  backup_compressor(): _worker{&backup_compressor::_run, this} { }
+
+  ~backup_compressor() {
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _stop = true;
+    }
+    _cv.notify_all();
+    _worker.join();
+    for (const job& j : _jobs) ::close(j._fd);
+  }
+
+  backup_compressor(backup_compressor&&) = delete;
+  backup_compressor(const backup_compressor&) = delete;
+  backup_compressor& operator=(backup_compressor&&) = delete;
+  backup_compressor& operator=(const backup_compressor&) = delete;
+
+  /**
+   * shift_backups() for plain and compressed backups: name.N and name.N.lz4 are
+   * dropped, name.i(.lz4) renamed to name.i+1(.lz4).
+   */
+  void shift(const filesystem::path& file_, unsigned nrt_) {
+    if (!nrt_) return;
+    const char* ext = compress::file_codec::extension();
+    std::lock_guard<std::mutex> lk(_names_mtx);
+    (void)::unlink(backup_name(file_, nrt_).c_str());
+    (void)::unlink((backup_name(file_, nrt_) + ext).c_str());
+    for (unsigned i = nrt_; i > 1; --i) {
+      (void)std::rename(backup_name(file_, i - 1).c_str(), backup_name(file_, i).c_str());
+      (void)std::rename((backup_name(file_, i - 1) + ext).c_str(),
+                        (backup_name(file_, i) + ext).c_str());
+    }
+  }
+
+  /**
+   * Queue name.1, just rotated, for compression.
+   */
+  void submit(const filesystem::path& file_, unsigned nrt_) {
+    if (!nrt_) return;
+    job j;
+    j._file = file_.raw();
+    j._nrt = nrt_;
+    j._fd = ::open(backup_name(file_, 1).c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (j._fd < 0) return;
+    if (::fstat(j._fd, &st) != 0) {
+      ::close(j._fd);
+      return;
+    }
+    j._dev = st.st_dev;
+    j._ino = st.st_ino;
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _jobs.push_back(std::move(j));
+      ++_pending;
+    }
+    _cv.notify_all();
+  }
+
+  /**
+   * Return once every submitted file is compressed.
+   */
+  void wait_idle() {
+    std::unique_lock<std::mutex> lk(_mtx);
+    _cv.wait(lk, [this]() { return !_pending; });
+  }
+
+  stats get_stats() const {
+    std::lock_guard<std::mutex> lk(_mtx);
+    return _stats;
+  }
+
+private:
+  struct job {
+    std::string   _file;
+    unsigned      _nrt{0};
+    int           _fd{-1};
+    dev_t         _dev{0};
+    ino_t         _ino{0};
+  };
+
+  mutable std::mutex          _mtx;         ///< Queue and stats
+  std::condition_variable     _cv;
+  std::deque<job>             _jobs;
+  std::size_t                 _pending{0};  ///< Queued or in progress
+  bool                        _stop{false};
+  stats                       _stats;
+  std::mutex                  _names_mtx;   ///< Renames of the backups
+  std::thread                 _worker;
+
+  static void _lower_priority() {
+    struct sched_param sp;
+    memset(&sp, 0, sizeof(sp));
+    (void)::sched_setscheduler(0, SCHED_IDLE, &sp);
+    // ioprio_set(IOPRIO_WHO_PROCESS, this thread, IOPRIO_CLASS_IDLE), no glibc wrapper.
+#ifdef SYS_ioprio_set
+    (void)::syscall(SYS_ioprio_set, 1, 0, 3 << 13);
+#endif
+  }
+
+  void _run() {
+    _lower_priority();
+    compress::file_codec codec;
+    std::unique_lock<std::mutex> lk(_mtx);
+    for (;;) {
+      _cv.wait(lk, [this]() { return _stop || !_jobs.empty(); });
+      if (_stop) return;
+      job j = std::move(_jobs.front());
+      _jobs.pop_front();
+      lk.unlock();
+
+      const auto t0 = std::chrono::steady_clock::now();
+      stats done;
+      _compress(codec, j, done);
+      done._seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+      lk.lock();
+      _stats._files += done._files;
+      _stats._bytes_in += done._bytes_in;
+      _stats._bytes_out += done._bytes_out;
+      _stats._seconds += done._seconds;
+      --_pending;
+      _cv.notify_all();
+    }
+  }
+
+  void _compress(compress::file_codec& codec_, const job& j_, stats& done_) {
+    const filesystem::path file(j_._file.c_str());
+    const std::string tmp = j_._file + ".compressing" + compress::file_codec::extension();
+    const int out = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = out >= 0 && codec_.compress(j_._fd, out, done_._bytes_in);
+    struct stat st;
+    if (out >= 0 && ::fstat(out, &st) == 0) done_._bytes_out = static_cast<std::uint64_t>(st.st_size);
+    if (out >= 0) ok = (::close(out) == 0) && ok;
+    ::close(j_._fd);
+
+    std::lock_guard<std::mutex> lk(_names_mtx);
+    for (unsigned i = 1; ok && i <= j_._nrt; ++i) {
+      const std::string name = backup_name(file, i);
+      if (::stat(name.c_str(), &st) != 0 || st.st_dev != j_._dev || st.st_ino != j_._ino) continue;
+      if (std::rename(tmp.c_str(), (name + compress::file_codec::extension()).c_str()) == 0) {
+        (void)::unlink(name.c_str());
+        done_._files = 1;
+        return;
+      }
     }
+    // Failed, or the backup was dropped meanwhile.
+    (void)::unlink(tmp.c_str());
+  }
+};
+
+/**
+ * Log file with rotation: once a line would take the file past fsize_ bytes, the
+ * file is renamed to name.1 (name.1 to name.2 ... up to name.nrt_, the oldest one
+ * dropped) and a new file is started. The size is tracked with an in-memory byte
+ * counter and nothing is copied.
+ *
+ * The backups are shifted without holding the stream lock, other threads keep
+ * appending to the current file meanwhile. Only the last rename and the reopen
+ * are done under the lock. With a backup_compressor, name.1 is then compressed in
+ * the background.
+ */
+class file_stream: public log_stream
+{
+public:
+  /**
+   * @param[in] file_ Log file path
+   * @param[in] fsize_ Maximum size of a log file in bytes, 0 for no rotation
+   * @param[in] nrt_ Maximum number of rotated files, 0 to simply truncate the file
+   * @param[in] compressor_ Compresses the rotated files, if set
+   */
+  file_stream(const filesystem::path& file_, std::uint32_t fsize_, std::uint8_t nrt_,
+              std::shared_ptr<backup_compressor> compressor_ = nullptr):
+    _file{file_}, _fsize{fsize_}, _nrt{nrt_}, _compressor{std::move(compressor_)} {
+    filesystem::error_code ec;
+    const long int size = file_size(_file, ec);
+    _written = size > 0 ? static_cast<std::uint64_t>(size) : 0;
+    _open(std::ios_base::app);
   }
 
   ~file_stream() {
@@ -104,19 +382,27 @@ public:
   file_stream& operator=(const file_stream&) = delete;
 
   void print_log(const std::string_view& msg_) override {
-    std::lock_guard<std::recursive_mutex> lk(_mtx);
-    filesystem::error_code ec;
-    auto fs = file_size(_file, ec);
-    if (fs >= _fsize) {
-      _rotate();
-    }
-    else if (fs == -1) {
-      _fstream << ec.what() << std::endl;
-      throw std::runtime_error(ec.what());
-    }
-    else {
-      _fstream << msg_ << std::endl;
+    std::unique_lock<std::mutex> lk(_mtx);
+    const std::uint64_t n = msg_.size() + 1;
+    if (_fsize && _written && _written + n > _fsize && !_rotating) {
+      _rotating = true;
+      lk.unlock();
+      if (_compressor) {
+        _compressor->shift(_file, _nrt);
+      } else {
+        shift_backups(_file, _nrt);
+      }
+      lk.lock();
+      _rotating = false;
+      _reopen();
     }
+    _fstream << msg_ << '\n';
+    _written += n;
+  }
+
+  void flush() override {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _fstream.flush();
   }
 
 private:
@@ -124,217 +410,2960 @@ private:
   std::uint32_t         _fsize;   ///< Backup file size
   std::uint8_t          _nrt;     ///< Maximum number of rotated files
   std::ofstream         _fstream; ///< Log file stream
-  std::recursive_mutex  _mtx;
-
-  void _rotate() {
-    std::lock_guard<std::recursive_mutex> lk(_mtx);
-    _fstream.flush();
-    _fstream.close();
+  std::uint64_t         _written{0};  ///< Current file size
+  bool                  _rotating{false};
+  std::shared_ptr<backup_compressor>  _compressor;
+  std::mutex            _mtx;
 
-    filesystem::error_code ec;
-    filesystem::path bk_file(_file/filesystem::path(".bak"));
-    if (!copy_file(_file, bk_file, ec)) {
-      throw std::runtime_error(ec.what());
+  void _open(std::ios_base::openmode mode_) {
+    _fstream.open(_file.raw(), mode_);
+    if (!_fstream.is_open()) {
+      std::stringstream ss;
+      ss << "Cannot open file stream at " << _file.raw();
+      throw std::runtime_error(ss.str());
     }
-    else {
-      (void)std::remove(_file.raw());
-      _fstream.open(_file.raw(), std::ios_base::app);
+  }
+
+  /**
+   * Rename name to name.1 (or drop it without backups) and start a new file.
+   */
+  void _reopen() {
+    _fstream.close();
+    if (_nrt) {
+      (void)std::rename(_file.raw(), backup_name(_file, 1).c_str());
+      if (_compressor) _compressor->submit(_file, _nrt);
     }
+    _written = 0;
+    _open(std::ios_base::out | std::ios_base::trunc);
   }
 };
 
-#define __FILENAME__                  \
-        strrchr(__FILE__, '/') ?      \
-        strrchr(__FILE__, '/') + 1 :  \
-        __FILE__
+/**
+ * When a writev_stream writes its buffered lines out, and how durable they are.
+ */
+struct flush_policy {
+  enum class durability {
+    eNONE,        ///< Never fdatasync(), the kernel writes back when it likes
+    eBATCH,       ///< At most one fdatasync() per _sync_interval, and on flush()
+    eEVERY_WRITE  ///< fdatasync() after every write-out
+  };
 
-#define __CONTEXT__ \
-        std::string(__FILENAME__).append(":").append(std::to_string(__LINE__)).c_str()
+  std::size_t               _buffer_size{1 << 20};            ///< Write out from this many bytes
+  std::chrono::milliseconds _interval{200};                   ///< Write out at least this often, 0 for never
+  LogLevel                  _immediate{LogLevel::eERROR};     ///< Write out (and sync) at once from this level
+  durability                _durability{durability::eNONE};
+  std::chrono::milliseconds _sync_interval{1000};             ///< See durability::eBATCH
+};
 
-#define VA_ARGS(...),##__VA_ARGS__
+/**
+ * Log file written in large batches: lines are copied into a chain of 64KiB chunks
+ * and the chunks go out with one writev() on an O_APPEND descriptor, see
+ * flush_policy for when. Lines at or above the policy's immediate level are written
+ * out before write() returns; a timer thread covers the interval.
+ *
+ * Filling and writing use two chunk chains. The thread doing a write-out hands the
+ * filled chunks over under the lock and writes them without it, so logging threads
+ * keep appending while a write-out is in progress; a write-out requested meanwhile
+ * is taken by the one in progress before it finishes. Only the threads needing
+ * their lines written (immediate level, flush()) wait for it.
+ *
+ * A failed write-out keeps its unwritten chunks for the next one, up to
+ * MAX_RETAINED chunks (older ones are dropped and counted), and flush() reports
+ * the error. No rotation, use file_stream for that.
+ */
+class writev_stream: public log_stream
+{
+public:
+  static constexpr std::size_t CHUNK_SIZE = 64 * 1024;
+  static constexpr std::size_t MAX_RETAINED = 256;
 
-#define LOGGER anhthd::cpplibs::logger::lightweight::get_instance()
+  /**
+   * @param[in] file_ Log file path, appended to
+   * @param[in] policy_ Flush and durability policy
+   */
+  explicit writev_stream(const filesystem::path& file_,
+                         const flush_policy& policy_ = flush_policy{}):
+    _file{file_}, _policy{policy_} {
+    _fd = ::open(_file.raw(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+      std::stringstream ss;
+      ss << "Cannot open file stream at " << _file.raw();
+      throw std::runtime_error(ss.str());
+    }
+    if (_tick().count() > 0) {
+      _timer = std::thread([this]() { _run_timer(); });
+    }
+  }
 
-enum class LogLevel {
-  eTRACE    = 0x01,
-  eDEBUG    = 0x02,
-  eINFO     = 0x04,
-  eWARNING  = 0x08,
-  eERROR    = 0x16,
-  eFATAL    = 0x32
-};
+  ~writev_stream() {
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _stop = true;
+    }
+    _cv.notify_all();
+    if (_timer.joinable()) _timer.join();
+    try {
+      flush();
+    } catch (...) {
+      ;
+    }
+    ::close(_fd);
+  }
 
-#define LOG_LEVEL(level, fmt, ...) \
-  try { \
-    LOGGER.print_log(level, __CONTEXT__, fmt VA_ARGS(__VA_ARGS__)); \
-  } catch (const std::system_error& err) { \
-    (void)err; \
-  } catch (...) { \
-    ; \
-  } \
-
-#define TRACE(fmt, ...) \
-  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, \
-      fmt VA_ARGS(__VA_ARGS__))
-#define DEBUG(fmt, ...) \
-  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, \
-      fmt VA_ARGS(__VA_ARGS__))
-#define INFO(fmt, ...) \
-  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, \
-      fmt VA_ARGS(__VA_ARGS__))
-#define WARNING(fmt, ...) \
-  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, \
-      fmt VA_ARGS(__VA_ARGS__))
-#define ERROR(fmt, ...) \
-  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, \
-      fmt VA_ARGS(__VA_ARGS__))
-#define FATAL(fmt, ...) \
-  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, \
-      fmt VA_ARGS(__VA_ARGS__))
-
-static const auto g_start = std::chrono::high_resolution_clock::now();
-static const std::unordered_map<LogLevel, const char*> LogLevelStr = {
-  {LogLevel::eTRACE,    "TRACE"},
-  {LogLevel::eDEBUG,    "DEBUG"},
-  {LogLevel::eINFO,     "INFO"},
-  {LogLevel::eWARNING,  "WARNING"},
-  {LogLevel::eERROR,    "ERROR"},
-  {LogLevel::eFATAL,    "FATAL"},
-};
+  writev_stream(writev_stream&&) = delete;
+  writev_stream(const writev_stream&) = delete;
+  writev_stream& operator=(writev_stream&&) = delete;
+  writev_stream& operator=(const writev_stream&) = delete;
 
-class log_formater
-{
-private:
-  static double exect() {
-    auto n = high_resolution_clock::now();
-    return ((double)duration_cast<microseconds>(n - g_start).count()/1e6);
+  void print_log(const std::string_view& msg_) override {
+    _append(msg_, false);
   }
 
-public:
-  static inline std::string
-  format(LogLevel lvl_, const char* ctx_, const std::string_view& msg_) {
-    auto ss = std::stringstream{};
-    auto t = std::time(nullptr);
-    auto tm = *std::localtime(&t);
-    ss << std::put_time(&tm, "%d-%m-%Y %H:%M:%S") << std::setfill(' ');
-    //ss << " | " << std::setfill(' ') << std::setw(10) << exect() << "s";
-    ss << " | " << std::setfill(' ') << std::setw(07)  << LogLevelStr.at(lvl_);
-    ss << " | " << std::setfill(' ') << std::setw(30) << ctx_;
-    ss << " | " << msg_;
-    return ss.str();
+  void write(LogLevel lvl_, const std::string_view& msg_) override {
+    _append(msg_, !(lvl_ < _policy._immediate));
+  }
+
+  /**
+   * Write out everything buffered, and fdatasync() unless the durability is eNONE.
+   * Throws std::system_error if a write-out failed since the last flush(), the
+   * lines it could not write are retried by the next one.
+   */
+  void flush() override {
+    std::unique_lock<std::mutex> lk(_mtx);
+    _write_out(lk, _policy._durability != flush_policy::durability::eNONE, true);
+    if (_error) {
+      const int err = _error;
+      _error = 0;
+      throw std::system_error(err, std::generic_category(), "writev " + std::string(_file.raw()));
+    }
+  }
+
+  bool has_flush_policy() const noexcept override { return true; }
+
+  /**
+   * Bytes dropped after failed write-outs, see MAX_RETAINED.
+   */
+  std::uint64_t lost_bytes() const noexcept {
+    return _lost.load(std::memory_order_relaxed);
   }
 
 private:
-  log_formater() = default;
-  ~log_formater() = default;
+  struct chunk {
+    std::unique_ptr<char[]> _data{new char[CHUNK_SIZE]};
+    std::size_t             _used{0};
+  };
 
-  log_formater(log_formater&&) = delete;
-  log_formater(const log_formater&) = delete;
-  log_formater& operator=(log_formater&&) = delete;
-  log_formater& operator=(const log_formater&) = delete;
-};
+  filesystem::path        _file;
+  flush_policy            _policy;
+  int                     _fd{-1};
 
-#define MAX_MSG_LENGTH 512
-class logger {
-public:
-  using log_stream_p = std::unique_ptr<log_stream>;
+  /// Filling side and write-out state, guarded by _mtx
+  std::vector<chunk>      _fill;
+  std::size_t             _nfill{0};      ///< Chunks of _fill in use
+  std::size_t             _buffered{0};   ///< Bytes in _fill
+  bool                    _writing{false};  ///< A write-out is in progress
+  bool                    _more{false};   ///< Another write-out was requested
+  bool                    _sync{false};   ///< ... with an fdatasync()
+  std::uint64_t           _taken{0};      ///< Batches handed to the writing side
+  std::uint64_t           _written{0};    ///< Batches written out, or failed
+  int                     _error{0};      ///< errno of a failed write-out, see flush()
+  bool                    _stop{false};
+  std::mutex              _mtx;
+  std::condition_variable _cv;
+
+  /// Writing side, owned by the thread doing the write-out
+  std::vector<chunk>      _out;
+  std::size_t             _nout{0};       ///< Chunks of _out to write, maybe left by a failure
+  std::size_t             _off{0};        ///< Already written bytes of _out[0]
+  bool                    _dirty{false};  ///< Written since the last fdatasync()
+  std::chrono::steady_clock::time_point _last_sync{std::chrono::steady_clock::now()};
+  std::atomic<std::uint64_t> _lost{0};
+
+  std::thread             _timer;
+
+  void _append(const std::string_view& msg_, bool now_) {
+    std::unique_lock<std::mutex> lk(_mtx);
+    _copy(msg_.data(), msg_.size());
+    _copy("\n", 1);
+    _buffered += msg_.size() + 1;
+    if (now_) {
+      _write_out(lk, _policy._durability != flush_policy::durability::eNONE, true);
+    } else if (_buffered >= _policy._buffer_size) {
+      _write_out(lk, false, false);
+    }
+  }
+
+  void _copy(const char* p_, std::size_t n_) {
+    while (n_) {
+      if (!_nfill || _fill[_nfill - 1]._used == CHUNK_SIZE) {
+        if (_nfill == _fill.size()) _fill.emplace_back();
+        _fill[_nfill++]._used = 0;
+      }
+      chunk& c = _fill[_nfill - 1];
+      const std::size_t k = std::min(n_, CHUNK_SIZE - c._used);
+      memcpy(c._data.get() + c._used, p_, k);
+      c._used += k;
+      p_ += k;
+      n_ -= k;
+    }
+  }
 
   /**
-   * Set minimum log level.
+   * Write out the lines appended so far, or leave them to the write-out in
+   * progress. Called and returns with lk_ holding _mtx, never waits for a
+   * write-out while holding it.
    *
-   * @param[in] min_lvl_ Specify the minimum log level.
+   * @param[in] sync_ Force an fdatasync()
+   * @param[in] wait_ Return once the lines appended so far were written out
    */
-  void set_log_level(LogLevel min_lvl_) {
-    _min_lvl = min_lvl_;
+  void _write_out(std::unique_lock<std::mutex>& lk_, bool sync_, bool wait_) {
+    const std::uint64_t batch = _taken + 1;   // The next batch takes the lines so far
+    _more = true;
+    _sync = _sync || sync_;
+    if (!_writing) {
+      _writing = true;
+      while (_more) {
+        _more = false;
+        try {
+          _take_fill();
+        } catch (...) {
+          _writing = false;
+          throw;
+        }
+        const bool sync = _sync;
+        const std::uint64_t taken = _taken;
+        _sync = false;
+        lk_.unlock();
+        const int err = _write_batch(sync);
+        lk_.lock();
+        if (err) _error = err;
+        _written = taken;
+        _cv.notify_all();
+      }
+      _writing = false;
+    }
+    if (wait_) {
+      _cv.wait(lk_, [this, batch]() { return _written >= batch; });
+    }
   }
 
   /**
-   * Set log file path and its backup size and maximum number of backups.
+   * Move the filled chunks behind the ones left to write, spare chunks take their
+   * place. Under _mtx, by the thread doing the write-out. Unchanged if growing
+   * _out throws.
+   */
+  void _take_fill() {
+    if (_out.size() < _nout + _nfill) _out.resize(_nout + _nfill);
+    for (std::size_t j = 0; j < _nfill; ++j) {
+      std::swap(_out[_nout + j], _fill[j]);
+    }
+    _nout += _nfill;
+    _nfill = 0;
+    _buffered = 0;
+    ++_taken;
+  }
+
+  /**
+   * Write the taken chunks out and fdatasync() as the durability says. Without
+   * _mtx, by the thread doing the write-out.
    *
-   * @param[in] lf_ Log file path
-   * @param[in] fsize_  Log file size to make backup
-   * @param[in] nrt_ Maximum number of rotated files
+   * @return 0 or the errno of the failed writev().
    */
-  void set_log_file(const filesystem::path& lf_,
-                    std::uint32_t fsize_,
-                    std::uint8_t nrt_) {
-    if ((std::int32_t)fsize_ < 0) {
-      throw std::invalid_argument("Log file size cannot be negative");
+  int _write_batch(bool sync_) noexcept {
+    const int err = _writev();
+    const auto now = std::chrono::steady_clock::now();
+    if (_policy._durability == flush_policy::durability::eEVERY_WRITE ||
+        (_policy._durability == flush_policy::durability::eBATCH &&
+         now - _last_sync >= _policy._sync_interval)) {
+      sync_ = true;
     }
-    if ((std::int8_t)nrt_ < 0) {
-      throw std::invalid_argument("Number of rotated log files cannot be negative");
+    if (sync_ && _dirty) {
+      ::fdatasync(_fd);
+      _dirty = false;
+      _last_sync = now;
     }
-    std::lock_guard<std::mutex> lk(_mtx);
-    _streams.emplace_back(std::make_unique<file_stream>(lf_, fsize_, nrt_));
+    return err;
   }
 
   /**
-   * Set log trace file.
+   * Write _out[0.._nout) with as few writev() calls as the kernel allows. On a
+   * failure the unwritten chunks are moved to the front, to be written first next
+   * time.
    *
-   * @param[in] tf_ Specify the trace file
-   * @param[in] fsize_  Trace file size to make backup
-   * @param[in] nrt_ Maximum number of rotated files
+   * @return 0 or the errno of the failed call.
    */
-  void set_log_trace(const filesystem::path& tf_,
-                     std::uint32_t fsize_,
-                     std::uint8_t nrt_) {
-    if ((std::int32_t)fsize_ < 0) {
-      throw std::invalid_argument("Trace file size cannot be negative");
+  int _writev() noexcept {
+    constexpr int MAX_IOV = 64;
+    struct iovec iov[MAX_IOV];
+    std::size_t i = 0;
+    int err = 0;
+    while (i < _nout) {
+      int k = 0;
+      for (std::size_t j = i; j < _nout && k < MAX_IOV; ++j, ++k) {
+        const std::size_t o = (j == i) ? _off : 0;
+        iov[k].iov_base = _out[j]._data.get() + o;
+        iov[k].iov_len = _out[j]._used - o;
+      }
+      const ssize_t w = ::writev(_fd, iov, k);
+      if (w < 0) {
+        if (errno == EINTR) continue;
+        err = errno;
+        break;
+      }
+      _dirty = true;
+      std::size_t left = static_cast<std::size_t>(w);
+      while (left && i < _nout) {
+        const std::size_t rest = _out[i]._used - _off;
+        if (left < rest) {
+          _off += left;
+          left = 0;
+        } else {
+          left -= rest;
+          _off = 0;
+          ++i;
+        }
+      }
     }
-    if ((std::int8_t)nrt_ < 0) {
-      throw std::invalid_argument("Number of rotated trace files cannot be negative");
+    std::rotate(_out.begin(), _out.begin() + i, _out.begin() + _nout);
+    _nout -= i;
+    if (_nout > MAX_RETAINED) {
+      std::uint64_t lost = _out[0]._used - _off;
+      for (std::size_t j = 1; j < _nout - MAX_RETAINED; ++j) lost += _out[j]._used;
+      std::rotate(_out.begin(), _out.begin() + (_nout - MAX_RETAINED), _out.begin() + _nout);
+      _nout = MAX_RETAINED;
+      _off = 0;
+      _lost.fetch_add(lost, std::memory_order_relaxed);
     }
-    std::lock_guard<std::mutex> lk(_mtx);
-    _streams.emplace_back(std::make_unique<file_stream>(tf_, fsize_, nrt_));
+    return err;
   }
 
   /**
-   * Enable log stream to console.
+   * Timer period: the flush interval, or the sync interval in eBATCH mode if shorter.
    */
-  void enable_console() {
-    std::lock_guard<std::mutex> lk(_mtx);
-    _streams.emplace_back(std::make_unique<console_stream>());
+  std::chrono::milliseconds _tick() const noexcept {
+    std::chrono::milliseconds t = _policy._interval;
+    if (_policy._durability == flush_policy::durability::eBATCH &&
+        (!t.count() || _policy._sync_interval < t)) {
+      t = _policy._sync_interval;
+    }
+    return t;
   }
 
-  void print_log(LogLevel lvl_, const char* ctx_, const char* fmt_, ...) {
-    if (lvl_ < _min_lvl) return;
+  void _run_timer() {
+    const std::chrono::milliseconds tick = _tick();
+    std::unique_lock<std::mutex> lk(_mtx);
+    while (!_stop) {
+      if (_cv.wait_for(lk, tick, [this]() { return _stop; })) break;
+      try {
+        _write_out(lk, false, false);
+      } catch (...) {
+        ; // Out of memory, the next tick retries.
+      }
+    }
+  }
+};
 
-    std::lock_guard<std::mutex> lk(_mtx);
-    memset(_buffer, '\0', MAX_MSG_LENGTH);
-    va_list arg_list;
-    va_start(arg_list, fmt_);
-    vsnprintf(_buffer, MAX_MSG_LENGTH, fmt_, arg_list);
-    va_end(arg_list);
-    std::string_view msg_(_buffer);
+/**
+ * Log file written through a shared memory mapping, for very high rates: a line
+ * claims its byte range with one fetch_add and is memcpy'd into the mapping, no
+ * syscall and no lock per line. The kernel writes the pages back, also after the
+ * process crashed.
+ *
+ * The file is mapped over its whole capacity_ up front but grows in chunk_ steps
+ * (ftruncate, under a lock, once per chunk). The claim crossing the capacity
+ * rotates the file like file_stream does, after the lines in flight completed;
+ * the file is truncated to its real size on rotation and close. A file left over
+ * by a crash ends with NUL padding, trimmed when it is opened again.
+ *
+ * A line longer than the capacity is cut to it, and counted (cut_lines()).
+ */
+class mmap_stream: public log_stream
+{
+public:
+  /**
+   * @param[in] file_ Log file path, appended to
+   * @param[in] capacity_ Maximum size of a log file in bytes
+   * @param[in] nrt_ Maximum number of rotated files, 0 to simply truncate the file
+   * @param[in] chunk_ The file grows by this many bytes at a time
+   * @param[in] compressor_ Compresses the rotated files, if set
+   */
+  mmap_stream(const filesystem::path& file_,
+              std::uint64_t capacity_ = 256 << 20,
+              std::uint8_t nrt_ = 4,
+              std::uint64_t chunk_ = 16 << 20,
+              std::shared_ptr<backup_compressor> compressor_ = nullptr):
+    _file{file_}, _cap{capacity_}, _nrt{nrt_}, _chunk{chunk_},
+    _compressor{std::move(compressor_)} {
+    if (_cap < 4096 || !_chunk) {
+      throw std::invalid_argument("Mapped log file capacity must be at least 4KiB");
+    }
+    region* r = _open_region(false);
+    if (r->_claimed.load(std::memory_order_relaxed) >= _cap) {
+      r = _next_region(*r, r->_size.load(std::memory_order_relaxed));
+    }
+    _cur.store(r, std::memory_order_release);
+  }
+
+  /**
+   * No line may be in flight anymore.
+   */
+  ~mmap_stream() {
+    region* r = _cur.load(std::memory_order_acquire);
+    if (r) _close_region(*r, r->_committed.load(std::memory_order_acquire));
+  }
+
+  mmap_stream(mmap_stream&&) = delete;
+  mmap_stream(const mmap_stream&) = delete;
+  mmap_stream& operator=(mmap_stream&&) = delete;
+  mmap_stream& operator=(const mmap_stream&) = delete;
 
-    auto msg = log_formater::format(lvl_, ctx_, msg_);
-    for (auto& s : _streams) {
-      s->print_log(msg);
+  void print_log(const std::string_view& msg_) override {
+    const std::size_t len = std::min<std::uint64_t>(msg_.size(), _cap - 1);
+    if (len < msg_.size()) _cut.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t n = len + 1;
+    const writer w{*this};
+    for (;;) {
+      region* r = _cur.load(std::memory_order_acquire);
+      const std::uint64_t off = r->_claimed.fetch_add(n, std::memory_order_relaxed);
+      if (off + n <= _cap) {
+        const bool ok = _reserve(*r, off + n);
+        if (ok) {
+          memcpy(r->_map + off, msg_.data(), len);
+          r->_map[off + len] = '\n';
+        }
+        r->_committed.fetch_add(n, std::memory_order_release);
+        if (!ok) {
+          throw std::system_error(errno, std::generic_category(), "ftruncate");
+        }
+        return;
+      }
+      if (off <= _cap) {
+        // The first claim past the capacity: wait for the lines in flight, then rotate.
+        while (r->_committed.load(std::memory_order_acquire) != off) {
+          std::this_thread::yield();
+        }
+        std::lock_guard<std::mutex> lk(_mtx);
+        try {
+          _cur.store(_next_region(*r, off), std::memory_order_seq_cst);
+        } catch (...) {
+          _broken.store(true, std::memory_order_release);
+          throw;
+        }
+        _retire(*r);
+        continue;
+      }
+      while (_cur.load(std::memory_order_acquire) == r) {
+        if (_broken.load(std::memory_order_acquire)) {
+          throw std::runtime_error("Mapped log file could not be rotated");
+        }
+        std::this_thread::yield();
+      }
     }
   }
 
   /**
-   * Print log message to actual available Log Stream(s)
+   * Lines are in the page cache as soon as they are copied, nothing to flush.
+   */
+  bool has_flush_policy() const noexcept override { return true; }
+
+  /**
+   * Lines cut to the capacity of a file.
+   */
+  std::uint64_t cut_lines() const noexcept {
+    return _cut.load(std::memory_order_relaxed);
+  }
+
+private:
+  /**
+   * One mapped file. A thread which loaded a rotated region only ever claims past
+   * its capacity and retries, so a rotated region is retired rather than freed, see
+   * writer.
+   */
+  struct region {
+    int                         _fd{-1};
+    char*                       _map{nullptr};
+    std::atomic<std::uint64_t>  _claimed{0};    ///< Next free offset
+    std::atomic<std::uint64_t>  _committed{0};  ///< Bytes of the claims completed
+    std::atomic<std::uint64_t>  _size{0};       ///< File size, the mapping is valid below
+    std::uint64_t               _retired{0};    ///< Retirement generation, 0 while current
+  };
+
+  /**
+   * A thread in print_log(), counted in _users. The retired regions a thread may
+   * hold were retired while it was counted: the thread bringing the count to 0
+   * frees the regions retired up to the generation it saw.
+   */
+  struct writer {
+    explicit writer(mmap_stream& s_) noexcept: _s{s_} {
+      _s._users.fetch_add(1, std::memory_order_seq_cst);
+    }
+    ~writer() {
+      _s._leave();
+    }
+    mmap_stream& _s;
+  };
+
+  filesystem::path                      _file;
+  std::uint64_t                         _cap;
+  std::uint8_t                          _nrt;
+  std::uint64_t                         _chunk;
+  std::shared_ptr<backup_compressor>    _compressor;
+  std::atomic<region*>                  _cur{nullptr};
+  std::atomic<bool>                     _broken{false};
+  std::atomic<std::uint64_t>            _users{0};    ///< Generation << 32 | writers
+  std::atomic<std::size_t>              _nretired{0};
+  std::atomic<std::uint64_t>            _cut{0};
+  std::vector<std::unique_ptr<region>>  _regions;   ///< Current and retired, guarded by _mtx
+  std::mutex                            _mtx;       ///< File growth and rotation
+
+  /**
+   * Retire the rotated region r_, _cur moved on already. Under _mtx.
+   */
+  void _retire(region& r_) noexcept {
+    r_._retired = (_users.fetch_add(std::uint64_t{1} << 32, std::memory_order_seq_cst) >> 32) + 1;
+    _nretired.fetch_add(1, std::memory_order_release);
+  }
+
+  void _leave() noexcept {
+    const std::uint64_t users = _users.fetch_sub(1, std::memory_order_seq_cst);
+    if ((users & 0xffffffffu) != 1 || !_nretired.load(std::memory_order_acquire)) return;
+    std::lock_guard<std::mutex> lk(_mtx);
+    const std::uint64_t gen = users >> 32;
+    std::size_t left = 0;
+    for (std::size_t i = 0; i < _regions.size();) {
+      const std::uint64_t retired = _regions[i]->_retired;
+      if (retired && retired <= gen) {
+        _regions[i] = std::move(_regions.back());
+        _regions.pop_back();
+        continue;
+      }
+      left += retired != 0;
+      ++i;
+    }
+    _nretired.store(left, std::memory_order_release);
+  }
+
+  /**
+   * Grow the file to cover [0, end_) if needed.
    *
-   * @param[in] msg_ Log message content
+   * @return false if ftruncate() failed, errno is set then.
    */
-  void print_log(LogLevel lvl_, const char* ctx_, const std::string_view& msg_) {
-    if (lvl_ < _min_lvl) return;
+  bool _reserve(region& r_, std::uint64_t end_) {
+    if (end_ <= r_._size.load(std::memory_order_acquire)) return true;
+    std::lock_guard<std::mutex> lk(_mtx);
+    const std::uint64_t size = r_._size.load(std::memory_order_relaxed);
+    if (end_ <= size) return true;
+    const std::uint64_t grown = std::min(_cap, (end_ + _chunk - 1) / _chunk * _chunk);
+    if (::ftruncate(r_._fd, static_cast<off_t>(grown)) != 0) return false;
+    r_._size.store(grown, std::memory_order_release);
+    return true;
+  }
 
-    auto msg = log_formater::format(lvl_, ctx_, msg_);
-    for (auto& s : _streams) {
-      s->print_log(msg);
+  /**
+   * Open and map the log file, appending after its content (trailing NUL padding
+   * of a crashed run excluded) or truncating it.
+   */
+  region* _open_region(bool truncate_) {
+    int flags = O_RDWR | O_CREAT | O_CLOEXEC;
+    if (truncate_) flags |= O_TRUNC;
+    const int fd = ::open(_file.raw(), flags, 0644);
+    if (fd < 0) {
+      std::stringstream ss;
+      ss << "Cannot open file stream at " << _file.raw();
+      throw std::runtime_error(ss.str());
+    }
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (::fstat(fd, &st) == 0) {
+      map = ::mmap(nullptr, _cap, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    if (map == MAP_FAILED) {
+      const int err = errno;
+      ::close(fd);
+      throw std::system_error(err, std::generic_category(), "mmap");
     }
+    auto r = std::make_unique<region>();
+    r->_fd = fd;
+    r->_map = static_cast<char*>(map);
+    std::uint64_t size = std::min<std::uint64_t>(static_cast<std::uint64_t>(st.st_size), _cap);
+    r->_size.store(static_cast<std::uint64_t>(st.st_size), std::memory_order_relaxed);
+    while (size && !r->_map[size - 1]) --size;
+    r->_claimed.store(size, std::memory_order_relaxed);
+    r->_committed.store(size, std::memory_order_relaxed);
+    _regions.emplace_back(std::move(r));
+    return _regions.back().get();
   }
 
-private:
-  std::vector<log_stream_p>   _streams{};
-  LogLevel                    _min_lvl{LogLevel::eINFO};
-  std::mutex                  _mtx;
-  char                        _buffer[MAX_MSG_LENGTH]{};;
+  void _close_region(region& r_, std::uint64_t end_) noexcept {
+    if (r_._fd < 0) return;
+    (void)::ftruncate(r_._fd, static_cast<off_t>(end_));
+    ::munmap(r_._map, _cap);
+    ::close(r_._fd);
+    r_._fd = -1;
+  }
+
+  /**
+   * Truncate the full file to end_, rotate it and map a new one.
+   */
+  region* _next_region(region& r_, std::uint64_t end_) {
+    _close_region(r_, end_);
+    if (_compressor) {
+      _compressor->shift(_file, _nrt);
+    } else {
+      shift_backups(_file, _nrt);
+    }
+    if (_nrt) {
+      (void)std::rename(_file.raw(), backup_name(_file, 1).c_str());
+      if (_compressor) _compressor->submit(_file, _nrt);
+    }
+    return _open_region(true);
+  }
+};
+
+/**
+ * File name part of a path, evaluated at compile time for __FILE__.
+ */
+constexpr const char* basename(const char* path_) {
+  const char* base = path_;
+  for (const char* p = path_; *p; ++p) {
+    if (*p == '/') base = p + 1;
+  }
+  return base;
+}
+
+#define __FILENAME__ anhthd::cpplibs::logger::lightweight::basename(__FILE__)
+
+#define LOGGER anhthd::cpplibs::logger::lightweight::get_instance()
+
+/**
+ * Levels of a call site resolved against the module and file overrides, see
+ * logger::set_module_level(). Stale once the logger's level generation moved on,
+ * then resolved again by the next call.
+ */
+struct site_level {
+  /// generation << 16 | logged level << 8 | enabled level (logged or recorded)
+  std::atomic<std::uint64_t>  _v{0};
+};
+
+/**
+ * Static descriptor of a log call site, built at compile time.
+ */
+struct log_site {
+  LogLevel    _lvl;
+  const char* _file;    ///< Base name
+  int         _line;
+  const char* _fmt;
+  const char* _module{""};          ///< LOG_MODULE of the translation unit
+  site_level* _cache{nullptr};      ///< Static of the call site
+};
+
+/**
+ * Module of the call sites of a translation unit, for the per-module levels. Define
+ * it before including logger.hh, i.e. #define LOG_MODULE "net" or -DLOG_MODULE.
+ */
+#ifndef LOG_MODULE
+#define LOG_MODULE ""
+#endif
+
+/**
+ * Calls below this level are compiled out entirely, i.e. -DLOG_MIN_LEVEL=0x04 strips
+ * TRACE and DEBUG. Use the LogLevel values.
+ */
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL 0
+#endif
+
+/**
+ * First argument of a macro argument list, i.e. the format of LOG_LEVEL(level, ...).
+ * Standard C++17, no `, ##__VA_ARGS__` needed.
+ */
+#define LOG_FMT(...) LOG_FMT_(__VA_ARGS__, 0)
+#define LOG_FMT_(fmt, ...) fmt
+
+/**
+ * The format literal is wrapped into a local type so logger::log() can parse and
+ * check it against the arguments at compile time. The arguments are only evaluated
+ * once the level check passed.
+ */
+#define LOG_LEVEL(level, ...) LOG_CALL_(level, (void)0, true, __VA_ARGS__)
+
+/**
+ * state_ declares the per-call-site state of a sampled call, cond_ is checked
+ * after the level.
+ */
+#define LOG_CALL_(level, state_, cond_, ...) \
+  do { \
+    if constexpr (static_cast<int>(level) >= LOG_MIN_LEVEL) { \
+      struct _log_format { \
+        static constexpr std::string_view value() { return LOG_FMT(__VA_ARGS__); } \
+      }; \
+      static anhthd::cpplibs::logger::lightweight::site_level _log_level; \
+      static constexpr anhthd::cpplibs::logger::lightweight::log_site _log_site{ \
+        level, __FILENAME__, __LINE__, LOG_FMT(__VA_ARGS__), LOG_MODULE, &_log_level}; \
+      state_; \
+      if (LOGGER.is_enabled(_log_site) && (cond_)) { \
+        try { \
+          LOGGER.log<_log_format>(_log_site, __VA_ARGS__); \
+        } catch (const std::system_error& err) { \
+          (void)err; \
+        } catch (...) { \
+          ; \
+        } \
+      } \
+    } \
+  } while (0)
+
+#define TRACE(...) \
+  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, __VA_ARGS__)
+#define DEBUG(...) \
+  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, __VA_ARGS__)
+#define INFO(...) \
+  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, __VA_ARGS__)
+#define WARNING(...) \
+  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, __VA_ARGS__)
+#define ERROR(...) \
+  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, __VA_ARGS__)
+#define FATAL(...) \
+  LOG_LEVEL(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, __VA_ARGS__)
+
+/**
+ * Structured calls: a constant message and typed fields, i.e.
+ * INFO_KV("request done", kv("user", id), kv("ms", 3.25)). See structured.hh.
+ */
+#define LOG_KV(level, ...) \
+  do { \
+    if constexpr (static_cast<int>(level) >= LOG_MIN_LEVEL) { \
+      static anhthd::cpplibs::logger::lightweight::site_level _log_level; \
+      static constexpr anhthd::cpplibs::logger::lightweight::log_site _log_site{ \
+        level, __FILENAME__, __LINE__, LOG_FMT(__VA_ARGS__), LOG_MODULE, &_log_level}; \
+      if (LOGGER.is_enabled(_log_site)) { \
+        try { \
+          LOGGER.log_kv(_log_site, __VA_ARGS__); \
+        } catch (const std::system_error& err) { \
+          (void)err; \
+        } catch (...) { \
+          ; \
+        } \
+      } \
+    } \
+  } while (0)
+
+#define TRACE_KV(...) \
+  LOG_KV(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, __VA_ARGS__)
+#define DEBUG_KV(...) \
+  LOG_KV(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, __VA_ARGS__)
+#define INFO_KV(...) \
+  LOG_KV(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, __VA_ARGS__)
+#define WARNING_KV(...) \
+  LOG_KV(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, __VA_ARGS__)
+#define ERROR_KV(...) \
+  LOG_KV(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, __VA_ARGS__)
+#define FATAL_KV(...) \
+  LOG_KV(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, __VA_ARGS__)
+
+/**
+ * Sampled calls, for call sites in hot loops. The state is a static of the call
+ * site: a suppressed call costs one relaxed atomic operation (plus a clock read
+ * for the rate limit) and neither formats nor evaluates the arguments.
+ *
+ *   LOG_EVERY_N(level, n, fmt, ...)             1st, n+1-th, 2n+1-th ... call
+ *   LOG_FIRST_N(level, n, fmt, ...)             First n calls
+ *   LOG_RATE_LIMITED(level, per_sec, fmt, ...)  Up to per_sec calls a second
+ *
+ * and the same per level, i.e. WARNING_EVERY_N(n, fmt, ...).
+ *
+ * Only calls passing the level are counted.
+ */
+#define LOG_EVERY_N(level, n, ...) \
+  LOG_CALL_(level, static anhthd::cpplibs::logger::lightweight::every_n _log_state, \
+            _log_state.pass(n), __VA_ARGS__)
+#define LOG_FIRST_N(level, n, ...) \
+  LOG_CALL_(level, static anhthd::cpplibs::logger::lightweight::first_n _log_state, \
+            _log_state.pass(n), __VA_ARGS__)
+#define LOG_RATE_LIMITED(level, per_sec, ...) \
+  LOG_CALL_(level, static anhthd::cpplibs::logger::lightweight::rate_limit _log_state, \
+            _log_state.pass(per_sec), __VA_ARGS__)
+
+#define TRACE_EVERY_N(n, ...) \
+  LOG_EVERY_N(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, n, __VA_ARGS__)
+#define DEBUG_EVERY_N(n, ...) \
+  LOG_EVERY_N(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, n, __VA_ARGS__)
+#define INFO_EVERY_N(n, ...) \
+  LOG_EVERY_N(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, n, __VA_ARGS__)
+#define WARNING_EVERY_N(n, ...) \
+  LOG_EVERY_N(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, n, __VA_ARGS__)
+#define ERROR_EVERY_N(n, ...) \
+  LOG_EVERY_N(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, n, __VA_ARGS__)
+#define FATAL_EVERY_N(n, ...) \
+  LOG_EVERY_N(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, n, __VA_ARGS__)
+
+#define TRACE_FIRST_N(n, ...) \
+  LOG_FIRST_N(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, n, __VA_ARGS__)
+#define DEBUG_FIRST_N(n, ...) \
+  LOG_FIRST_N(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, n, __VA_ARGS__)
+#define INFO_FIRST_N(n, ...) \
+  LOG_FIRST_N(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, n, __VA_ARGS__)
+#define WARNING_FIRST_N(n, ...) \
+  LOG_FIRST_N(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, n, __VA_ARGS__)
+#define ERROR_FIRST_N(n, ...) \
+  LOG_FIRST_N(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, n, __VA_ARGS__)
+#define FATAL_FIRST_N(n, ...) \
+  LOG_FIRST_N(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, n, __VA_ARGS__)
+
+#define TRACE_RATE_LIMITED(per_sec, ...) \
+  LOG_RATE_LIMITED(anhthd::cpplibs::logger::lightweight::LogLevel::eTRACE, per_sec, __VA_ARGS__)
+#define DEBUG_RATE_LIMITED(per_sec, ...) \
+  LOG_RATE_LIMITED(anhthd::cpplibs::logger::lightweight::LogLevel::eDEBUG, per_sec, __VA_ARGS__)
+#define INFO_RATE_LIMITED(per_sec, ...) \
+  LOG_RATE_LIMITED(anhthd::cpplibs::logger::lightweight::LogLevel::eINFO, per_sec, __VA_ARGS__)
+#define WARNING_RATE_LIMITED(per_sec, ...) \
+  LOG_RATE_LIMITED(anhthd::cpplibs::logger::lightweight::LogLevel::eWARNING, per_sec, __VA_ARGS__)
+#define ERROR_RATE_LIMITED(per_sec, ...) \
+  LOG_RATE_LIMITED(anhthd::cpplibs::logger::lightweight::LogLevel::eERROR, per_sec, __VA_ARGS__)
+#define FATAL_RATE_LIMITED(per_sec, ...) \
+  LOG_RATE_LIMITED(anhthd::cpplibs::logger::lightweight::LogLevel::eFATAL, per_sec, __VA_ARGS__)
+
+/**
+ * Level names, padded to the width of the level column.
+ */
+constexpr std::string_view level_name(LogLevel lvl_) {
+  switch (lvl_) {
+  case LogLevel::eTRACE:    return "  TRACE";
+  case LogLevel::eDEBUG:    return "  DEBUG";
+  case LogLevel::eINFO:     return "   INFO";
+  case LogLevel::eWARNING:  return "WARNING";
+  case LogLevel::eERROR:    return "  ERROR";
+  case LogLevel::eFATAL:    return "  FATAL";
+  }
+  return "      ?";
+}
+
+/**
+ * Level from its name, case-sensitive and without padding: "TRACE" ... "FATAL".
+ */
+inline bool parse_level(std::string_view name_, LogLevel& lvl_) {
+  for (LogLevel l : {LogLevel::eTRACE, LogLevel::eDEBUG, LogLevel::eINFO,
+                     LogLevel::eWARNING, LogLevel::eERROR, LogLevel::eFATAL}) {
+    std::string_view n = level_name(l);
+    n.remove_prefix(n.find_first_not_of(' '));
+    if (n == name_) {
+      lvl_ = l;
+      return true;
+    }
+  }
+  return false;
+}
+
+/**
+ * Wall clock of the log lines, in nanoseconds since epoch.
+ *
+ * By default it reads CLOCK_REALTIME (a vDSO call). use_tsc() switches to the time
+ * stamp counter on x86: a single rdtsc scaled against CLOCK_REALTIME, calibrated
+ * once over calibration_ms_. Only worth it on hosts with an invariant TSC; the
+ * clock does not follow NTP adjustments made after the calibration.
+ */
+class log_clock
+{
+public:
+  /**
+   * TSC reading _base_tsc taken at _base_ns, and the TSC period.
+   */
+  struct tsc_calibration {
+    std::int64_t  _base_ns{0};
+    std::uint64_t _base_tsc{0};
+    double        _ns_per_tick{0};
+  };
+
+  static std::int64_t now() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+    const tsc_calibration* c = _tsc().load(std::memory_order_acquire);
+    if (c) {
+      return c->_base_ns + static_cast<std::int64_t>(
+        static_cast<double>(__rdtsc() - c->_base_tsc) * c->_ns_per_tick);
+    }
+#endif
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+
+  /**
+   * Switch to (or back from) the TSC clock.
+   *
+   * @return false if the TSC is not available on this architecture.
+   */
+  static bool use_tsc(bool on_ = true, unsigned calibration_ms_ = 20) {
+#if defined(__x86_64__) || defined(__i386__)
+    if (!on_) {
+      _tsc().store(nullptr, std::memory_order_release);
+      return true;
+    }
+    static tsc_calibration slots[2];
+    static std::atomic<unsigned> next{0};
+    tsc_calibration& c = slots[next.fetch_add(1) & 1];
+    if (!calibrate_tsc(c, calibration_ms_)) return false;
+    _tsc().store(&c, std::memory_order_release);
+    return true;
+#else
+    return !on_;
+#endif
+  }
+
+  /**
+   * The calibration in use since use_tsc(), if any.
+   */
+  static bool tsc(tsc_calibration& c_) noexcept {
+    const tsc_calibration* c = _tsc().load(std::memory_order_acquire);
+    if (c) c_ = *c;
+    return c != nullptr;
+  }
+
+  /**
+   * Measure the TSC against CLOCK_REALTIME over calibration_ms_, as use_tsc() does.
+   *
+   * @return false if the TSC is not available or did not advance.
+   */
+  static bool calibrate_tsc(tsc_calibration& c_, unsigned calibration_ms_) {
+#if defined(__x86_64__) || defined(__i386__)
+    const std::int64_t ns0 = _realtime();
+    const std::uint64_t tsc0 = __rdtsc();
+    std::this_thread::sleep_for(std::chrono::milliseconds(calibration_ms_));
+    const std::int64_t ns1 = _realtime();
+    const std::uint64_t tsc1 = __rdtsc();
+    if (tsc1 <= tsc0) return false;
+
+    c_._base_ns = ns1;
+    c_._base_tsc = tsc1;
+    c_._ns_per_tick = static_cast<double>(ns1 - ns0) / static_cast<double>(tsc1 - tsc0);
+    return true;
+#else
+    (void)c_;
+    (void)calibration_ms_;
+    return false;
+#endif
+  }
+
+private:
+  static std::atomic<const tsc_calibration*>& _tsc() noexcept {
+    static std::atomic<const tsc_calibration*> c{nullptr};
+    return c;
+  }
+
+  static std::int64_t _realtime() noexcept {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return static_cast<std::int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+  }
+};
+
+/**
+ * Per-call-site state of LOG_EVERY_N.
+ */
+struct every_n {
+  std::atomic<std::uint64_t> _count{0};
+
+  bool pass(std::uint64_t n_) noexcept {
+    const std::uint64_t c = _count.fetch_add(1, std::memory_order_relaxed);
+    return n_ <= 1 || c % n_ == 0;
+  }
+};
+
+/**
+ * Per-call-site state of LOG_FIRST_N. Once n_ calls passed, a plain load.
+ */
+struct first_n {
+  std::atomic<std::uint64_t> _count{0};
+
+  bool pass(std::uint64_t n_) noexcept {
+    return _count.load(std::memory_order_relaxed) < n_ &&
+           _count.fetch_add(1, std::memory_order_relaxed) < n_;
+  }
+};
+
+/**
+ * Per-call-site state of LOG_RATE_LIMITED: a generic cell rate algorithm, i.e. a
+ * token bucket holding one second worth of calls kept in a single atomic. _tat
+ * is the time the bucket will be empty again, a call passes while that is less
+ * than a second ahead.
+ */
+struct rate_limit {
+  std::atomic<std::int64_t> _tat{0};
+
+  bool pass(std::uint32_t per_sec_) noexcept {
+    if (!per_sec_) return false;
+    constexpr std::int64_t SECOND = 1000000000;
+    const std::int64_t step = SECOND / per_sec_;
+    const std::int64_t now = log_clock::now();
+    std::int64_t tat = _tat.load(std::memory_order_relaxed);
+    do {
+      if (tat - now > SECOND - step) return false;
+    } while (!_tat.compare_exchange_weak(tat, std::max(tat, now) + step,
+                                         std::memory_order_relaxed));
+    return true;
+  }
+};
+
+#define MAX_MSG_LENGTH 512
+#define MAX_CTX_LENGTH 64
+#define MAX_STREAMS    16
+
+/**
+ * Renders "dd-mm-YYYY HH:MM:SS.uuuuuu | LEVEL | file:line | message", or the same
+ * as a JSON object or logfmt pairs (see line_format) with the time in ISO 8601.
+ *
+ * No stream and no allocation once the output buffer has grown: the date-time part
+ * is rendered (localtime_r) once per second per thread and cached, only the
+ * microseconds are filled in for every line.
+ */
+class log_formater
+{
+public:
+  static constexpr std::size_t CTX_WIDTH = 30;
+
+  /**
+   * Append the line of a message issued at ns_ (see log_clock) to out_.
+   */
+  static void format_to(std::string& out_, LogLevel lvl_, const char* ctx_,
+                        const std::string_view& msg_, std::int64_t ns_) {
+    const std::string_view ctx(ctx_ ? ctx_ : "");
+    char* p = _prefix(out_, lvl_, ctx.size(), ns_, msg_.size());
+    memcpy(p, ctx.data(), ctx.size());
+    _suffix(p + ctx.size(), msg_);
+  }
+
+  /**
+   * Append the line of a static call site to out_.
+   */
+  static void format_to(std::string& out_, LogLevel lvl_, const log_site& site_,
+                        const std::string_view& msg_, std::int64_t ns_) {
+    char line[16];
+    const std::size_t file = strlen(site_._file);
+    const std::size_t nline = std::to_chars(line, line + sizeof(line), site_._line).ptr - line;
+    char* p = _prefix(out_, lvl_, file + 1 + nline, ns_, msg_.size());
+    memcpy(p, site_._file, file);
+    p[file] = ':';
+    memcpy(p + file + 1, line, nline);
+    _suffix(p + file + 1 + nline, msg_);
+  }
+
+  /**
+   * Append a line in fmt_. fields_ are encoded for fmt_ already (see
+   * structured::encode()), the text layout takes them after the message.
+   *
+   * @param[in] ctx_ Context, or nullptr for the call site site_
+   */
+  static void format_to(std::string& out_, line_format fmt_, LogLevel lvl_,
+                        const char* ctx_, const log_site* site_,
+                        const std::string_view& msg_, const std::string_view& fields_,
+                        std::int64_t ns_) {
+    if (fmt_ == line_format::eTEXT) {
+      if (site_) {
+        format_to(out_, lvl_, *site_, msg_, ns_);
+      } else {
+        format_to(out_, lvl_, ctx_, msg_, ns_);
+      }
+      out_.append(fields_.data(), fields_.size());
+      return;
+    }
+
+    char where[MAX_CTX_LENGTH + 16];
+    std::string_view ctx(ctx_ ? ctx_ : "");
+    if (site_) {
+      const std::size_t file = std::min(strlen(site_->_file), std::size_t{MAX_CTX_LENGTH});
+      memcpy(where, site_->_file, file);
+      where[file] = ':';
+      const char* end = std::to_chars(where + file + 1, where + sizeof(where), site_->_line).ptr;
+      ctx = std::string_view(where, end - where);
+    }
+    std::string_view lvl = level_name(lvl_);
+    lvl.remove_prefix(lvl.find_first_not_of(' '));
+
+    int usec;
+    const char* date = _date(ns_, usec)._iso;
+    char time[DATE + 7];
+    memcpy(time, date, DATE);
+    time[DATE] = '.';
+    _put2(time + DATE + 1, usec / 10000);
+    _put2(time + DATE + 3, usec / 100 % 100);
+    _put2(time + DATE + 5, usec % 100);
+
+    if (fmt_ == line_format::eJSON) {
+      out_.append("{\"time\":\"").append(time, sizeof(time));
+      out_.append("\",\"level\":\"").append(lvl.data(), lvl.size());
+      out_.append("\",\"site\":");
+      structured::json_string(out_, ctx);
+      out_.append(",\"msg\":");
+      structured::json_string(out_, msg_);
+      out_.append(fields_.data(), fields_.size());
+      out_.push_back('}');
+      return;
+    }
+    out_.append("time=").append(time, sizeof(time));
+    out_.append(" level=").append(lvl.data(), lvl.size());
+    out_.append(" site=");
+    structured::logfmt_string(out_, ctx);
+    out_.append(" msg=");
+    structured::json_string(out_, msg_);
+    out_.append(fields_.data(), fields_.size());
+  }
+
+  static inline std::string
+  format(LogLevel lvl_, const char* ctx_, const std::string_view& msg_) {
+    return format(lvl_, ctx_, msg_, log_clock::now());
+  }
+
+  /**
+   * Format a log line whose message was issued at ns_.
+   */
+  static inline std::string
+  format(LogLevel lvl_, const char* ctx_, const std::string_view& msg_, std::int64_t ns_) {
+    std::string out;
+    format_to(out, lvl_, ctx_, msg_, ns_);
+    return out;
+  }
+
+  static inline std::string
+  format(LogLevel lvl_, const log_site& site_, const std::string_view& msg_, std::int64_t ns_) {
+    std::string out;
+    format_to(out, lvl_, site_, msg_, ns_);
+    return out;
+  }
+
+private:
+  log_formater() = default;
+  ~log_formater() = default;
+
+  log_formater(log_formater&&) = delete;
+  log_formater(const log_formater&) = delete;
+  log_formater& operator=(log_formater&&) = delete;
+  log_formater& operator=(const log_formater&) = delete;
+
+  static constexpr std::size_t DATE = 19;     ///< "dd-mm-YYYY HH:MM:SS"
+  static constexpr std::size_t PREFIX = DATE + 7 + 3 + 7 + 3;   ///< Up to the context
+
+  static void _put2(char* p_, int v_) noexcept {
+    p_[0] = static_cast<char>('0' + v_ / 10);
+    p_[1] = static_cast<char>('0' + v_ % 10);
+  }
+
+  struct date_cache {
+    std::int64_t  _sec{INT64_MIN};
+    char          _date[DATE];    ///< "dd-mm-YYYY HH:MM:SS"
+    char          _iso[DATE];     ///< "YYYY-mm-ddTHH:MM:SS"
+  };
+
+  /**
+   * The cached date-time of ns_, re-rendered when the second changes.
+   */
+  static const date_cache& _date(std::int64_t ns_, int& usec_) {
+    thread_local date_cache c;
+
+    std::int64_t sec = ns_ / 1000000000;
+    std::int64_t sub = ns_ % 1000000000;
+    if (sub < 0) {
+      sub += 1000000000;
+      --sec;
+    }
+    usec_ = static_cast<int>(sub / 1000);
+    if (sec != c._sec) {
+      const std::time_t t = static_cast<std::time_t>(sec);
+      std::tm tm;
+      localtime_r(&t, &tm);
+      char* d = c._date;
+      _put2(d, tm.tm_mday); d[2] = '-';
+      _put2(d + 3, tm.tm_mon + 1); d[5] = '-';
+      _put2(d + 6, (tm.tm_year + 1900) / 100); _put2(d + 8, (tm.tm_year + 1900) % 100);
+      d[10] = ' ';
+      _put2(d + 11, tm.tm_hour); d[13] = ':';
+      _put2(d + 14, tm.tm_min); d[16] = ':';
+      _put2(d + 17, tm.tm_sec);
+      char* i = c._iso;
+      memcpy(i, d + 6, 4); i[4] = '-';
+      memcpy(i + 5, d + 3, 2); i[7] = '-';
+      memcpy(i + 8, d, 2);
+      i[10] = 'T';
+      memcpy(i + 11, d + 11, 8);
+      c._sec = sec;
+    }
+    return c;
+  }
+
+  /**
+   * Grow out_ for the whole line, write everything before the context (padded to
+   * CTX_WIDTH), return where the context goes.
+   */
+  static char* _prefix(std::string& out_, LogLevel lvl_, std::size_t ctx_,
+                       std::int64_t ns_, std::size_t msg_) {
+    int usec;
+    const date_cache& c = _date(ns_, usec);
+
+    const std::size_t pad = ctx_ < CTX_WIDTH ? CTX_WIDTH - ctx_ : 0;
+    const std::size_t at = out_.size();
+    out_.resize(at + PREFIX + pad + ctx_ + 3 + msg_);
+    char* p = &out_[at];
+
+    memcpy(p, c._date, DATE);
+    p += DATE;
+    *p++ = '.';
+    _put2(p, usec / 10000);
+    _put2(p + 2, usec / 100 % 100);
+    _put2(p + 4, usec % 100);
+    p += 6;
+    memcpy(p, " | ", 3);
+    memcpy(p + 3, level_name(lvl_).data(), 7);
+    memcpy(p + 10, " | ", 3);
+    p += 13;
+    memset(p, ' ', pad);
+    return p + pad;
+  }
+
+  static void _suffix(char* p_, const std::string_view& msg_) noexcept {
+    memcpy(p_, " | ", 3);
+    memcpy(p_ + 3, msg_.data(), msg_.size());
+  }
+};
+
+/**
+ * A log message as it travels from a call site to the async backend thread.
+ */
+struct log_record {
+  enum class kind : std::uint8_t {
+    eMESSAGE,
+    eFLUSH      ///< Barrier, see logger::flush()
+  };
+
+  kind          _kind{kind::eMESSAGE};
+  LogLevel      _lvl{LogLevel::eINFO};
+  std::uint32_t _len{0};
+  std::uint32_t _split{0};   ///< Length of the message, the encoded fields follow
+  line_format   _fmt{line_format::eTEXT};   ///< Read at the call site, see log_kv()
+  std::int64_t  _ns{0};      ///< See log_clock
+  void*         _token{nullptr};
+  const log_site* _site{nullptr};   ///< Static call site, _ctx is unused then
+  char          _ctx[MAX_CTX_LENGTH]{};
+  char          _msg[MAX_MSG_LENGTH]{};
+  std::string   _ext;   ///< Messages longer than MAX_MSG_LENGTH, the slot keeps its capacity
+
+  std::string_view msg() const noexcept {
+    return _len < MAX_MSG_LENGTH ? std::string_view(_msg, _len) : std::string_view(_ext);
+  }
+
+  std::string_view text() const noexcept {
+    return msg().substr(0, _split);
+  }
+
+  std::string_view fields() const noexcept {
+    return msg().substr(_split);
+  }
+
+  /**
+   * Called on a claimed queue slot, so it must not throw: a long message that
+   * cannot be spilled to _ext is cut to fit _msg.
+   *
+   * @param[in] split_ Length of the message part of msg_, the rest are fields.
+   */
+  void set_msg(const std::string_view& msg_, std::size_t split_ = std::string_view::npos) noexcept {
+    std::size_t len = msg_.size();
+    if (len >= MAX_MSG_LENGTH) {
+      try {
+        _ext.assign(msg_.data(), len);
+      } catch (...) {
+        len = MAX_MSG_LENGTH - 1;
+      }
+    }
+    _split = static_cast<std::uint32_t>(std::min(split_, len));
+    _len = static_cast<std::uint32_t>(len);
+    if (_len < MAX_MSG_LENGTH) memcpy(_msg, msg_.data(), _len);
+  }
+};
+
+/**
+ * Crash flight recorder: the recent messages of every thread, kept in memory and
+ * written to a file when the process crashes.
+ *
+ * record() pushes a message into the calling thread's buffer::flight_recorder, a
+ * wait-free single-writer ring: no lock, no allocation, no syscall. dump() walks
+ * the rings and writes them, one section per thread, with async-signal-safe code
+ * only (open/write/close, hand-made number and UTC time formatting), so it runs
+ * from the SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL handlers installed by
+ * install_handlers(). The handler then restores the previous action and raises
+ * the signal again.
+ *
+ * Messages longer than MSG_LENGTH bytes are cut. Rings of exited threads are kept,
+ * and handed to new threads, up to MAX_THREADS rings.
+ */
+class crash_recorder
+{
+public:
+  static constexpr std::size_t MAX_THREADS = 256;
+  static constexpr std::size_t CTX_LENGTH = 32;
+  static constexpr std::size_t MSG_LENGTH = 192;
+  static constexpr std::chrono::microseconds DUMP_WAIT{std::chrono::seconds(2)};
+
+  /**
+   * @param[in] dump_file_ Appended to by every dump
+   * @param[in] events_ Messages kept per thread
+   */
+  crash_recorder(const filesystem::path& dump_file_, std::size_t events_):
+    _id{_next_id().fetch_add(1, std::memory_order_relaxed)}, _events{events_} {
+    const std::size_t n = std::min(strlen(dump_file_.raw()), sizeof(_path) - 1);
+    memcpy(_path, dump_file_.raw(), n);
+    _path[n] = '\0';
+  }
+
+  ~crash_recorder() {
+    crash_recorder* self = this;
+    _active().compare_exchange_strong(self, nullptr);
+  }
+
+  crash_recorder(crash_recorder&&) = delete;
+  crash_recorder(const crash_recorder&) = delete;
+  crash_recorder& operator=(crash_recorder&&) = delete;
+  crash_recorder& operator=(const crash_recorder&) = delete;
+
+  /**
+   * Keep a message in the calling thread's ring.
+   *
+   * @param[in] site_ Static call site, or nullptr for the context ctx_
+   */
+  void record(LogLevel lvl_, const log_site* site_, const char* ctx_,
+              const std::string_view& msg_, std::int64_t ns_) noexcept {
+    ring* r = _local();
+    if (!r) return;
+    event e;
+    e._ns = ns_;
+    e._site = site_;
+    e._lvl = lvl_;
+    e._len = static_cast<std::uint16_t>(std::min(msg_.size(), MSG_LENGTH));
+    memcpy(e._msg, msg_.data(), e._len);
+    const std::size_t nctx = (!site_ && ctx_) ? strnlen(ctx_, CTX_LENGTH - 1) : 0;
+    if (nctx) memcpy(e._ctx, ctx_, nctx);
+    e._ctx[nctx] = '\0';
+    r->_events.push(e);
+  }
+
+  /**
+   * Write every ring to the dump file. Async-signal-safe. Concurrent dumps run
+   * one after the other: a thread waits up to DUMP_WAIT for the running dump, so
+   * its crash does not end the process halfway through it, then appends its own.
+   * A dump interrupted by a crash on its own thread is abandoned.
+   */
+  void dump(const char* reason_) noexcept {
+    const long tid = static_cast<long>(::syscall(SYS_gettid));
+    long idle = 0;
+    for (std::chrono::microseconds waited{0};;) {
+      if (_dumping.compare_exchange_strong(idle, tid, std::memory_order_acq_rel)) break;
+      if (idle == tid || waited >= DUMP_WAIT) return;
+      idle = 0;
+      const struct timespec ts{0, 1000000};
+      ::nanosleep(&ts, nullptr);
+      waited += std::chrono::milliseconds(1);
+    }
+    const int fd = ::open(_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd >= 0) {
+      line l;
+      const std::size_t n = _nrings.load(std::memory_order_acquire);
+      l.put("==== flight recorder: ").put(reason_).put(", ");
+      l.put_u(n).put(" thread(s) ====\n");
+      l.write(fd);
+      for (std::size_t i = 0; i < n; ++i) {
+        const ring* r = _rings[i].load(std::memory_order_acquire);
+        l.put("---- thread ").put_u(r->_tid.load(std::memory_order_relaxed));
+        l.put(r->_in_use.load(std::memory_order_relaxed) ? "" : " (exited)").put(" ----\n");
+        l.write(fd);
+        r->_events.visit([&l, fd](std::uint64_t, const event& e_) {
+          _format(l, e_);
+          l.write(fd);
+        });
+      }
+      ::close(fd);
+    }
+    _dumping.store(0, std::memory_order_release);
+  }
+
+  /**
+   * Dump from the crash signal handlers from now on.
+   */
+  void install_handlers() {
+    _active().store(this, std::memory_order_release);
+    for (std::size_t i = 0; i < NSIGNALS; ++i) {
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = &crash_recorder::_on_signal;
+      sigemptyset(&sa.sa_mask);
+      sa.sa_flags = SA_RESETHAND;
+      sigaction(SIGNALS[i], &sa, &_previous()[i]);
+    }
+  }
+
+private:
+  struct event {
+    std::int64_t      _ns;
+    const log_site*   _site;
+    LogLevel          _lvl;
+    std::uint16_t     _len;
+    char              _ctx[CTX_LENGTH];
+    char              _msg[MSG_LENGTH];
+  };
+
+  struct ring {
+    explicit ring(std::size_t events_): _events{events_} { }
+
+    buffer::flight_recorder<event>  _events;
+    std::atomic<long>               _tid{0};
+    std::atomic<bool>               _in_use{true};
+  };
+
+  /**
+   * Hands the ring back on thread exit. Shares its ownership: the thread may
+   * outlive the recorder.
+   */
+  struct thread_handle {
+    std::uint64_t           _owner{0};
+    std::shared_ptr<ring>   _ring;
+    ~thread_handle() {
+      if (_ring) _ring->_in_use.store(false, std::memory_order_release);
+    }
+  };
+
+  /**
+   * Fixed buffer of a dump line, written with one write().
+   */
+  struct line {
+    char        _buf[512];
+    std::size_t _len{0};
+
+    line& put(const char* s_) noexcept {
+      return put(s_, strlen(s_));
+    }
+
+    line& put(const char* s_, std::size_t n_) noexcept {
+      n_ = std::min(n_, sizeof(_buf) - _len);
+      memcpy(_buf + _len, s_, n_);
+      _len += n_;
+      return *this;
+    }
+
+    line& put_u(std::uint64_t v_, int width_ = 0) noexcept {
+      char d[20];
+      int n = 0;
+      do {
+        d[n++] = static_cast<char>('0' + v_ % 10);
+        v_ /= 10;
+      } while (v_);
+      while (n < width_) d[n++] = '0';
+      while (n) put(&d[--n], 1);
+      return *this;
+    }
+
+    void write(int fd_) noexcept {
+      std::size_t off = 0;
+      while (off < _len) {
+        const ssize_t w = ::write(fd_, _buf + off, _len - off);
+        if (w < 0 && errno == EINTR) continue;
+        if (w <= 0) break;
+        off += static_cast<std::size_t>(w);
+      }
+      _len = 0;
+    }
+  };
+
+  static constexpr std::size_t NSIGNALS = 5;
+  static constexpr int SIGNALS[NSIGNALS] = {SIGSEGV, SIGABRT, SIGBUS, SIGFPE, SIGILL};
+
+  const std::uint64_t         _id;    ///< Tells the thread handles which recorder
+  std::size_t                 _events;
+  char                        _path[256];
+  std::vector<std::shared_ptr<ring>>  _owned;
+  std::atomic<ring*>          _rings[MAX_THREADS]{};
+  std::atomic<std::size_t>    _nrings{0};
+  std::atomic<long>           _dumping{0};   ///< Thread id of the running dump
+  std::mutex                  _mtx;   ///< Ring allocation
+
+  static std::atomic<crash_recorder*>& _active() noexcept {
+    static std::atomic<crash_recorder*> r{nullptr};
+    return r;
+  }
+
+  static std::atomic<std::uint64_t>& _next_id() noexcept {
+    static std::atomic<std::uint64_t> id{1};
+    return id;
+  }
+
+  static struct sigaction* _previous() noexcept {
+    static struct sigaction p[NSIGNALS];
+    return p;
+  }
+
+  static void _on_signal(int sig_) {
+    const char* name = "signal";
+    for (std::size_t i = 0; i < NSIGNALS; ++i) {
+      if (SIGNALS[i] != sig_) continue;
+      const char* names[NSIGNALS] = {"SIGSEGV", "SIGABRT", "SIGBUS", "SIGFPE", "SIGILL"};
+      name = names[i];
+      sigaction(sig_, &_previous()[i], nullptr);
+    }
+    crash_recorder* r = _active().load(std::memory_order_acquire);
+    if (r) r->dump(name);
+    raise(sig_);
+  }
+
+  /**
+   * The calling thread's ring: its own, a ring left by an exited thread, or a new
+   * one. nullptr once MAX_THREADS rings are in use.
+   */
+  ring* _local() noexcept {
+    thread_local thread_handle h;
+    if (h._owner == _id) return h._ring.get();
+    if (h._ring) h._ring->_in_use.store(false, std::memory_order_release);
+    h._owner = _id;
+    h._ring.reset();
+
+    std::lock_guard<std::mutex> lk(_mtx);
+    for (const auto& r : _owned) {
+      bool free = false;
+      if (r->_in_use.compare_exchange_strong(free, true, std::memory_order_acq_rel)) {
+        h._ring = r;
+        break;
+      }
+    }
+    if (!h._ring && _owned.size() < MAX_THREADS) {
+      try {
+        _owned.push_back(std::make_shared<ring>(_events));
+      } catch (...) {
+        return nullptr;
+      }
+      h._ring = _owned.back();
+      _rings[_owned.size() - 1].store(h._ring.get(), std::memory_order_release);
+      _nrings.store(_owned.size(), std::memory_order_release);
+    }
+    if (h._ring) h._ring->_tid.store(static_cast<long>(::syscall(SYS_gettid)), std::memory_order_relaxed);
+    return h._ring.get();
+  }
+
+  /**
+   * "YYYY-mm-dd HH:MM:SS.uuuuuu UTC | LEVEL | file:line | message", without
+   * localtime_r (not async-signal-safe).
+   */
+  static void _format(line& l_, const event& e_) noexcept {
+    std::int64_t sec = e_._ns / 1000000000;
+    std::int64_t sub = e_._ns % 1000000000;
+    if (sub < 0) {
+      sub += 1000000000;
+      --sec;
+    }
+    std::int64_t days = sec / 86400;
+    std::int64_t tod = sec % 86400;
+    if (tod < 0) {
+      tod += 86400;
+      --days;
+    }
+    // Civil date from days since 1970-01-01 (H. Hinnant's algorithm).
+    const std::int64_t z = days + 719468;
+    const std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+    const std::int64_t doe = z - era * 146097;
+    const std::int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    const std::int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    const std::int64_t mp = (5 * doy + 2) / 153;
+    const std::int64_t d = doy - (153 * mp + 2) / 5 + 1;
+    const std::int64_t m = mp < 10 ? mp + 3 : mp - 9;
+    const std::int64_t y = yoe + era * 400 + (m <= 2);
+
+    l_.put_u(static_cast<std::uint64_t>(y), 4).put("-").put_u(m, 2).put("-").put_u(d, 2);
+    l_.put(" ").put_u(tod / 3600, 2).put(":").put_u(tod / 60 % 60, 2).put(":").put_u(tod % 60, 2);
+    l_.put(".").put_u(static_cast<std::uint64_t>(sub / 1000), 6).put(" UTC | ");
+    l_.put(level_name(e_._lvl).data(), 7).put(" | ");
+    if (e_._site) {
+      l_.put(e_._site->_file).put(":").put_u(static_cast<std::uint64_t>(e_._site->_line));
+    } else {
+      l_.put(e_._ctx);
+    }
+    l_.put(" | ").put(e_._msg, e_._len);
+    if (l_._len == sizeof(l_._buf)) --l_._len;
+    l_.put("\n");
+  }
+};
+
+/**
+ * What a producer does when a bounded log queue is full.
+ */
+enum class overflow {
+  eBLOCK,             ///< Wait for room, up to a maximum wait, then drop the message
+  eDROP_NEWEST,       ///< Drop the message being logged
+  eOVERWRITE_OLDEST   ///< Drop the oldest queued message to make room
+};
+
+/**
+ * Maximum wait of overflow::eBLOCK: by default a burst against a slow stream costs
+ * a producer 1ms at most. WAIT_FOREVER has it wait as long as the stream takes.
+ */
+inline constexpr std::chrono::microseconds DEFAULT_MAX_WAIT{1000};
+inline constexpr std::chrono::microseconds WAIT_FOREVER = std::chrono::microseconds::max();
+
+/**
+ * Messages dropped on a full queue, per level. Counted by any thread, reported by
+ * the one thread draining the queue.
+ */
+class drop_counters
+{
+public:
+  void add(LogLevel lvl_) noexcept {
+    _count[_index(lvl_)].fetch_add(1, std::memory_order_relaxed);
+  }
+
+  std::uint64_t count(LogLevel lvl_) const noexcept {
+    return _count[_index(lvl_)].load(std::memory_order_relaxed);
+  }
+
+  std::uint64_t total() const noexcept {
+    std::uint64_t n = 0;
+    for (const auto& c : _count) n += c.load(std::memory_order_relaxed);
+    return n;
+  }
+
+  /**
+   * Render "Dropped N log lines on a full queue: DEBUG n, INFO n" for the drops
+   * since the previous report into out_. Draining thread only.
+   *
+   * @return false if nothing was dropped since.
+   */
+  bool report(std::string& out_) {
+    std::uint64_t delta[NLEVELS];
+    std::uint64_t sum = 0;
+    for (std::size_t i = 0; i < NLEVELS; ++i) {
+      const std::uint64_t c = _count[i].load(std::memory_order_relaxed);
+      delta[i] = c - _reported[i];
+      _reported[i] = c;
+      sum += delta[i];
+    }
+    if (!sum) return false;
+    out_.assign("Dropped ").append(std::to_string(sum)).append(" log lines on a full queue:");
+    const char* sep = " ";
+    for (std::size_t i = 0; i < NLEVELS; ++i) {
+      if (!delta[i]) continue;
+      std::string_view name = level_name(LEVELS[i]);
+      name.remove_prefix(name.find_first_not_of(' '));
+      out_.append(sep).append(name).append(" ").append(std::to_string(delta[i]));
+      sep = ", ";
+    }
+    return true;
+  }
+
+private:
+  static constexpr std::size_t NLEVELS = 6;
+  static constexpr LogLevel LEVELS[NLEVELS] = {
+    LogLevel::eTRACE, LogLevel::eDEBUG, LogLevel::eINFO,
+    LogLevel::eWARNING, LogLevel::eERROR, LogLevel::eFATAL
+  };
+
+  std::atomic<std::uint64_t>  _count[NLEVELS]{};
+  std::uint64_t               _reported[NLEVELS]{};
+
+  static std::size_t _index(LogLevel lvl_) noexcept {
+    for (std::size_t i = 0; i < NLEVELS; ++i) {
+      if (LEVELS[i] == lvl_) return i;
+    }
+    return NLEVELS - 1;
+  }
+};
+
+/**
+ * Log levels as read from a configuration file, see logger::load_levels():
+ *
+ *   # The default level
+ *   level = INFO
+ *   # LOG_MODULE "net"
+ *   module.net = DEBUG
+ *   # Call sites of server.cc, takes precedence over the module
+ *   file.server.cc = TRACE
+ */
+struct level_config {
+  struct rule {
+    std::string _name;
+    LogLevel    _lvl;
+  };
+
+  bool              _has_default{false};
+  LogLevel          _default{LogLevel::eINFO};
+  std::vector<rule> _modules;
+  std::vector<rule> _files;
+
+  /**
+   * @throw std::invalid_argument on a malformed line, std::runtime_error if the
+   *        file cannot be read.
+   */
+  static level_config parse(const filesystem::path& file_) {
+    std::ifstream in(file_.raw());
+    if (!in.is_open()) {
+      throw std::runtime_error(std::string("Cannot read log levels from ") + file_.raw());
+    }
+    level_config cfg;
+    std::string text;
+    for (int n = 1; std::getline(in, text); ++n) {
+      std::string_view l(text);
+      auto trim = [](std::string_view v_) {
+        const std::size_t b = v_.find_first_not_of(" \t\r");
+        if (b == std::string_view::npos) return std::string_view();
+        return v_.substr(b, v_.find_last_not_of(" \t\r") - b + 1);
+      };
+      l = trim(l.substr(0, l.find('#')));
+      if (l.empty()) continue;
+      const std::size_t eq = l.find('=');
+      LogLevel lvl;
+      const std::string_view key = trim(l.substr(0, eq));
+      if (eq == std::string_view::npos || !parse_level(trim(l.substr(eq + 1)), lvl)) {
+        throw std::invalid_argument(std::string(file_.raw()) + ":" + std::to_string(n) +
+                                    ": expected <key> = <TRACE|DEBUG|INFO|WARNING|ERROR|FATAL>");
+      }
+      if (key == "level") {
+        cfg._has_default = true;
+        cfg._default = lvl;
+      } else if (key.substr(0, 7) == "module." && key.size() > 7) {
+        cfg._modules.push_back({std::string(key.substr(7)), lvl});
+      } else if (key.substr(0, 5) == "file." && key.size() > 5) {
+        cfg._files.push_back({std::string(key.substr(5)), lvl});
+      } else {
+        throw std::invalid_argument(std::string(file_.raw()) + ":" + std::to_string(n) +
+                                    ": unknown key " + std::string(key));
+      }
+    }
+    return cfg;
+  }
+};
+
+/**
+ * Calls reload_ on a thread of its own when the watched file is written or replaced
+ * (inotify on its directory, editors rename over the file) and/or on SIGHUP. The
+ * SIGHUP handler only writes a byte to a pipe the thread polls.
+ */
+class config_watcher
+{
+public:
+  /**
+   * @param[in] file_ Watched file
+   * @param[in] sighup_ Install a SIGHUP handler
+   * @param[in] inotify_ Watch file_ for changes
+   */
+  config_watcher(const filesystem::path& file_, bool sighup_, bool inotify_,
+                 std::function<void()> reload_): _reload{std::move(reload_)} {
+    if (::pipe2(_pipe, O_CLOEXEC | O_NONBLOCK) != 0) {
+      throw std::system_error(errno, std::generic_category(), "pipe2");
+    }
+    const std::string path(file_.raw());
+    const std::size_t slash = path.rfind('/');
+    const std::string dir = (slash == std::string::npos) ? "." : path.substr(0, slash + 1);
+    _name = (slash == std::string::npos) ? path : path.substr(slash + 1);
+    if (inotify_) {
+      _inotify = ::inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+      if (_inotify < 0 ||
+          ::inotify_add_watch(_inotify, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE) < 0) {
+        const int err = errno;
+        _close();
+        throw std::system_error(err, std::generic_category(), "inotify on " + dir);
+      }
+    }
+    _thread = std::thread(&config_watcher::_run, this);
+    if (sighup_) {
+      _sighup_fd().store(_pipe[1], std::memory_order_release);
+      struct sigaction sa;
+      memset(&sa, 0, sizeof(sa));
+      sa.sa_handler = &config_watcher::_on_sighup;
+      sigemptyset(&sa.sa_mask);
+      sa.sa_flags = SA_RESTART;
+      struct sigaction old;
+      sigaction(SIGHUP, &sa, &old);
+      // Replacing a watcher: keep the action from before the first one.
+      if (old.sa_handler != &config_watcher::_on_sighup) _previous() = old;
+    }
+  }
+
+  /**
+   * SIGHUP gets back the action it had before, if it was handled.
+   */
+  ~config_watcher() {
+    int fd = _pipe[1];
+    if (_sighup_fd().compare_exchange_strong(fd, -1)) {
+      sigaction(SIGHUP, &_previous(), nullptr);
+    }
+    const char stop = 's';
+    (void)!::write(_pipe[1], &stop, 1);
+    _thread.join();
+    _close();
+  }
+
+  config_watcher(config_watcher&&) = delete;
+  config_watcher(const config_watcher&) = delete;
+  config_watcher& operator=(config_watcher&&) = delete;
+  config_watcher& operator=(const config_watcher&) = delete;
+
+private:
+  int                     _pipe[2]{-1, -1};
+  int                     _inotify{-1};
+  std::string             _name;      ///< Watched file name in its directory
+  std::function<void()>   _reload;
+  std::thread             _thread;
+
+  static std::atomic<int>& _sighup_fd() noexcept {
+    static std::atomic<int> fd{-1};
+    return fd;
+  }
+
+  /**
+   * SIGHUP action in place before the first watcher installed its handler.
+   */
+  static struct sigaction& _previous() noexcept {
+    static struct sigaction p;
+    return p;
+  }
+
+  static void _on_sighup(int) {
+    const int err = errno;
+    const int fd = _sighup_fd().load(std::memory_order_acquire);
+    const char hup = 'h';
+    if (fd >= 0) (void)!::write(fd, &hup, 1);
+    errno = err;
+  }
+
+  void _close() {
+    if (_inotify >= 0) ::close(_inotify);
+    ::close(_pipe[0]);
+    ::close(_pipe[1]);
+  }
+
+  void _run() {
+    struct pollfd fds[2] = {{_pipe[0], POLLIN, 0}, {_inotify, POLLIN, 0}};
+    alignas(struct inotify_event) char buf[4096];
+    for (;;) {
+      if (::poll(fds, _inotify >= 0 ? 2 : 1, -1) < 0) {
+        if (errno == EINTR) continue;
+        return;
+      }
+      bool reload = false;
+      ssize_t n;
+      while ((n = ::read(_pipe[0], buf, sizeof(buf))) > 0) {
+        if (memchr(buf, 's', n)) return;
+        reload = true;
+      }
+      while (_inotify >= 0 && (n = ::read(_inotify, buf, sizeof(buf))) > 0) {
+        for (char* p = buf; p < buf + n; ) {
+          const auto* ev = reinterpret_cast<const struct inotify_event*>(p);
+          if (ev->len && _name == ev->name) reload = true;
+          p += sizeof(struct inotify_event) + ev->len;
+        }
+      }
+      if (reload) _reload();
+    }
+  }
+};
+
+class logger {
+public:
+  using log_stream_p = std::unique_ptr<log_stream>;
+
+  logger() = default;
+
+  /**
+   * Stop the async backend and the stream writers, if any, after they wrote every
+   * pending message.
+   */
+  ~logger() {
+    _watcher.reset();
+    disable_async();
+    _stop_writers();
+  }
+
+  logger(logger&&) = delete;
+  logger(const logger&) = delete;
+  logger& operator=(logger&&) = delete;
+  logger& operator=(const logger&) = delete;
+
+  /**
+   * Set minimum log level.
+   *
+   * @param[in] min_lvl_ Specify the minimum log level.
+   */
+  void set_log_level(LogLevel min_lvl_) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _min_lvl.store(min_lvl_, std::memory_order_relaxed);
+    _levels_changed();
+  }
+
+  /**
+   * Level of the call sites of a module, see LOG_MODULE, instead of the log level.
+   * File levels take precedence.
+   */
+  void set_module_level(const std::string& module_, LogLevel lvl_) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _set_rule(_levels._modules, module_, lvl_);
+    _levels_changed();
+  }
+
+  /**
+   * Level of the call sites of a source file, by base name (i.e. "server.cc").
+   */
+  void set_file_level(const std::string& file_, LogLevel lvl_) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _set_rule(_levels._files, file_, lvl_);
+    _levels_changed();
+  }
+
+  /**
+   * Drop the module and file levels.
+   */
+  void clear_level_overrides() {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _levels._modules.clear();
+    _levels._files.clear();
+    _levels_changed();
+  }
+
+  /**
+   * Replace the log level (if set) and all module and file levels with those of a
+   * file, see level_config for the format. Nothing changes if the file is malformed.
+   *
+   * @throw std::invalid_argument, std::runtime_error, see level_config::parse().
+   */
+  void load_levels(const filesystem::path& file_) {
+    level_config cfg = level_config::parse(file_);
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (cfg._has_default) _min_lvl.store(cfg._default, std::memory_order_relaxed);
+    _levels = std::move(cfg);
+    _levels_changed();
+  }
+
+  /**
+   * load_levels() now, then again on SIGHUP and/or whenever the file is written or
+   * replaced, from a watcher thread. A reload failing is logged as a WARNING, the
+   * levels stay as they were.
+   *
+   * @param[in] sighup_ Reload on SIGHUP, the handler is installed
+   * @param[in] inotify_ Reload when the file changes
+   */
+  void watch_levels(const filesystem::path& file_, bool sighup_ = true, bool inotify_ = true) {
+    load_levels(file_);
+    const std::string path(file_.raw());
+    auto w = std::make_unique<config_watcher>(file_, sighup_, inotify_, [this, path]() {
+      try {
+        load_levels(filesystem::path(path.c_str()));
+        print_log(LogLevel::eINFO, "logger", "Log levels reloaded from %s", path.c_str());
+      } catch (const std::exception& e) {
+        print_log(LogLevel::eWARNING, "logger", "Log levels not reloaded: %s", e.what());
+      }
+    });
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _watcher.swap(w);
+    }
+    // The previous watcher, if any, is stopped outside the lock: it may be reloading.
+    w.reset();
+  }
+
+  /**
+   * Layout of the log lines: text (default), JSON lines or logfmt.
+   */
+  void set_line_format(line_format fmt_) {
+    _line_fmt.store(fmt_, std::memory_order_relaxed);
+  }
+
+  /**
+   * Check the level before building a message. Lock-free, one relaxed load.
+   */
+  bool is_enabled(LogLevel lvl_) const noexcept {
+    return !(lvl_ < _gate_lvl.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * is_enabled() for a call site, with its module and file levels. Lock-free, two
+   * relaxed loads: the site's cached levels and the level generation. A stale site
+   * resolves its levels again, once per generation.
+   */
+  bool is_enabled(const log_site& site_) const noexcept {
+    if (!site_._cache) return is_enabled(site_._lvl);
+    std::uint64_t v = site_._cache->_v.load(std::memory_order_relaxed);
+    if ((v >> 16) != _gen.load(std::memory_order_relaxed)) v = _resolve(site_);
+    return !(site_._lvl < static_cast<LogLevel>(v & 0xff));
+  }
+
+  /**
+   * Keep the last events_ messages of each thread from record_lvl_ up in memory,
+   * see crash_recorder, and write them to dump_file_ on a crash signal (if
+   * install_ is set) or a FATAL message. Messages below the log level are only
+   * recorded, at the cost of a copy into the thread's ring.
+   *
+   * @param[in] dump_file_ Appended to by every dump
+   * @param[in] record_lvl_ Minimum level recorded, may be below the log level
+   * @param[in] events_ Messages kept per thread
+   * @param[in] install_ Install the SIGSEGV, SIGABRT, SIGBUS, SIGFPE and SIGILL
+   *                     handlers
+   */
+  void enable_flight_recorder(const filesystem::path& dump_file_,
+                              LogLevel record_lvl_ = LogLevel::eTRACE,
+                              std::size_t events_ = 1024, bool install_ = true) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (_recorder) {
+      throw std::logic_error("Flight recorder already enabled");
+    }
+    _recorder = std::make_unique<crash_recorder>(dump_file_, events_);
+    if (install_) _recorder->install_handlers();
+    _rec_lvl.store(record_lvl_, std::memory_order_relaxed);
+    _rec.store(_recorder.get(), std::memory_order_release);
+    _levels_changed();
+  }
+
+  /**
+   * Write the flight recorder out now, if enabled. Async-signal-safe, i.e. for the
+   * application's own signal handlers.
+   */
+  void dump_flight_recorder(const char* reason_) noexcept {
+    crash_recorder* rec = _rec.load(std::memory_order_acquire);
+    if (rec) rec->dump(reason_);
+  }
+
+  /**
+   * Set log file path and its backup size and maximum number of backups.
+   *
+   * @param[in] lf_ Log file path
+   * @param[in] fsize_  Log file size to make backup
+   * @param[in] nrt_ Maximum number of rotated files
+   * @param[in] compress_ Compress the rotated files in the background, see
+   *                      compressor()
+   */
+  void set_log_file(const filesystem::path& lf_,
+                    std::uint32_t fsize_,
+                    std::uint8_t nrt_,
+                    bool compress_ = false) {
+    if ((std::int32_t)fsize_ < 0) {
+      throw std::invalid_argument("Log file size cannot be negative");
+    }
+    if ((std::int8_t)nrt_ < 0) {
+      throw std::invalid_argument("Number of rotated log files cannot be negative");
+    }
+    add_stream(std::make_unique<file_stream>(lf_, fsize_, nrt_,
+                                             compress_ ? compressor() : nullptr));
+  }
+
+  /**
+   * Set log trace file.
+   *
+   * @param[in] tf_ Specify the trace file
+   * @param[in] fsize_  Trace file size to make backup
+   * @param[in] nrt_ Maximum number of rotated files
+   * @param[in] compress_ Compress the rotated files in the background
+   */
+  void set_log_trace(const filesystem::path& tf_,
+                     std::uint32_t fsize_,
+                     std::uint8_t nrt_,
+                     bool compress_ = false) {
+    if ((std::int32_t)fsize_ < 0) {
+      throw std::invalid_argument("Trace file size cannot be negative");
+    }
+    if ((std::int8_t)nrt_ < 0) {
+      throw std::invalid_argument("Number of rotated trace files cannot be negative");
+    }
+    add_stream(std::make_unique<file_stream>(tf_, fsize_, nrt_,
+                                             compress_ ? compressor() : nullptr));
+  }
+
+  /**
+   * The logger's background compressor, started on first use. Shared by the file
+   * streams of set_log_file(..., true), and i.e. by mmap_stream instances.
+   */
+  std::shared_ptr<backup_compressor> compressor() {
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (!_compressor) _compressor = std::make_shared<backup_compressor>();
+    return _compressor;
+  }
+
+  /**
+   * Enable log stream to console.
+   *
+   * @param[in] min_lvl_ See add_stream()
+   * @param[in] queue_size_ See add_stream(), i.e. for a console piped to a slow reader.
+   */
+  void enable_console(LogLevel min_lvl_ = LogLevel::eTRACE, std::size_t queue_size_ = 0) {
+    add_stream(std::make_unique<console_stream>(), min_lvl_, queue_size_);
+  }
+
+  /**
+   * Add a user defined log stream. Streams are only ever added, so logging threads
+   * walk them without taking any lock of the logger.
+   *
+   * With a queue_size_, the stream gets a bounded queue of formatted lines and a
+   * writer thread of its own: logging threads (or the async backend) only copy the
+   * line into the queue, so a slow stream never holds up the others. While its
+   * queue is full, the lines for that stream are dropped and counted (see drops()),
+   * unless set_overflow_policy() says otherwise for the stream.
+   *
+   * @param[in] stream_ Log stream, owned by the logger from now on.
+   * @param[in] min_lvl_ Minimum level of the lines written to this stream, on top
+   *                     of the logger level.
+   * @param[in] queue_size_ 0 to write from the logging thread (or the async
+   *                        backend), otherwise the number of lines queued.
+   * @return The stream, i.e. for set_log_level(stream, level).
+   */
+  log_stream& add_stream(log_stream_p&& stream_,
+                         LogLevel min_lvl_ = LogLevel::eTRACE,
+                         std::size_t queue_size_ = 0) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    const std::size_t n = _nsinks.load(std::memory_order_relaxed);
+    if (n == MAX_STREAMS) {
+      throw std::length_error("Too many log streams");
+    }
+    auto s = std::make_unique<sink>();
+    s->_stream = std::move(stream_);
+    s->_min_lvl.store(min_lvl_, std::memory_order_relaxed);
+    if (queue_size_) {
+      s->_queue = std::make_unique<buffer::mpmc_ring<sink_line>>(queue_size_);
+      sink* raw = s.get();
+      s->_writer = std::thread([this, raw]() { _run_writer(*raw); });
+    }
+    _sink_at[n] = s.get();
+    _sinks.emplace_back(std::move(s));
+    _nsinks.store(n + 1, std::memory_order_release);
+    return *_sink_at[n]->_stream;
+  }
+
+  /**
+   * Set the minimum level of the lines written to stream_.
+   */
+  void set_log_level(const log_stream& stream_, LogLevel min_lvl_) {
+    _sink_of(stream_)._min_lvl.store(min_lvl_, std::memory_order_relaxed);
+  }
+
+  /**
+   * What to do while the async queue is full, eBLOCK for DEFAULT_MAX_WAIT by default.
+   * Dropped messages are counted per level (see drops()) and reported by a WARNING
+   * line from the backend, at most once per report interval.
+   *
+   * @param[in] policy_ Overflow policy
+   * @param[in] max_wait_ eBLOCK: drop the message after waiting this long,
+   *                      WAIT_FOREVER to wait as long as it takes.
+   */
+  void set_overflow_policy(overflow policy_, std::chrono::microseconds max_wait_ = DEFAULT_MAX_WAIT) {
+    _overflow.store(policy_, std::memory_order_relaxed);
+    _max_wait_us.store(max_wait_.count(), std::memory_order_relaxed);
+  }
+
+  /**
+   * Overflow policy of the queue of stream_ (see add_stream()), eDROP_NEWEST by
+   * default. Its writer thread reports the drops to the stream itself.
+   */
+  void set_overflow_policy(const log_stream& stream_, overflow policy_,
+                           std::chrono::microseconds max_wait_ = DEFAULT_MAX_WAIT) {
+    sink& s = _sink_of(stream_);
+    s._overflow.store(policy_, std::memory_order_relaxed);
+    s._max_wait_us.store(max_wait_.count(), std::memory_order_relaxed);
+  }
+
+  /**
+   * Shortest interval between two reports of dropped messages, 1s by default.
+   */
+  void set_drop_report_interval(std::chrono::milliseconds interval_) {
+    _report_ms.store(interval_.count(), std::memory_order_relaxed);
+  }
+
+  /**
+   * Messages dropped on the async queue.
+   */
+  const drop_counters& drops() const noexcept {
+    return _drops;
+  }
+
+  /**
+   * Lines dropped on the queue of stream_.
+   */
+  const drop_counters& drops(const log_stream& stream_) const {
+    return _sink_of(stream_)._drops;
+  }
+
+  /**
+   * Switch to asynchronous logging: call sites only format the message into a slot
+   * of a lock-free queue, a dedicated backend thread adds the prefix and writes to
+   * the log streams in batches.
+   *
+   * @param[in] queue_size_ Number of messages the queue can hold. What a call site
+   *                        does while it is full is set_overflow_policy()'s call.
+   */
+  void enable_async(std::size_t queue_size_ = 4096) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (_backend.joinable()) return;
+    if (!_queue) {
+      _queue = std::make_unique<buffer::mpmc_ring<log_record>>(queue_size_);
+    }
+    _stop.store(false, std::memory_order_relaxed);
+    _backend = std::thread([this]() { _run_backend(); });
+    _async.store(true, std::memory_order_release);
+  }
+
+  /**
+   * Switch back to synchronous logging. Pending messages are written first: the
+   * call sites that saw async mode on finish their push while the backend still
+   * runs, the queue is drained once it stopped.
+   */
+  void disable_async() {
+    std::unique_lock<std::mutex> lk(_mtx);
+    if (!_backend.joinable()) return;
+    _async.store(false, std::memory_order_seq_cst);
+    while (_producers.load(std::memory_order_seq_cst)) {
+      std::this_thread::yield();
+    }
+    _stop.store(true, std::memory_order_release);
+    lk.unlock();
+    _backend.join();
+    lk.lock();
+    while (_queue->try_consume([this](log_record& r_) noexcept { _write(r_); })) { }
+    _flush_streams();
+    token_stack::complete(_handoff.take());
+  }
+
+  /**
+   * Barrier: return once every message logged before the call is written and
+   * flushed by all log streams.
+   */
+  void flush() {
+    if (_enter_async()) {
+      flush_token token;
+      _enqueue([&token](log_record& r_) noexcept {
+        r_._kind = log_record::kind::eFLUSH;
+        r_._token = &token;
+      });
+      _leave_async();
+      token.wait();
+    } else {
+      _flush_streams();
+    }
+    _flush_writers();
+  }
+
+  /**
+   * Log a message whose format F::value() is checked against the arguments at
+   * compile time, see format.hh. Used by the logging macros, once is_enabled()
+   * passed.
+   *
+   * @param[in] site_ Static call site.
+   * @param[in] fmt_ The format literal, also carried by F and site_.
+   */
+  template <typename F, typename... A>
+  void log(const log_site& site_, const char* fmt_, const A&... args_) {
+    (void)fmt_;
+    thread_local std::string msg;
+    msg.clear();
+    detail::format_to<F>(msg, args_...);
+
+    const std::int64_t now = log_clock::now();
+    if (!_record(site_._lvl, &site_, nullptr, msg, now)) return;
+    const line_format lf = _line_fmt.load(std::memory_order_relaxed);
+    if (_enter_async()) {
+      _push(site_._lvl, [&](log_record& r_) noexcept {
+        r_._kind = log_record::kind::eMESSAGE;
+        r_._lvl = site_._lvl;
+        r_._fmt = lf;
+        r_._ns = now;
+        r_._site = &site_;
+        r_.set_msg(msg);
+      });
+      _leave_async();
+    } else {
+      thread_local std::string line;
+      line.clear();
+      _format(line, lf, site_._lvl, nullptr, &site_, msg, {}, now);
+      _print_sync(site_._lvl, line);
+    }
+    _on_fatal(site_._lvl);
+  }
+
+  /**
+   * Log a constant message with typed key-value fields, see structured.hh. The
+   * fields are encoded for the line format into a reused per-thread buffer right
+   * after the message text. The line is laid out with that same format, also by
+   * the async backend after a set_line_format(). Used by the *_KV macros, once
+   * is_enabled() passed.
+   *
+   * @param[in] site_ Static call site.
+   * @param[in] msg_ The message literal, also carried by site_.
+   */
+  template <typename... T>
+  void log_kv(const log_site& site_, const char* msg_, const kv_field<T>&... fields_) {
+    thread_local std::string msg;
+    msg.assign(msg_);
+    const std::size_t split = msg.size();
+    const line_format lf = _line_fmt.load(std::memory_order_relaxed);
+    structured::encode(msg, lf, fields_...);
+
+    const std::int64_t now = log_clock::now();
+    if (!_record(site_._lvl, &site_, nullptr, msg, now)) return;
+    if (_enter_async()) {
+      _push(site_._lvl, [&](log_record& r_) noexcept {
+        r_._kind = log_record::kind::eMESSAGE;
+        r_._lvl = site_._lvl;
+        r_._fmt = lf;
+        r_._ns = now;
+        r_._site = &site_;
+        r_.set_msg(msg, split);
+      });
+      _leave_async();
+    } else {
+      thread_local std::string line;
+      line.clear();
+      const std::string_view all(msg);
+      _format(line, lf, site_._lvl, nullptr, &site_, all.substr(0, split), all.substr(split), now);
+      _print_sync(site_._lvl, line);
+    }
+    _on_fatal(site_._lvl);
+  }
+
+  /**
+   * Log a message with a format only known at run time.
+   */
+  void print_log(LogLevel lvl_, const char* ctx_, const char* fmt_, ...) {
+    if (!is_enabled(lvl_)) return;
+
+    thread_local char buffer[MAX_MSG_LENGTH];
+    thread_local std::string longer;
+    va_list arg_list;
+    va_start(arg_list, fmt_);
+    va_list retry;
+    va_copy(retry, arg_list);
+    int n = vsnprintf(buffer, MAX_MSG_LENGTH, fmt_, arg_list);
+    va_end(arg_list);
+    std::string_view msg_(buffer, n < 0 ? 0 : std::min(n, MAX_MSG_LENGTH - 1));
+    if (n >= MAX_MSG_LENGTH) {
+      longer.resize(n + 1);
+      vsnprintf(&longer[0], n + 1, fmt_, retry);
+      msg_ = std::string_view(longer.data(), n);
+    }
+    va_end(retry);
+
+    print_log(lvl_, ctx_, msg_);
+  }
+
+  /**
+   * Print log message to actual available Log Stream(s)
+   *
+   * @param[in] msg_ Log message content
+   */
+  void print_log(LogLevel lvl_, const char* ctx_, const std::string_view& msg_) {
+    print_log(lvl_, ctx_, msg_, log_clock::now());
+  }
+
+  /**
+   * Print a log message issued at ns_ (see log_clock), i.e. by a deferred (binary)
+   * call site.
+   */
+  void print_log(LogLevel lvl_, const char* ctx_, const std::string_view& msg_,
+                 std::int64_t ns_) {
+    if (!is_enabled(lvl_) || !_record(lvl_, nullptr, ctx_, msg_, ns_)) return;
+
+    const line_format lf = _line_fmt.load(std::memory_order_relaxed);
+    if (_enter_async()) {
+      _push(lvl_, [&](log_record& r_) noexcept {
+        r_._kind = log_record::kind::eMESSAGE;
+        r_._lvl = lvl_;
+        r_._fmt = lf;
+        r_._ns = ns_;
+        r_._site = nullptr;
+        _copy_ctx(r_, ctx_);
+        r_.set_msg(msg_);
+      });
+      _leave_async();
+    } else {
+      thread_local std::string line;
+      line.clear();
+      _format(line, lf, lvl_, ctx_, nullptr, msg_, {}, ns_);
+      _print_sync(lvl_, line);
+    }
+    _on_fatal(lvl_);
+  }
+
+private:
+  /**
+   * Levels as of one generation, never changed once published, see _resolve().
+   */
+  struct level_snapshot {
+    std::uint64_t _gen;
+    LogLevel      _min_lvl;
+    bool          _rec;       ///< Flight recorder enabled
+    LogLevel      _rec_lvl;
+    level_config  _levels;
+  };
+
+  struct flush_token {
+    std::mutex              _mtx;
+    std::condition_variable _cv;
+    bool                    _done{false};
+    flush_token*            _next{nullptr};   ///< See token_stack
+
+    void wait() {
+      std::unique_lock<std::mutex> lk(_mtx);
+      _cv.wait(lk, [this]() { return _done; });
+    }
+
+    void done() {
+      std::lock_guard<std::mutex> lk(_mtx);
+      _done = true;
+      _cv.notify_all();
+    }
+  };
+
+  /**
+   * Flush barriers taken out of a full queue by eOVERWRITE_OLDEST. The producer
+   * hands them over to the thread draining the queue, which flushes and completes
+   * them: the records queued before a barrier were written or dropped already.
+   */
+  struct token_stack {
+    std::atomic<flush_token*> _top{nullptr};
+
+    void push(flush_token* t_) noexcept {
+      t_->_next = _top.load(std::memory_order_relaxed);
+      while (!_top.compare_exchange_weak(t_->_next, t_, std::memory_order_release,
+                                         std::memory_order_relaxed)) { }
+    }
+
+    flush_token* take() noexcept {
+      return _top.exchange(nullptr, std::memory_order_acquire);
+    }
+
+    static void complete(flush_token* t_) noexcept {
+      while (t_) {
+        flush_token* next = t_->_next;   // t_ is gone once done
+        t_->done();
+        t_ = next;
+      }
+    }
+  };
+
+  /**
+   * A formatted line queued for a stream writer, or a flush barrier.
+   */
+  struct sink_line {
+    LogLevel      _lvl{LogLevel::eINFO};
+    flush_token*  _token{nullptr};
+    std::string   _line;    ///< The slot keeps its capacity
+  };
+
+  /**
+   * A log stream, its level and, optionally, its queue and writer thread.
+   */
+  struct sink {
+    log_stream_p                                    _stream;
+    std::atomic<LogLevel>                           _min_lvl{LogLevel::eTRACE};
+    std::atomic<overflow>                           _overflow{overflow::eDROP_NEWEST};
+    std::atomic<std::int64_t>                       _max_wait_us{DEFAULT_MAX_WAIT.count()};
+    drop_counters                                   _drops;
+    std::unique_ptr<buffer::mpmc_ring<sink_line>>   _queue;
+    std::thread                                     _writer;
+    std::atomic<bool>                               _stop{false};
+    token_stack                                     _handoff;
+  };
+
+  sink& _sink_of(const log_stream& stream_) const {
+    const std::size_t n = _nsinks.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < n; ++i) {
+      if (_sink_at[i]->_stream.get() == &stream_) return *_sink_at[i];
+    }
+    throw std::invalid_argument("Unknown log stream");
+  }
+
+  /**
+   * Hand a formatted line to every stream whose level it passes. Queued streams
+   * get a copy, see set_overflow_policy() for a full queue.
+   *
+   * @param[in] sync_ Synchronous mode: flush unbuffered streams after the line and
+   *                  let the errors through to the call site.
+   */
+  void _dispatch(LogLevel lvl_, const std::string_view& line_, bool sync_) {
+    const std::size_t n = _nsinks.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < n; ++i) {
+      sink& s = *_sink_at[i];
+      if (lvl_ < s._min_lvl.load(std::memory_order_relaxed)) continue;
+      if (s._queue) {
+        auto fill = [&](sink_line& l_) noexcept {
+          l_._lvl = lvl_;
+          l_._token = nullptr;
+          try {
+            l_._line.assign(line_.data(), line_.size());
+          } catch (...) {
+            // Cut to the capacity of the slot, no allocation
+            l_._line.clear();
+            l_._line.append(line_.data(), std::min(line_.size(), l_._line.capacity()));
+          }
+        };
+        auto discard = [&s](sink_line& l_) noexcept {
+          if (!l_._token) {
+            s._drops.add(l_._lvl);
+            return;
+          }
+          s._handoff.push(l_._token);   // Flushed by the writer, not on this thread
+          l_._token = nullptr;
+        };
+        if (!_push_to(*s._queue, s._overflow.load(std::memory_order_relaxed),
+                      s._max_wait_us.load(std::memory_order_relaxed), fill, discard)) {
+          s._drops.add(lvl_);
+        }
+        continue;
+      }
+      if (sync_) {
+        s._stream->write(lvl_, line_);
+        if (!s._stream->has_flush_policy()) s._stream->flush();
+        continue;
+      }
+      try {
+        s._stream->write(lvl_, line_);
+      } catch (...) {
+        ; // A failing stream must not take the backend thread down.
+      }
+    }
+  }
+
+  /**
+   * Synchronous mode: write and flush a formatted line on every stream. The only
+   * synchronization is inside each stream.
+   */
+  void _print_sync(LogLevel lvl_, const std::string_view& msg_) {
+    _dispatch(lvl_, msg_, true);
+  }
+
+  /**
+   * Flush the streams without a writer of their own.
+   *
+   * @param[in] idle_ Backend ran idle: leave the streams with a flush policy alone.
+   */
+  void _flush_streams(bool idle_ = false) noexcept {
+    const std::size_t n = _nsinks.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < n; ++i) {
+      sink& s = *_sink_at[i];
+      if (s._queue || (idle_ && s._stream->has_flush_policy())) continue;
+      try {
+        s._stream->flush();
+      } catch (...) {
+        ;
+      }
+    }
+  }
+
+  /**
+   * Barrier through the queue of every stream writer, waiting for room if needed.
+   */
+  void _flush_writers() {
+    const std::size_t n = _nsinks.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < n; ++i) {
+      sink& s = *_sink_at[i];
+      if (!s._queue) continue;
+      flush_token token;
+      while (!s._queue->try_emplace_with([&token](sink_line& l_) noexcept { l_._token = &token; })) {
+        std::this_thread::yield();
+      }
+      token.wait();
+    }
+  }
+
+  void _stop_writers() noexcept {
+    const std::size_t n = _nsinks.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < n; ++i) {
+      sink& s = *_sink_at[i];
+      if (!s._writer.joinable()) continue;
+      s._stop.store(true, std::memory_order_release);
+      s._writer.join();
+    }
+  }
+
+  /**
+   * Stream writer thread: same batching and backoff as the async backend. Exits
+   * once stopped and drained.
+   */
+  void _run_writer(sink& s_) {
+    constexpr std::size_t BATCH = 256;
+    bool dirty = false;
+    idle_backoff idle;
+    std::string report;
+    std::string line;
+    auto next_report = std::chrono::steady_clock::now();
+    auto report_drops = [&]() {
+      if (!s_._drops.report(report)) return;
+      line.clear();
+      _format(line, _line_fmt.load(std::memory_order_relaxed), LogLevel::eWARNING, "logger",
+              nullptr, report, {}, log_clock::now());
+      try {
+        s_._stream->write(LogLevel::eWARNING, line);
+      } catch (...) {
+        ;
+      }
+    };
+    auto write = [&s_](sink_line& l_) noexcept {
+      try {
+        if (l_._token) {
+          s_._stream->flush();
+        } else {
+          s_._stream->write(l_._lvl, l_._line);
+        }
+      } catch (...) {
+        ; // A failing stream must not take its writer down.
+      }
+      if (l_._token) {
+        l_._token->done();
+        l_._token = nullptr;
+      }
+    };
+    auto complete_handoff = [&s_]() {
+      flush_token* t = s_._handoff.take();
+      if (!t) return;
+      try {
+        s_._stream->flush();
+      } catch (...) {
+        ;
+      }
+      token_stack::complete(t);
+    };
+
+    for (;;) {
+      std::size_t n = 0;
+      while (n < BATCH && s_._queue->try_consume(write)) {
+        ++n;
+      }
+      complete_handoff();
+      if (_report_due(next_report)) report_drops();
+      if (!n && dirty) {
+        if (!s_._stream->has_flush_policy()) {
+          try {
+            s_._stream->flush();
+          } catch (...) {
+            ;
+          }
+        }
+        dirty = false;
+      }
+      if (n) {
+        dirty = true;
+        idle.reset();
+        continue;
+      }
+      if (s_._stop.load(std::memory_order_acquire) && !s_._queue->size()) {
+        report_drops();
+        complete_handoff();
+        return;
+      }
+      idle.wait();
+    }
+  }
+
+  static void _copy_ctx(log_record& r_, const char* ctx_) noexcept {
+    std::size_t n = ctx_ ? strnlen(ctx_, MAX_CTX_LENGTH - 1) : 0;
+    if (n) memcpy(r_._ctx, ctx_, n);
+    r_._ctx[n] = '\0';
+  }
+
+  /**
+   * Become a producer of the async queue if async mode is on; _leave_async() once
+   * the record is queued. While there is a producer, disable_async() keeps the
+   * backend running, so a push never waits on a stopped backend and never leaves
+   * its record behind the final drain.
+   *
+   * @return false in synchronous mode.
+   */
+  bool _enter_async() noexcept {
+    if (!_async.load(std::memory_order_acquire)) return false;
+    _producers.fetch_add(1, std::memory_order_seq_cst);
+    if (_async.load(std::memory_order_seq_cst)) return true;
+    _leave_async();
+    return false;
+  }
+
+  void _leave_async() noexcept {
+    _producers.fetch_sub(1, std::memory_order_release);
+  }
+
+  /**
+   * Fill a queue slot in place with fn_, waiting while the queue is full. Only for
+   * the flush barriers, messages go through _push(). Between _enter_async() and
+   * _leave_async().
+   */
+  template <typename F>
+  void _enqueue(F&& fn_) {
+    unsigned spins = 0;
+    while (!_queue->try_emplace_with(fn_)) {
+      if (++spins < 64) continue;
+      std::this_thread::yield();
+    }
+  }
+
+  /**
+   * Queue a message of level lvl_ with fill_, applying the overflow policy.
+   */
+  template <typename F>
+  void _push(LogLevel lvl_, F&& fill_) {
+    auto discard = [this](log_record& r_) noexcept {
+      if (r_._kind == log_record::kind::eMESSAGE) {
+        _drops.add(r_._lvl);
+        return;
+      }
+      _handoff.push(static_cast<flush_token*>(r_._token));   // Flushed by the backend
+    };
+    if (!_push_to(*_queue, _overflow.load(std::memory_order_relaxed),
+                  _max_wait_us.load(std::memory_order_relaxed), fill_, discard)) {
+      _drops.add(lvl_);
+    }
+  }
+
+  /**
+   * Fill a slot of q_ with fill_ under an overflow policy. eOVERWRITE_OLDEST takes
+   * the oldest element out with discard_, which must hand a flush barrier over to
+   * the draining thread (token_stack) rather than lose it or flush on the producer.
+   *
+   * @return false if the message is dropped.
+   */
+  template <typename T, typename F, typename D>
+  static bool _push_to(buffer::mpmc_ring<T>& q_, overflow policy_, std::int64_t max_wait_us_,
+                       F& fill_, D& discard_) {
+    if (q_.try_emplace_with(fill_)) return true;
+    switch (policy_) {
+    case overflow::eDROP_NEWEST:
+      return false;
+    case overflow::eOVERWRITE_OLDEST:
+      do {
+        (void)q_.try_consume(discard_);
+      } while (!q_.try_emplace_with(fill_));
+      return true;
+    case overflow::eBLOCK:
+      break;
+    }
+    const auto deadline = (max_wait_us_ == WAIT_FOREVER.count()) ?
+      std::chrono::steady_clock::time_point::max() :
+      std::chrono::steady_clock::now() + std::chrono::microseconds(max_wait_us_);
+    unsigned spins = 0;
+    while (!q_.try_emplace_with(fill_)) {
+      if (++spins < 64) continue;
+      if (std::chrono::steady_clock::now() >= deadline) return false;
+      std::this_thread::yield();
+    }
+    return true;
+  }
+
+  /**
+   * Whether a drop report is due, moving next_ one report interval ahead if so.
+   */
+  bool _report_due(std::chrono::steady_clock::time_point& next_) const noexcept {
+    const auto now = std::chrono::steady_clock::now();
+    if (now < next_) return false;
+    next_ = now + std::chrono::milliseconds(_report_ms.load(std::memory_order_relaxed));
+    return true;
+  }
+
+  /**
+   * Backend thread: log the messages dropped on the async queue since the last report.
+   */
+  void _report_drops() {
+    if (!_drops.report(_report)) return;
+    _line.clear();
+    _format(_line, _line_fmt.load(std::memory_order_relaxed), LogLevel::eWARNING, "logger",
+            nullptr, _report, {}, log_clock::now());
+    _dispatch(LogLevel::eWARNING, _line, false);
+  }
+
+  /**
+   * Backend thread: drain the queue in batches, flush the streams whenever the
+   * queue runs empty, sleep while idle (see idle_backoff). Exits once stopped and
+   * drained.
+   */
+  void _run_backend() {
+    constexpr std::size_t BATCH = 256;
+    bool dirty = false;
+    idle_backoff idle;
+    auto next_report = std::chrono::steady_clock::now();
+
+    for (;;) {
+      std::size_t n = 0;
+      while (n < BATCH && _queue->try_consume([this](log_record& r_) noexcept { _write(r_); })) {
+        ++n;
+      }
+      if (flush_token* t = _handoff.take()) {
+        _flush_streams();
+        token_stack::complete(t);
+      }
+      if (_report_due(next_report)) _report_drops();
+      if (!n && dirty) {
+        _flush_streams(true);
+        dirty = false;
+      }
+      if (n) {
+        dirty = true;
+        idle.reset();
+        continue;
+      }
+      if (_stop.load(std::memory_order_acquire) && !_queue->size()) {
+        _report_drops();
+        return;
+      }
+      idle.wait();
+    }
+  }
+
+  /**
+   * Backend thread: format and write one record, in place in its queue slot.
+   */
+  void _write(log_record& r_) noexcept {
+    if (r_._kind == log_record::kind::eFLUSH) {
+      _flush_streams();
+      static_cast<flush_token*>(r_._token)->done();
+      return;
+    }
+    try {
+      _line.clear();
+      _format(_line, r_._fmt, r_._lvl, r_._site ? nullptr : r_._ctx, r_._site, r_.text(),
+              r_.fields(), r_._ns);
+      _dispatch(r_._lvl, _line, false);
+    } catch (...) {
+      ; // Out of memory: the message is lost, not the slot.
+    }
+  }
+
+  /**
+   * Keep the message in the flight recorder, if any.
+   *
+   * @return Whether the message passes the log level, i.e. is written out.
+   */
+  bool _record(LogLevel lvl_, const log_site* site_, const char* ctx_,
+               const std::string_view& msg_, std::int64_t ns_) noexcept {
+    crash_recorder* rec = _rec.load(std::memory_order_acquire);
+    if (rec && !(lvl_ < _rec_lvl.load(std::memory_order_relaxed))) {
+      rec->record(lvl_, site_, ctx_, msg_, ns_);
+    }
+    if (site_ && site_->_cache) {
+      const std::uint64_t v = site_->_cache->_v.load(std::memory_order_relaxed);
+      return !(lvl_ < static_cast<LogLevel>((v >> 8) & 0xff));
+    }
+    return !(lvl_ < _min_lvl.load(std::memory_order_relaxed));
+  }
+
+  /**
+   * After a FATAL message: write out everything logged so far, then dump the
+   * flight recorder.
+   */
+  void _on_fatal(LogLevel lvl_) {
+    if (lvl_ != LogLevel::eFATAL) return;
+    crash_recorder* rec = _rec.load(std::memory_order_acquire);
+    if (!rec) return;
+    flush();
+    rec->dump("FATAL");
+  }
+
+  /**
+   * After any level change, under _mtx: is_enabled(level) lets through what is
+   * either logged or recorded, the call sites resolve their levels again against
+   * a new snapshot. The previous one is freed once no _resolve() may still read it.
+   */
+  void _levels_changed() {
+    const bool rec = _rec.load(std::memory_order_relaxed) != nullptr;
+    const std::uint64_t gen = _gen.load(std::memory_order_relaxed) + 1;
+    std::unique_ptr<const level_snapshot> next(new level_snapshot{
+      gen, _min_lvl.load(std::memory_order_relaxed), rec,
+      _rec_lvl.load(std::memory_order_relaxed), _levels});
+    LogLevel gate = next->_min_lvl;
+    if (rec) gate = std::min(gate, next->_rec_lvl);
+
+    _snap.store(next.get(), std::memory_order_seq_cst);
+    _gate_lvl.store(gate, std::memory_order_relaxed);
+    _gen.store(gen, std::memory_order_release);
+    while (_resolving.load(std::memory_order_seq_cst)) {
+      std::this_thread::yield();
+    }
+    _snap_owned = std::move(next);
+  }
+
+  static void _set_rule(std::vector<level_config::rule>& rules_, const std::string& name_,
+                        LogLevel lvl_) {
+    for (auto& r : rules_) {
+      if (r._name == name_) {
+        r._lvl = lvl_;
+        return;
+      }
+    }
+    rules_.push_back({name_, lvl_});
+  }
+
+  /**
+   * Levels of a call site: its file's, else its module's, else the log level. The
+   * enabled level also lets the flight recorder's messages through. Lock-free: the
+   * levels are those of the current snapshot, counted in _resolving while read.
+   */
+  std::uint64_t _resolve(const log_site& site_) const noexcept {
+    _resolving.fetch_add(1, std::memory_order_seq_cst);
+    const level_snapshot& s = *_snap.load(std::memory_order_seq_cst);
+    const std::uint64_t gen = s._gen;
+    LogLevel lvl = s._min_lvl;
+    bool found = false;
+    for (const auto& r : s._levels._files) {
+      if (r._name == site_._file) {
+        lvl = r._lvl;
+        found = true;
+        break;
+      }
+    }
+    for (std::size_t i = 0; !found && *site_._module && i < s._levels._modules.size(); ++i) {
+      if (s._levels._modules[i]._name == site_._module) {
+        lvl = s._levels._modules[i]._lvl;
+        found = true;
+      }
+    }
+    LogLevel gate = lvl;
+    if (s._rec) gate = std::min(gate, s._rec_lvl);
+    _resolving.fetch_sub(1, std::memory_order_release);
+    const std::uint64_t v = (gen << 16) | (static_cast<std::uint64_t>(lvl) << 8) |
+                            static_cast<std::uint64_t>(gate);
+    site_._cache->_v.store(v, std::memory_order_relaxed);
+    return v;
+  }
+
+  /**
+   * @param[in] fmt_ Line format, the one fields_ were encoded for.
+   */
+  static void _format(std::string& out_, line_format fmt_, LogLevel lvl_, const char* ctx_,
+                      const log_site* site_, const std::string_view& msg_,
+                      const std::string_view& fields_, std::int64_t ns_) {
+    log_formater::format_to(out_, fmt_, lvl_, ctx_, site_, msg_, fields_, ns_);
+  }
+
+  std::vector<std::unique_ptr<sink>>  _sinks{};             ///< Owns the streams
+  sink*                       _sink_at[MAX_STREAMS]{};    ///< Append-only, lock-free walk
+  std::atomic<std::size_t>    _nsinks{0};
+  std::atomic<LogLevel>       _min_lvl{LogLevel::eINFO};
+  std::atomic<LogLevel>       _gate_lvl{LogLevel::eINFO};   ///< Logged or recorded
+  std::atomic<std::uint64_t>  _gen{1};                      ///< Level generation, see site_level
+  level_config                _levels;                      ///< Module and file levels, under _mtx
+  std::unique_ptr<const level_snapshot>   _snap_owned{
+    new level_snapshot{1, LogLevel::eINFO, false, LogLevel::eTRACE, {}}};
+  std::atomic<const level_snapshot*>      _snap{_snap_owned.get()};   ///< See _resolve()
+  mutable std::atomic<std::uint32_t>      _resolving{0};
+  std::atomic<line_format>    _line_fmt{line_format::eTEXT};
+  std::mutex                  _mtx;                     ///< Serializes configuration
+
+  /// Async mode
+  std::atomic<bool>                                 _async{false};
+  std::atomic<std::uint32_t>                        _producers{0};   ///< See _enter_async()
+  token_stack                                       _handoff;        ///< Of the async queue
+  std::atomic<bool>                                 _stop{false};
+  std::unique_ptr<buffer::mpmc_ring<log_record>>    _queue;
+  std::thread                                       _backend;
+  std::string                                       _line;    ///< Backend line buffer
+  std::atomic<overflow>                             _overflow{overflow::eBLOCK};
+  std::atomic<std::int64_t>                         _max_wait_us{DEFAULT_MAX_WAIT.count()};
+  std::atomic<std::int64_t>                         _report_ms{1000};
+  drop_counters                                     _drops;
+  std::string                                       _report;  ///< Backend drop report
+
+  std::shared_ptr<backup_compressor>  _compressor;    ///< See compressor()
+
+  /// Flight recorder
+  std::unique_ptr<crash_recorder>   _recorder;
+  std::atomic<crash_recorder*>      _rec{nullptr};
+  std::atomic<LogLevel>             _rec_lvl{LogLevel::eTRACE};
+
+  std::unique_ptr<config_watcher>   _watcher;     ///< See watch_levels()
 };
 
-static logger& get_instance() {
+/**
+ * The process-wide logger, shared by every translation unit.
+ */
+inline logger& get_instance() {
   static logger ins;
   return ins;
 }
@@ -0,0 +1,199 @@
+/**************************************************************************************
+* Lightweight Logger - Structured Fields
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: structured.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * Typed key-value fields for structured log lines, and their encoding as JSON lines
+ * or logfmt:
+ *
+ *   INFO_KV("request done", kv("user", id), kv("path", path), kv("ms", 3.25));
+ *
+ *   {"time":"...","level":"INFO","site":"server.cc:42","msg":"request done",
+ *    "user":42,"path":"/index","ms":3.25}
+ *   time=... level=INFO site=server.cc:42 msg="request done" user=42 path=/index ms=3.25
+ *
+ * encode() appends the fields straight to the caller's (reused) buffer: integers and
+ * floating point through std::to_chars, strings escaped span by span. No temporary
+ * string, no stream.
+ *
+ * Supported values: bool, integers, floating point, const char* (null is written as
+ * null), char arrays, std::string and std::string_view.
+ */
+#ifndef LIGHTWEIGHT_STRUCTURED_H_
+#define LIGHTWEIGHT_STRUCTURED_H_
+
+#include <cmath>
+#include <string>
+#include <cstdint>
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+
+namespace anhthd {
+namespace cpplibs {
+namespace logger {
+namespace lightweight {
+/**
+ * Layout of the log lines.
+ */
+enum class line_format {
+  eTEXT,    ///< "date | LEVEL | file:line | message key=value ..."
+  eJSON,    ///< One JSON object per line
+  eLOGFMT   ///< key=value pairs
+};
+
+/**
+ * A named value, see kv(). Numbers are held by value, anything else by reference:
+ * a field lives for the full expression of the logging call.
+ */
+template <typename T>
+struct kv_field {
+  using value_type = std::conditional_t<std::is_arithmetic<T>::value, T, const T&>;
+
+  const char* _key;
+  value_type  _value;
+};
+
+template <typename T>
+kv_field<T> kv(const char* key_, const T& value_) {
+  return kv_field<T>{key_, value_};
+}
+
+namespace structured {
+/**
+ * Append s_ escaped for the inside of a JSON string.
+ */
+inline void json_escape(std::string& out_, std::string_view s_) {
+  static constexpr char HEX[] = "0123456789abcdef";
+  std::size_t from = 0;
+  for (std::size_t i = 0; i < s_.size(); ++i) {
+    const unsigned char c = static_cast<unsigned char>(s_[i]);
+    if (c >= 0x20 && c != '"' && c != '\\') continue;
+    out_.append(s_.data() + from, i - from);
+    from = i + 1;
+    switch (c) {
+    case '"':  out_.append("\\\""); break;
+    case '\\': out_.append("\\\\"); break;
+    case '\n': out_.append("\\n"); break;
+    case '\r': out_.append("\\r"); break;
+    case '\t': out_.append("\\t"); break;
+    default: {
+      const char u[6] = {'\\', 'u', '0', '0', HEX[c >> 4], HEX[c & 0xf]};
+      out_.append(u, sizeof(u));
+    }
+    }
+  }
+  out_.append(s_.data() + from, s_.size() - from);
+}
+
+inline void json_string(std::string& out_, std::string_view s_) {
+  out_.push_back('"');
+  json_escape(out_, s_);
+  out_.push_back('"');
+}
+
+/**
+ * Append s_ as a logfmt value: bare if it can be, otherwise quoted with `"`, `\`
+ * and control characters escaped.
+ */
+inline void logfmt_string(std::string& out_, std::string_view s_) {
+  bool bare = !s_.empty();
+  for (const char c : s_) {
+    if (static_cast<unsigned char>(c) <= ' ' || c == '=' || c == '"' || c == '\\') {
+      bare = false;
+      break;
+    }
+  }
+  if (bare) {
+    out_.append(s_.data(), s_.size());
+    return;
+  }
+  json_string(out_, s_);
+}
+
+/**
+ * Append s_ as a logfmt key. Keys cannot be quoted, so a space, control
+ * character, `=` or `"` is replaced with `_`, and an empty key becomes `_`.
+ */
+inline void logfmt_key(std::string& out_, std::string_view s_) {
+  if (s_.empty()) {
+    out_.push_back('_');
+    return;
+  }
+  for (const char c : s_) {
+    const bool bad = static_cast<unsigned char>(c) <= ' ' || c == '=' || c == '"';
+    out_.push_back(bad ? '_' : c);
+  }
+}
+
+template <typename T>
+void encode_value(std::string& out_, line_format fmt_, const T& v_) {
+  using U = std::decay_t<T>;
+  if constexpr (std::is_same<U, bool>::value) {
+    out_.append(v_ ? "true" : "false");
+  } else if constexpr (std::is_integral<U>::value) {
+    char buf[24];
+    out_.append(buf, std::to_chars(buf, buf + sizeof(buf), v_).ptr - buf);
+  } else if constexpr (std::is_floating_point<U>::value) {
+    if (fmt_ == line_format::eJSON && !std::isfinite(v_)) {
+      out_.append("null");
+      return;
+    }
+    char buf[32];
+    out_.append(buf, std::to_chars(buf, buf + sizeof(buf), v_).ptr - buf);
+  } else if constexpr (std::is_array<T>::value) {
+    encode_value(out_, fmt_, std::string_view(v_));
+  } else if constexpr (std::is_same<U, const char*>::value || std::is_same<U, char*>::value) {
+    if (!v_) {
+      out_.append("null");
+    } else {
+      encode_value(out_, fmt_, std::string_view(v_));
+    }
+  } else if constexpr (std::is_same<U, std::string>::value ||
+                       std::is_same<U, std::string_view>::value) {
+    if (fmt_ == line_format::eJSON) {
+      json_string(out_, v_);
+    } else {
+      logfmt_string(out_, v_);
+    }
+  } else {
+    static_assert(!sizeof(T), "log field: unsupported value type");
+  }
+}
+
+/**
+ * Append fields_ in fmt_: `,"key":value` pairs for JSON (the object is opened and
+ * closed by the line formatter), ` key=value` pairs otherwise, see logfmt_key().
+ */
+template <typename... T>
+void encode(std::string& out_, line_format fmt_, const kv_field<T>&... fields_) {
+  if (fmt_ == line_format::eJSON) {
+    ((out_.push_back(','), json_string(out_, fields_._key), out_.push_back(':'),
+      encode_value(out_, fmt_, fields_._value)), ...);
+  } else {
+    ((out_.push_back(' '), logfmt_key(out_, fields_._key), out_.push_back('='),
+      encode_value(out_, fmt_, fields_._value)), ...);
+  }
+}
+};  // namespace structured
+};  // namespace lightweight
+};  // namespace logger
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* LIGHTWEIGHT_STRUCTURED_H_ */
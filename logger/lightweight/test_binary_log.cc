@@ -0,0 +1,54 @@
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+
+#include "binary_log.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+enum class side { eBUY = 1, eSELL = 2 };
+
+int main(int argc, char** argv)
+{
+  // Binary file, decoded below (or offline with log_decoder).
+  BINLOGGER.enable(fs::path("./binary.blog"));
+
+  std::vector<std::thread> ts;
+  for (int t = 0; t < 2; ++t) {
+    ts.emplace_back([t]() {
+      for (int i = 0; i < 3; ++i) {
+        BIN_INFO("thread %d order %u side %d px %.2f", t, (unsigned)i, side::eSELL, 100.25 + i);
+      }
+    });
+  }
+  for (auto& th : ts) th.join();
+
+  const std::string venue = "XNAS";
+  BIN_WARNING("venue %s symbol %-6s| qty %5lld", venue, "AAPL", -42LL);
+  BIN_ERROR("no argument, 100%% literal");
+  BIN_DEBUG("filtered out: %d", 1);
+  BINLOGGER.disable();
+
+  binary::log_reader reader{fs::path("./binary.blog")};
+  binary::log_reader::entry e;
+  while (reader.next(e)) {
+    cout << e._site->_file << ":" << e._site->_line << " " << e._msg << endl;
+  }
+
+  // Text mode: the backend formats and writes to LOGGER streams.
+  LOGGER.enable_console();
+  BINLOGGER.enable(LOGGER);
+  BIN_INFO("formatted on the backend thread: %s=%d %p", "answer", 42, (void*)&reader);
+  // Larger than half the 1MiB thread buffer: dropped, counted and reported.
+  BIN_INFO("too large: %s", std::string(600 << 10, 'x'));
+  cout << "dropped " << BINLOGGER.dropped() << " message(s)" << endl;
+  BINLOGGER.flush();
+  BINLOGGER.disable();
+
+  return 0;
+}
@@ -0,0 +1,172 @@
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "logger.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+static int failures = 0;
+
+static void check(bool ok_, const std::string& what_) {
+  failures += !ok_;
+  cout << (ok_ ? "ok   " : "FAIL ") << what_ << endl;
+}
+
+static std::string read_file(const std::string& path_) {
+  std::ifstream in(path_, std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static bool exists(const std::string& path_) {
+  return ::access(path_.c_str(), F_OK) == 0;
+}
+
+#ifndef LOG_COMPRESS_ZLIB
+/**
+ * Reference LZ4 frame decoder, just enough for what file_codec writes.
+ */
+static bool lz4_decode(const std::string& in_, std::string& out_) {
+  const auto* p = reinterpret_cast<const std::uint8_t*>(in_.data());
+  const auto* end = p + in_.size();
+  auto get32 = [](const std::uint8_t* q) {
+    return q[0] | (q[1] << 8) | (q[2] << 16) | (std::uint32_t(q[3]) << 24);
+  };
+  if (in_.size() < 11 || get32(p) != 0x184D2204u) return false;
+  if (p[6] != std::uint8_t(compress::xxh32_short(p + 4, 2) >> 8)) return false;
+  p += 7;
+  out_.clear();
+  for (;;) {
+    if (end - p < 4) return false;
+    const std::uint32_t size = get32(p);
+    p += 4;
+    if (!size) return p == end;
+    const std::uint32_t n = size & 0x7fffffffu;
+    if (std::uint32_t(end - p) < n) return false;
+    if (size & 0x80000000u) {
+      out_.append(reinterpret_cast<const char*>(p), n);
+      p += n;
+      continue;
+    }
+    const std::uint8_t* q = p;
+    const std::uint8_t* block_end = p + n;
+    const std::size_t block_start = out_.size();
+    while (q < block_end) {
+      const std::uint8_t token = *q++;
+      std::size_t lit = token >> 4;
+      if (lit == 15) {
+        std::uint8_t b;
+        do { b = *q++; lit += b; } while (b == 255);
+      }
+      out_.append(reinterpret_cast<const char*>(q), lit);
+      q += lit;
+      if (q == block_end) break;
+      const std::size_t offset = q[0] | (q[1] << 8);
+      q += 2;
+      std::size_t len = (token & 15) + 4;
+      if ((token & 15) == 15) {
+        std::uint8_t b;
+        do { b = *q++; len += b; } while (b == 255);
+      }
+      if (!offset || offset > out_.size() - block_start) return false;
+      const std::size_t from = out_.size() - offset;
+      for (std::size_t i = 0; i < len; ++i) out_.push_back(out_[from + i]);
+    }
+    p = block_end;
+  }
+}
+
+/**
+ * Round trip through file_codec and lz4_decode.
+ */
+static void round_trip(const std::string& data_, const std::string& what_) {
+  const char* in_path = "./codec.in";
+  const char* out_path = "./codec.lz4";
+  { std::ofstream(in_path, std::ios::binary) << data_; }
+  const int in = ::open(in_path, O_RDONLY);
+  const int out = ::open(out_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  compress::file_codec codec;
+  std::uint64_t n = 0;
+  const bool ok = codec.compress(in, out, n);
+  ::close(in);
+  ::close(out);
+  const std::string packed = read_file(out_path);
+  std::string back;
+  check(ok && n == data_.size() && lz4_decode(packed, back) && back == data_,
+        what_ + ": " + std::to_string(data_.size()) + " -> " + std::to_string(packed.size()));
+}
+#endif
+
+int main(int argc, char** argv)
+{
+#ifndef LOG_COMPRESS_ZLIB
+  std::string text;
+  for (int i = 0; text.size() < (9u << 20); ++i) {
+    text += "19-10-2026 10:00:00.000123 |    INFO | server.cc:42 | request " +
+            std::to_string(i) + " done in " + std::to_string(i % 97) + "ms\n";
+  }
+  std::string noise(300000, '\0');
+  std::uint32_t x = 12345;
+  for (char& c : noise) c = static_cast<char>((x = x * 1103515245u + 12345u) >> 24);
+
+  round_trip("", "empty");
+  round_trip("short", "short");
+  round_trip(std::string(100000, 'a'), "one byte repeated");
+  round_trip(text, "log text, 3 blocks");
+  round_trip(noise, "incompressible");
+  round_trip(text.substr(0, 5000) + noise.substr(0, 5000) + text.substr(0, 70000), "mixed");
+#endif
+
+  // Rotation: backups compressed and shifted under their compressed names.
+  const std::string file = "./compress.log";
+  const std::string ext = compress::file_codec::extension();
+  for (int i = 0; i <= 4; ++i) {
+    const std::string b = i ? backup_name(fs::path(file.c_str()), i) : file;
+    std::remove(b.c_str());
+    std::remove((b + ext).c_str());
+  }
+  auto gz = std::make_shared<backup_compressor>();
+  {
+    file_stream s(fs::path(file.c_str()), 64 << 10, 3, gz);
+    for (int i = 0; i < 5000; ++i) {
+      s.print_log("19-10-2026 10:00:00.000123 |    INFO | test_compress.cc:42 | line " +
+                  std::to_string(i));
+    }
+  }
+  gz->wait_idle();
+  const auto st = gz->get_stats();
+  check(st._files >= 3 && st._bytes_out * 3 < st._bytes_in,
+        "compressed " + std::to_string(st._files) + " files, " + std::to_string(st._bytes_in) +
+        " -> " + std::to_string(st._bytes_out) + " bytes");
+  for (int i = 1; i <= 3; ++i) {
+    const std::string b = backup_name(fs::path(file.c_str()), i);
+    check(exists(b + ext) && !exists(b), b + ext + " only");
+  }
+  check(!exists(backup_name(fs::path(file.c_str()), 4) + ext), "no 4th backup");
+#ifndef LOG_COMPRESS_ZLIB
+  std::string newest;
+  const bool decoded = lz4_decode(read_file(backup_name(fs::path(file.c_str()), 1) + ext), newest);
+  const std::string current = read_file(file);
+  const std::size_t last = newest.rfind("| line ", newest.size() - 2);
+  const std::size_t first = current.find("| line ");
+  check(decoded && last != std::string::npos && first != std::string::npos &&
+        atoi(newest.c_str() + last + 7) + 1 == atoi(current.c_str() + first + 7),
+        "newest backup decodes, followed by the current file");
+#endif
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? 1 : 0;
+}
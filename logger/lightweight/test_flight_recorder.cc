@@ -0,0 +1,107 @@
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "logger.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+static int failures = 0;
+
+static std::string read_file(const char* path_) {
+  std::ifstream in(path_);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+static void expect(const std::string& text_, const char* what_, bool present_ = true) {
+  const bool ok = (text_.find(what_) != std::string::npos) == present_;
+  failures += !ok;
+  cout << (ok ? "ok   " : "FAIL ") << (present_ ? "has " : "has not ") << what_;
+  if (what_[strlen(what_) - 1] != '\n') cout << endl;
+}
+
+int main(int argc, char** argv)
+{
+  const char* dump = "./crash.dump";
+  remove(dump);
+
+  // Only WARNING and above are written out, everything is recorded.
+  LOGGER.set_log_level(LogLevel::eWARNING);
+  LOGGER.set_log_file(fs::path("./flight.log"), 1 << 20, 1);
+  LOGGER.enable_flight_recorder(fs::path(dump), LogLevel::eTRACE, 64);
+  INFO("recording");
+
+  std::thread worker([]() {
+    for (int i = 0; i < 100; ++i) {
+      DEBUG("worker step %d", i);
+    }
+  });
+  worker.join();
+  for (int i = 0; i < 10; ++i) {
+    TRACE("main step %d", i);
+  }
+  INFO_KV("state", kv("queue", 3), kv("user", "bob"));
+
+  // A crash in a child process: the handler dumps, then the default action runs.
+  if (argc > 1 && std::string(argv[1]) == "segv") {
+    volatile int* p = nullptr;
+    *p = 1;
+  }
+  const pid_t pid = fork();
+  if (pid == 0) {
+    DEBUG("child about to abort");
+    abort();
+  }
+  int status = 0;
+  waitpid(pid, &status, 0);
+  const bool aborted = WIFSIGNALED(status) && WTERMSIG(status) == SIGABRT;
+  failures += !aborted;
+  cout << (aborted ? "ok   " : "FAIL ") << "child killed by SIGABRT" << endl;
+
+  std::string text = read_file(dump);
+  expect(text, "==== flight recorder: SIGABRT, 2 thread(s) ====");
+  expect(text, "|   DEBUG | test_flight_recorder.cc:");
+  expect(text, "| child about to abort");
+  expect(text, "| worker step 35\n", false);   // 64 events per thread
+  expect(text, "| worker step 99\n");
+  expect(text, "| state queue=3 user=bob\n");
+
+  // FATAL: written out, then the rings are dumped.
+  remove(dump);
+  FATAL("giving up after %d steps", 10);
+  text = read_file(dump);
+  expect(text, "==== flight recorder: FATAL, 2 thread(s) ====");
+  expect(text, "|   TRACE | test_flight_recorder.cc:");
+  expect(text, "| main step 9\n");
+  expect(text, "| giving up after 10 steps\n");
+  expect(text, "| child about to abort", false);
+
+  // Concurrent dumps: the second waits for the first, then appends.
+  remove(dump);
+  std::thread first([]() { LOGGER.dump_flight_recorder("first"); });
+  std::thread second([]() { LOGGER.dump_flight_recorder("second"); });
+  first.join();
+  second.join();
+  text = read_file(dump);
+  expect(text, "==== flight recorder: first, 2 thread(s) ====");
+  expect(text, "==== flight recorder: second, 2 thread(s) ====");
+
+  text = read_file("./flight.log");
+  expect(text, "giving up after 10 steps");
+  expect(text, "main step", false);
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,117 @@
+#include <new>
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+
+#include "format.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+
+#define FORMAT_STRUCT(name, literal) \
+  struct name { static constexpr std::string_view value() { return literal; } }
+
+static int failures = 0;
+static std::size_t allocations = 0;
+
+void* operator new(std::size_t n_) {
+  ++allocations;
+  if (void* p = malloc(n_ ? n_ : 1)) return p;
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p_) noexcept {
+  free(p_);
+}
+
+void operator delete(void* p_, std::size_t) noexcept {
+  free(p_);
+}
+
+/**
+ * Compare detail::format_to with snprintf on the same format and arguments.
+ */
+#define EXPECT_SAME(literal, ...) \
+  do { \
+    FORMAT_STRUCT(_f, literal); \
+    std::string got; \
+    detail::format_to<_f>(got, __VA_ARGS__); \
+    char want[512]; \
+    snprintf(want, sizeof(want), literal, __VA_ARGS__); \
+    if (got != want) { \
+      ++failures; \
+      cout << "FAIL " << literal << ": [" << got << "] != [" << want << "]" << endl; \
+    } else { \
+      cout << "ok   " << literal << ": [" << got << "]" << endl; \
+    } \
+  } while (0)
+
+enum class color { eRED = 1, eGREEN = 2 };
+
+int main(int argc, char** argv)
+{
+  EXPECT_SAME("%d %i %u", 42, -7, 3000000000u);
+  EXPECT_SAME("%5d|%-5d|%05d|%+d|% d", 42, 42, -42, 42, 42);
+  EXPECT_SAME("%x %X %#x %#o %o %08X", 255u, 255u, 255u, 8u, 0u, 0xbeefu);
+  EXPECT_SAME("%.3d %.0d|%8.3d", 7, 0, -5);
+  EXPECT_SAME("%.50d|%-60.50x|%#08o|%+.45d", 7, 255u, 8u, -3);
+  EXPECT_SAME("%lld %llu %zu", (long long)INT64_MIN, (unsigned long long)UINT64_MAX, (size_t)12);
+  EXPECT_SAME("%hhd %hd %ld", (signed char)-3, (short)-300, 123456789L);
+  EXPECT_SAME("%c%c%c", 'a', 'b', 99);
+  EXPECT_SAME("%f %.2f %10.3f %-10.1f| %+.1f", 3.14159, 2.005, -1.5, 0.25, 1.0);
+  EXPECT_SAME("%e %.3E %g %G %.3g", 12345.678, 0.000123, 0.0001, 1e20, 3.14159);
+  EXPECT_SAME("%a %A %.2a", 1.0, -0.5, 3.0);
+  EXPECT_SAME("%#g %#.0f %#.0e %#G %#.3g %#g", 1.0, 1.0, 12345.0, 1e20, 0.0001, 123456789.0);
+  EXPECT_SAME("%#.0a %#10.0f|%#g %#.0g %#.400g", 1.0, -2.0, 0.0, 5.0, 1e300);
+  EXPECT_SAME("%f %f %F %08.2f", 1.0 / 0.0, -1.0 / 0.0, 1.0 / 0.0, -3.5);
+  EXPECT_SAME("%s|%10s|%-10s|%.3s", "abc", "right", "left", "truncate");
+  EXPECT_SAME("%p %p", (void*)&failures, (void*)nullptr);
+  EXPECT_SAME("%*d|%-*d|%.*f|%*.*s", 6, 42, 6, 42, 2, 3.14159, 8, 3, "abcdef");
+  EXPECT_SAME("100%% literal %d%%", 5);
+
+  {
+    // Types snprintf cannot take directly.
+    FORMAT_STRUCT(_f, "%s=%d %s [%5.1f]");
+    std::string got;
+    const std::string name = "color";
+    detail::format_to<_f>(got, name, color::eGREEN, std::string_view("view"), 2.25f);
+    const bool ok = (got == "color=2 view [  2.2]" || got == "color=2 view [  2.3]");
+    failures += !ok;
+    cout << (ok ? "ok   " : "FAIL ") << got << endl;
+  }
+
+  {
+    // No truncation: a message far above MAX_MSG_LENGTH.
+    FORMAT_STRUCT(_f, "%s%s");
+    std::string got;
+    const std::string big(2000, 'x');
+    detail::format_to<_f>(got, big, "!");
+    const bool ok = (got.size() == 2001 && got.back() == '!');
+    failures += !ok;
+    cout << (ok ? "ok   " : "FAIL ") << "long message of " << got.size() << " chars" << endl;
+  }
+
+  {
+    // std::string arguments are appended in place, never copied.
+    FORMAT_STRUCT(_f, "%s|%-3000s|%.5s");
+    const std::string big(2000, 'y');
+    std::string got;
+    got.reserve(8192);
+    const std::size_t before = allocations;
+    detail::format_to<_f>(got, big, big, big);
+    const bool ok = (allocations == before && got.size() == 2000 + 1 + 3000 + 1 + 5);
+    failures += !ok;
+    cout << (ok ? "ok   " : "FAIL ") << "std::string arguments, "
+         << allocations - before << " allocation(s)" << endl;
+  }
+
+  // These fail to compile:
+  //   FORMAT_STRUCT(_f, "%d"); detail::format_to<_f>(s, "text");  // type mismatch
+  //   FORMAT_STRUCT(_f, "%d %d"); detail::format_to<_f>(s, 1);    // too few arguments
+  //   FORMAT_STRUCT(_f, "%y"); detail::format_to<_f>(s, 1);       // unknown conversion
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? 1 : 0;
+}
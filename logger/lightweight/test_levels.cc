@@ -0,0 +1,165 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+#include <signal.h>
+
+#define LOG_MODULE "net"
+#include "logger.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+static int failures = 0;
+
+/**
+ * Collects the log lines.
+ */
+class capture_stream: public log_stream
+{
+public:
+  void print_log(const std::string_view& msg_) override {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _lines.emplace_back(msg_);
+  }
+
+  std::size_t count(const char* what_) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    std::size_t n = 0;
+    for (const auto& l : _lines) n += l.find(what_) != std::string::npos;
+    return n;
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _lines.clear();
+  }
+
+private:
+  std::mutex                _mtx;
+  std::vector<std::string>  _lines;
+};
+
+static capture_stream* cap = nullptr;
+
+static void on_hup(int) { }
+
+static void check(bool ok_, const char* what_) {
+  failures += !ok_;
+  cout << (ok_ ? "ok   " : "FAIL ") << what_ << endl;
+}
+
+/**
+ * One call per level, the same call sites every time.
+ */
+static void log_all() {
+  TRACE("at TRACE");
+  DEBUG("at DEBUG");
+  INFO("at INFO");
+  WARNING("at WARNING");
+}
+
+static void write_file(const char* path_, const char* text_) {
+  // Replaced like an editor does, by a rename.
+  const std::string tmp = std::string(path_) + ".tmp";
+  std::ofstream(tmp) << text_;
+  std::rename(tmp.c_str(), path_);
+}
+
+/**
+ * Wait up to 2s for the watcher thread to apply a reload.
+ */
+static bool wait_for(bool (*cond_)()) {
+  for (int i = 0; i < 200 && !cond_(); ++i) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  }
+  return cond_();
+}
+
+int main(int argc, char** argv)
+{
+  LOGGER.set_log_level(LogLevel::eINFO);
+  auto& s = static_cast<capture_stream&>(LOGGER.add_stream(std::make_unique<capture_stream>()));
+  cap = &s;
+
+  log_all();
+  check(!s.count("at DEBUG") && s.count("at INFO") == 1, "default level INFO");
+
+  s.clear();
+  LOGGER.set_module_level("net", LogLevel::eDEBUG);
+  LOGGER.set_module_level("disk", LogLevel::eTRACE);
+  log_all();
+  check(!s.count("at TRACE") && s.count("at DEBUG") == 1, "module net at DEBUG");
+
+  s.clear();
+  LOGGER.set_file_level("test_levels.cc", LogLevel::eWARNING);
+  log_all();
+  check(!s.count("at INFO") && s.count("at WARNING") == 1, "file level before module level");
+
+  s.clear();
+  LOGGER.clear_level_overrides();
+  log_all();
+  check(!s.count("at DEBUG") && s.count("at INFO") == 1, "overrides cleared");
+
+  // A watcher gone, SIGHUP gets back the action it had before.
+  const char* conf = "./levels.conf";
+  signal(SIGHUP, on_hup);
+  {
+    config_watcher w(fs::path(conf), true, false, []() { });
+  }
+  struct sigaction sa;
+  sigaction(SIGHUP, nullptr, &sa);
+  check(sa.sa_handler == on_hup, "SIGHUP action restored");
+  signal(SIGHUP, SIG_DFL);
+
+  // Hot reload on file change.
+  write_file(conf, "# test\nlevel = WARNING\nmodule.net = TRACE   # everything\n");
+  LOGGER.watch_levels(fs::path(conf));
+  s.clear();
+  log_all();
+  check(s.count("at TRACE") == 1, "loaded: module net at TRACE");
+
+  write_file(conf, "level = WARNING\n");
+  check(wait_for([]() {
+          cap->clear();
+          log_all();
+          return !cap->count("at TRACE");
+        }), "reloaded on change: module level dropped");
+
+  s.clear();
+  write_file(conf, "level = LOUD\n");
+  check(wait_for([]() { return cap->count("Log levels not reloaded") == 1; }),
+        "malformed file: reload failure logged");
+  s.clear();
+  log_all();
+  check(!s.count("at INFO") && s.count("at WARNING") == 1, "malformed file: levels kept");
+
+  // Reload on SIGHUP only.
+  write_file(conf, "level = INFO\n");
+  LOGGER.watch_levels(fs::path(conf), true, false);
+  write_file(conf, "level = DEBUG\n");
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  check(!LOGGER.is_enabled(LogLevel::eDEBUG), "no reload without SIGHUP");
+  raise(SIGHUP);
+  check(wait_for([]() { return LOGGER.is_enabled(LogLevel::eDEBUG); }), "reloaded on SIGHUP");
+  s.clear();
+  log_all();
+  check(!s.count("at TRACE") && s.count("at DEBUG") == 1, "reloaded: level DEBUG");
+
+  // Cost of a filtered call site.
+  LOGGER.set_log_level(LogLevel::eINFO);
+  const int n = 10000000;
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    DEBUG("filtered %d", i);
+  }
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  cout << "filtered call: " << ns / n << " ns" << endl;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? 1 : 0;
+}
@@ -7,15 +7,25 @@
 #include "logger.hh"
 
 using namespace std;
-using namespace anhthd::cpplibs;
 using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
 
 int main(int argc, char** argv)
 {
   LOGGER.set_log_level(LogLevel::eTRACE);
-  LOGGER.set_log_file(filesystem::path("./log.log"), 10000, 5);
-  LOGGER.set_log_trace(filesystem::path("./trace.trace"), 1000, 2);
-  LOGGER.enable_console();
+  LOGGER.set_log_file(fs::path("./log.log"), 10000, 5);
+  LOGGER.set_log_trace(fs::path("./trace.trace"), 1000, 2);
+  // The console gets its own queue and writer thread, a slow terminal only delays itself.
+  LOGGER.enable_console(LogLevel::eTRACE, 1024);
+
+  // Batched file: written out every 64KiB or 100ms, ERROR and FATAL at once.
+  flush_policy policy;
+  policy._buffer_size = 64 * 1024;
+  policy._interval = std::chrono::milliseconds(100);
+  LOGGER.add_stream(std::make_unique<writev_stream>(fs::path("./batch.log"), policy));
+  // Memory-mapped file: 1MiB files grown by 64KiB, 2 backups, WARNING and above.
+  LOGGER.add_stream(std::make_unique<mmap_stream>(fs::path("./mmap.log"), 1 << 20, 2, 64 << 10),
+                    LogLevel::eWARNING);
 
   TRACE("This is log TRACE");
   DEBUG("This is log DEBUG");
@@ -23,6 +33,33 @@ int main(int argc, char** argv)
   WARNING("This is log WARNING");
   ERROR("This is log ERROR");
   FATAL("This is log FATAL");
+  INFO("Typed arguments: %s %5.2f %#x %p", std::string("string"), 3.14159, 255u, (void*)argv);
+  INFO("Long message, not truncated: %s|", std::string(600, '-'));
+
+  // Arguments of a filtered call are not evaluated.
+  int evaluated = 0;
+  auto costly = [&evaluated]() { return std::to_string(++evaluated); };
+  LOGGER.set_log_level(LogLevel::eINFO);
+  DEBUG("This is filtered: %s", costly());
+  INFO("Arguments of the filtered DEBUG evaluated %d time(s)", evaluated);
+
+  // Sampled call sites: 3 lines each out of 25 calls.
+  for (int i = 0; i < 25; ++i) {
+    INFO_EVERY_N(10, "Every 10th call, this is #%d", i);
+    INFO_FIRST_N(3, "First 3 calls, this is #%d", i);
+    INFO_RATE_LIMITED(3, "Up to 3 a second, this is #%d", i);
+  }
+
+  log_clock::use_tsc();
+  // A full queue holds a call site up to 1ms, then the message is dropped and counted.
+  LOGGER.set_overflow_policy(overflow::eBLOCK, std::chrono::milliseconds(1));
+  LOGGER.enable_async();
+  for (int i = 0; i < 3; ++i) {
+    INFO("This is async log INFO #%d", i);
+  }
+  INFO("Long async message, not truncated: %s|", std::string(600, '='));
+  LOGGER.flush();
+  WARNING("This is async log WARNING, written at exit");
 
   return 0;
 }
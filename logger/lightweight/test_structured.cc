@@ -0,0 +1,99 @@
+#include <string>
+#include <cstdio>
+#include <cstdint>
+#include <iostream>
+
+#include "logger.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+
+static int failures = 0;
+
+/**
+ * Compare structured::encode of the fields with the expected text.
+ */
+#define EXPECT_FIELDS(fmt, want, ...) \
+  do { \
+    std::string got; \
+    structured::encode(got, fmt, __VA_ARGS__); \
+    if (got != want) { \
+      ++failures; \
+      cout << "FAIL [" << got << "] != [" << want << "]" << endl; \
+    } else { \
+      cout << "ok   [" << got << "]" << endl; \
+    } \
+  } while (0)
+
+/**
+ * Collects the log lines.
+ */
+class capture_stream: public log_stream
+{
+public:
+  void print_log(const std::string_view& msg_) override {
+    _lines.emplace_back(msg_);
+  }
+
+  std::vector<std::string> _lines;
+};
+
+int main(int argc, char** argv)
+{
+  const std::string path = "/index a=b";
+  const char* none = nullptr;
+
+  EXPECT_FIELDS(line_format::eJSON, ",\"user\":42,\"ok\":true,\"ms\":3.25",
+                kv("user", 42), kv("ok", true), kv("ms", 3.25));
+  EXPECT_FIELDS(line_format::eLOGFMT, " user=42 ok=true ms=3.25",
+                kv("user", 42), kv("ok", true), kv("ms", 3.25));
+  EXPECT_FIELDS(line_format::eJSON, ",\"path\":\"/index a=b\",\"q\":\"say \\\"hi\\\"\\n\"",
+                kv("path", path), kv("q", "say \"hi\"\n"));
+  EXPECT_FIELDS(line_format::eLOGFMT, " path=\"/index a=b\" id=abc empty=\"\"",
+                kv("path", path), kv("id", std::string_view("abc")), kv("empty", ""));
+  EXPECT_FIELDS(line_format::eJSON, ",\"none\":null,\"nan\":null,\"ctl\":\"\\u0001\"",
+                kv("none", none), kv("nan", 0.0 / 0.0), kv("ctl", "\x01"));
+  EXPECT_FIELDS(line_format::eTEXT, " min=-9223372036854775808 max=18446744073709551615",
+                kv("min", INT64_MIN), kv("max", UINT64_MAX));
+  EXPECT_FIELDS(line_format::eLOGFMT, " a_b=1 x_y_=2 _=3",
+                kv("a b", 1), kv("x=y\"", 2), kv("", 3));
+
+  // Whole lines, through the logger.
+  LOGGER.set_log_level(LogLevel::eINFO);
+  auto& s = static_cast<capture_stream&>(LOGGER.add_stream(std::make_unique<capture_stream>()));
+  for (line_format fmt : {line_format::eTEXT, line_format::eJSON, line_format::eLOGFMT}) {
+    LOGGER.set_line_format(fmt);
+    INFO_KV("request done", kv("user", 42), kv("path", path), kv("ms", 3.25));
+    WARNING("plain \"message\" %d", 7);
+  }
+  LOGGER.set_line_format(line_format::eJSON);
+  LOGGER.enable_async();
+  ERROR_KV("async", kv("n", 1));
+  LOGGER.set_line_format(line_format::eLOGFMT);   // The queued line stays JSON
+  LOGGER.flush();
+  LOGGER.disable_async();
+
+  const char* expect[] = {
+    "| request done user=42 path=\"/index a=b\" ms=3.25",
+    "| plain \"message\" 7",
+    "\",\"level\":\"INFO\",\"site\":\"test_structured.cc:",
+    "\",\"msg\":\"request done\",\"user\":42,\"path\":\"/index a=b\",\"ms\":3.25}",
+    "\"msg\":\"plain \\\"message\\\" 7\"}",
+    " level=INFO site=test_structured.cc:",
+    " msg=\"request done\" user=42 path=\"/index a=b\" ms=3.25",
+    " level=WARNING site=test_structured.cc:",
+    "\"level\":\"ERROR\",\"site\":\"test_structured.cc:",
+    "\"msg\":\"async\",\"n\":1}"
+  };
+  const std::size_t line_of[] = {0, 1, 2, 2, 3, 4, 4, 5, 6, 6};
+  for (std::size_t i = 0; i < sizeof(line_of) / sizeof(line_of[0]); ++i) {
+    const bool ok = line_of[i] < s._lines.size() &&
+                    s._lines[line_of[i]].find(expect[i]) != std::string::npos;
+    failures += !ok;
+    cout << (ok ? "ok   " : "FAIL ")
+         << (line_of[i] < s._lines.size() ? s._lines[line_of[i]] : "(missing)") << endl;
+  }
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? 1 : 0;
+}
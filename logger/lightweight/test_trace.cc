@@ -0,0 +1,99 @@
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+
+#include "trace.hh"
+
+using namespace std;
+using namespace anhthd::cpplibs::logger::lightweight;
+namespace fs = anhthd::cpplibs::filesystem;
+
+static int failures = 0;
+
+static void check(bool ok_, const std::string& what_) {
+  failures += !ok_;
+  cout << (ok_ ? "ok   " : "FAIL ") << what_ << endl;
+}
+
+static std::size_t count(const std::string& text_, const char* what_) {
+  std::size_t n = 0;
+  for (std::size_t p = text_.find(what_); p != std::string::npos; p = text_.find(what_, p + 1)) ++n;
+  return n;
+}
+
+static void handle(int i_) {
+  TRACE_FUNCTION();
+  {
+    TRACE_SPAN("parse");
+    std::this_thread::sleep_for(std::chrono::microseconds(i_ % 3 ? 10 : 200));
+  }
+  TRACE_SPAN("reply \"quoted\"");
+}
+
+int main(int argc, char** argv)
+{
+  const char* file = "./trace.json";
+
+  // Disabled: nothing recorded.
+  handle(0);
+
+  TRACER.enable(fs::path(file));
+  std::vector<std::thread> ts;
+  for (int t = 0; t < 3; ++t) {
+    ts.emplace_back([]() {
+      for (int i = 0; i < 100; ++i) handle(i);
+    });
+  }
+  for (auto& th : ts) th.join();
+  handle(1);
+  TRACER.disable();
+  handle(2);
+
+  std::ifstream in(file);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  const std::string text = ss.str();
+  check(text.rfind("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", 0) == 0 &&
+        text.size() > 4 && text.compare(text.size() - 4, 4, "\n]}\n") == 0, "trace file complete");
+  check(count(text, "\"ph\":\"X\"") == 903, "903 complete events");
+  check(count(text, "\"name\":\"handle\"") == 301, "301 handle spans, named after the function");
+  check(count(text, "\"name\":\"parse\"") == 301, "301 parse spans");
+  check(count(text, "\"name\":\"reply \\\"quoted\\\"\"") == 301, "names escaped");
+  check(count(text, ",\n{") == 902, "events separated");
+  check(TRACER.dropped() == 0, "nothing dropped");
+
+  // The long parse spans last at least 200us.
+  std::size_t slow = 0;
+  for (std::size_t p = text.find("\"name\":\"parse\""); p != std::string::npos;
+       p = text.find("\"name\":\"parse\"", p + 1)) {
+    const std::size_t d = text.find("\"dur\":", p);
+    slow += atof(text.c_str() + d + 6) >= 200.0;
+  }
+  check(slow >= 102, "slow parse spans measured (" + std::to_string(slow) + ")");
+
+  // Full thread ring: spans dropped and counted.
+  TRACER.enable(fs::path("./trace_drop.json"), 16);
+  for (int i = 0; i < 1000; ++i) {
+    TRACE_SPAN("burst");
+  }
+  const std::uint64_t dropped = TRACER.dropped();
+  TRACER.disable();
+  check(dropped > 0, "full ring dropped " + std::to_string(dropped) + " spans");
+
+  // Cost of a span while disabled.
+  const int n = 100000000;
+  const auto t0 = std::chrono::steady_clock::now();
+  for (int i = 0; i < n; ++i) {
+    TRACE_SPAN("off");
+  }
+  const double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - t0).count();
+  cout << "disabled span: " << ns / n << " ns" << endl;
+
+  cout << (failures ? "FAILED" : "PASSED") << endl;
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,218 @@
+/**************************************************************************************
+* Lightweight Logger - Thread Rings
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: thread_rings.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * The plumbing shared by the backends fed through one ring per producer thread (the
+ * binary logger, the tracer):
+ *
+ *  - thread_rings hands each thread a ring of its own, per registry and per session
+ *    (enable() to disable()), and lets the backend thread walk them. A ring is
+ *    freed once its thread exited and the backend drained it.
+ *  - run_backend() is the backend thread's loop, idle_backoff its sleep while
+ *    there is nothing to drain.
+ */
+#ifndef LIGHTWEIGHT_THREAD_RINGS_H_
+#define LIGHTWEIGHT_THREAD_RINGS_H_
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <cstdint>
+
+namespace anhthd {
+namespace cpplibs {
+namespace logger {
+namespace lightweight {
+/**
+ * Sleep of an idle backend thread: 50us, doubling up to 1ms, back to 50us once
+ * there is work again.
+ */
+class idle_backoff
+{
+public:
+  void reset() noexcept {
+    _idle = std::chrono::microseconds(50);
+  }
+
+  void wait() {
+    std::this_thread::sleep_for(_idle);
+    if (_idle < std::chrono::milliseconds(1)) _idle *= 2;
+  }
+
+private:
+  std::chrono::microseconds _idle{50};
+};
+
+/**
+ * Backend thread loop: drain_() until it returns 0, then idle_(), then exit if
+ * stop_ is set or sleep, see idle_backoff. Anything committed before stop_ was set
+ * is drained before the loop exits.
+ */
+template <typename D, typename I>
+void run_backend(const std::atomic<bool>& stop_, D&& drain_, I&& idle_) {
+  idle_backoff idle;
+  for (;;) {
+    if (drain_()) {
+      idle.reset();
+      continue;
+    }
+    idle_();
+    if (stop_.load(std::memory_order_acquire)) return;
+    idle.wait();
+  }
+}
+
+/**
+ * Rings of the producer threads, R being constructible from a capacity. Getting
+ * the calling thread's ring takes no lock, once the thread has one for the
+ * current session.
+ */
+template <typename R>
+class thread_rings
+{
+public:
+  thread_rings(): _id{_next_id().fetch_add(1, std::memory_order_relaxed)} { }
+
+  thread_rings(thread_rings&&) = delete;
+  thread_rings(const thread_rings&) = delete;
+  thread_rings& operator=(thread_rings&&) = delete;
+  thread_rings& operator=(const thread_rings&) = delete;
+
+  /**
+   * Start a session: threads get new rings of capacity_ from now on.
+   */
+  void open(std::size_t capacity_) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    _capacity = capacity_;
+    _new.clear();     // Taken by threads since the last close()
+    _session.fetch_add(1, std::memory_order_release);
+  }
+
+  /**
+   * Drop every ring, once the backend thread stopped.
+   */
+  void close() {
+    _active.clear();
+    std::lock_guard<std::mutex> lk(_mtx);
+    _new.clear();
+  }
+
+  /**
+   * Ring of the calling thread for this registry and its current session, a new
+   * one after each open(): the previous one may still be held by the backend. A
+   * thread keeps a handle per registry it uses.
+   *
+   * @return nullptr if out of memory.
+   */
+  R* local() noexcept {
+    thread_local std::vector<handle> hs;
+    const std::uint64_t session = _session.load(std::memory_order_acquire);
+    handle* h = nullptr;
+    for (auto& x : hs) {
+      if (x._owner != _id) continue;
+      if (x._session == session) return &x._slot->_ring;
+      h = &x;
+    }
+    try {
+      if (!h) h = &hs.emplace_back();
+      std::lock_guard<std::mutex> lk(_mtx);
+      auto s = std::make_shared<slot>(_capacity);
+      if (h->_slot) h->_slot->_retired.store(true, std::memory_order_release);
+      _new.push_back(s);
+      h->_slot = std::move(s);
+      h->_owner = _id;
+      h->_session = session;
+      return &h->_slot->_ring;
+    } catch (...) {
+      return nullptr;
+    }
+  }
+
+  /**
+   * Backend thread: drain_(ring) on every ring, then drop the rings of exited
+   * threads.
+   *
+   * @return The sum of what drain_() returned, i.e. the entries drained.
+   */
+  template <typename F>
+  std::size_t drain(F&& drain_) {
+    {
+      std::lock_guard<std::mutex> lk(_mtx);
+      for (auto& s : _new) _active.push_back(std::move(s));
+      _new.clear();
+    }
+    std::size_t n = 0;
+    for (std::size_t i = 0; i < _active.size();) {
+      slot& s = *_active[i];
+      const bool retired = s._retired.load(std::memory_order_acquire);
+      n += drain_(s._ring);
+      if (retired) {
+        _active[i] = std::move(_active.back());
+        _active.pop_back();
+      } else {
+        ++i;
+      }
+    }
+    return n;
+  }
+
+private:
+  struct slot {
+    explicit slot(std::size_t capacity_): _ring{capacity_} { }
+    R                   _ring;
+    std::atomic<bool>   _retired{false};   ///< Its thread exited
+  };
+
+  /**
+   * Marks the ring as retired on thread exit, the backend frees it once drained.
+   */
+  struct handle {
+    std::shared_ptr<slot> _slot;
+    std::uint64_t         _owner{0};     ///< thread_rings::_id
+    std::uint64_t         _session{0};
+    handle() = default;
+    handle(handle&&) = default;   // Moved by its thread's vector
+    ~handle() {
+      if (_slot) _slot->_retired.store(true, std::memory_order_release);
+    }
+  };
+
+  static std::atomic<std::uint64_t>& _next_id() noexcept {
+    static std::atomic<std::uint64_t> id{1};
+    return id;
+  }
+
+  const std::uint64_t                 _id;          ///< Keys the thread handles
+  std::mutex                          _mtx;         ///< _new, _capacity
+  std::atomic<std::uint64_t>          _session{0};  ///< open() count
+  std::size_t                         _capacity{0};
+  std::vector<std::shared_ptr<slot>>  _new;         ///< Not yet seen by the backend
+
+  /// Backend thread only
+  std::vector<std::shared_ptr<slot>>  _active;
+};
+};  // namespace lightweight
+};  // namespace logger
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* LIGHTWEIGHT_THREAD_RINGS_H_ */
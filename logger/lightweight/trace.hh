@@ -0,0 +1,336 @@
+/**************************************************************************************
+* Lightweight Logger - Trace Spans
+* COPYRIGHT: (c) 2023 Anh Tran
+* Author: Anh Tran (anhthd2017@gmail.com)
+* File: trace.hh
+* License: GPLv3
+*
+* This program is free software: you can redistribute it and/or modify it under
+* the terms of the GNU General Public License as published by the Free Software
+* Foundation, either version 3 of the License, or (at your option) any later version.
+*
+* This program is distributed in the hope that it will be useful, but WITHOUT ANY
+* WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR A
+* PARTICULAR PURPOSE. See the GNU General Public License for more details.
+*
+* You should have received a copy of the GNU General Public License along with this
+* program. If not, see <https://www.gnu.org/licenses/>.
+**************************************************************************************/
+
+/**
+ * Scoped trace spans, written as a Chrome trace (JSON object format), for
+ * chrome://tracing or https://ui.perfetto.dev:
+ *
+ *   TRACER.enable(filesystem::path("app.trace.json"));
+ *   void handle(request& r_) {
+ *     TRACE_SPAN("handle");
+ *     { TRACE_SPAN("parse"); ... }
+ *   }
+ *   TRACER.disable();
+ *
+ *  - A span reads the time stamp counter when it opens and closes, and pushes
+ *    {begin, end, name} into a buffer_ring of its own thread. No lock, no
+ *    allocation, no formatting. A span closing while its thread's ring is full is
+ *    dropped and counted.
+ *  - A backend thread drains the rings, see thread_rings, and appends one complete
+ *    ("X") event per span: microseconds since enable(), thread ID, name.
+ *  - Disabled, a span costs one relaxed load and one predictable branch (the
+ *    close reuses its outcome). Built with -DLOG_TRACE_SPANS=0, TRACE_SPAN()
+ *    compiles to nothing.
+ *
+ * Span names must be string literals, only their address is recorded.
+ */
+#ifndef LIGHTWEIGHT_TRACE_H_
+#define LIGHTWEIGHT_TRACE_H_
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <condition_variable>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "logger.hh"
+#include "structured.hh"
+#include "thread_rings.hh"
+#include "../../buffer/ring/buffer_ring.hh"
+
+namespace anhthd {
+namespace cpplibs {
+namespace logger {
+namespace lightweight {
+namespace trace {
+/**
+ * Time stamp counter, or the steady clock in nanoseconds off x86.
+ */
+inline std::uint64_t ticks() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+struct span_event {
+  std::uint64_t _begin;
+  std::uint64_t _end;
+  const char*   _name;
+};
+
+/**
+ * Owns the thread rings and the backend thread of the spans. The spans go to the
+ * process' tracer, TRACER.
+ */
+class tracer
+{
+public:
+  tracer() = default;
+
+  ~tracer() {
+    disable();
+  }
+
+  tracer(tracer&&) = delete;
+  tracer(const tracer&) = delete;
+  tracer& operator=(tracer&&) = delete;
+  tracer& operator=(const tracer&) = delete;
+
+  /**
+   * Start tracing into file_, truncated.
+   *
+   * @param[in] file_ Chrome trace file, complete once disable() returned
+   * @param[in] events_ Capacity of each thread ring, in spans
+   */
+  void enable(const filesystem::path& file_, std::size_t events_ = 1 << 14) {
+    std::lock_guard<std::mutex> lk(_mtx);
+    if (_backend.joinable()) {
+      throw std::logic_error("Tracing is already enabled");
+    }
+    _out = fopen(file_.raw(), "w");
+    if (!_out) {
+      throw std::runtime_error(std::string("Cannot open trace file ") + file_.raw());
+    }
+    setvbuf(_out, nullptr, _IOFBF, 1 << 20);
+    fputs("{\"displayTimeUnit\":\"ns\",\"traceEvents\":[", _out);
+    _nevents = 0;
+    _pid = static_cast<long>(::getpid());
+    _calibrate();
+    _rings.open(events_);
+    _stop.store(false, std::memory_order_relaxed);
+    _dropped.store(0, std::memory_order_relaxed);
+    _backend = std::thread([this]() { _run_backend(); });
+    _enabled.store(true, std::memory_order_release);
+    _on.store(true, std::memory_order_release);
+  }
+
+  /**
+   * Stop tracing and complete the trace file, once every closed span is written.
+   * Spans open meanwhile are dropped when they close. Drops are reported to LOGGER
+   * as a WARNING.
+   */
+  void disable() {
+    std::unique_lock<std::mutex> lk(_mtx);
+    if (!_backend.joinable()) return;
+    _on.store(false, std::memory_order_release);
+    _enabled.store(false, std::memory_order_release);
+    _stop.store(true, std::memory_order_release);
+    lk.unlock();
+    _backend.join();
+    _drain_all();
+    _rings.close();
+    lk.lock();
+    fputs("\n]}\n", _out);
+    fclose(_out);
+    _out = nullptr;
+    const std::uint64_t dropped = _dropped.load(std::memory_order_relaxed);
+    lk.unlock();
+    if (dropped) {
+      LOGGER.print_log(LogLevel::eWARNING, "trace", std::string_view(
+                         "Dropped " + std::to_string(dropped) + " spans on a full thread ring"));
+    }
+  }
+
+  bool enabled() const noexcept {
+    return _enabled.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Whether a tracer is enabled. A constant-initialized flag: a span checks it
+   * without going through TRACER's initialization guard.
+   */
+  static bool on() noexcept {
+    return _on.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * Span close: queue the span into the ring of the calling thread.
+   */
+  void record(std::uint64_t begin_, const char* name_) noexcept {
+    const std::uint64_t end = ticks();
+    thread_ring* tr = _rings.local();
+    if (!tr || !enabled() || !tr->_ring.push(span_event{begin_, end, name_})) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * Spans dropped since enable().
+   */
+  std::uint64_t dropped() const noexcept {
+    return _dropped.load(std::memory_order_relaxed);
+  }
+
+private:
+  struct thread_ring {
+    explicit thread_ring(std::size_t events_): _ring{events_} { }
+    buffer::buffer_ring<span_event> _ring;
+    long                            _tid{static_cast<long>(::syscall(SYS_gettid))};
+  };
+
+  static inline std::atomic<bool> _on{false};
+
+  std::atomic<bool>           _enabled{false};
+  std::atomic<bool>           _stop{false};
+  std::atomic<std::uint64_t>  _dropped{0};
+  std::mutex                  _mtx;
+  std::thread                 _backend;
+  thread_rings<thread_ring>   _rings;
+  FILE*                       _out{nullptr};
+
+  /// Backend thread only, once enabled
+  std::uint64_t               _base{0};               ///< Ticks at enable()
+  double                      _us_per_tick{1e-3};
+  long                        _pid{0};
+  std::uint64_t               _nevents{0};
+  std::string                 _line;
+
+  /**
+   * Ticks to microseconds: the TSC rate of log_clock::use_tsc() if in use, else
+   * measured the same way over 10ms.
+   */
+  void _calibrate() {
+    log_clock::tsc_calibration c;
+    const bool tsc = log_clock::tsc(c) || log_clock::calibrate_tsc(c, 10);
+    _us_per_tick = tsc ? c._ns_per_tick * 1e-3 : 1e-3;   // Off x86, ticks() are ns
+    _base = ticks();
+  }
+
+  /**
+   * Backend thread: write the trace file out whenever the rings all run empty.
+   */
+  void _run_backend() {
+    run_backend(_stop, [this]() { return _drain_all(); }, [this]() { fflush(_out); });
+  }
+
+  /**
+   * Write every queued span.
+   */
+  std::size_t _drain_all() {
+    return _rings.drain([this](thread_ring& tr_) {
+      std::size_t n = 0;
+      while (const span_event* e = tr_._ring.front()) {
+        _write(tr_._tid, *e);
+        tr_._ring.pop_front();
+        ++n;
+      }
+      return n;
+    });
+  }
+
+  void _write(long tid_, const span_event& e_) {
+    // Spans opened before enable() start at 0.
+    const double ts = (e_._begin > _base) ? (e_._begin - _base) * _us_per_tick : 0.0;
+    const double end = (e_._end > _base) ? (e_._end - _base) * _us_per_tick : 0.0;
+    _line.assign(_nevents++ ? ",\n{\"name\":" : "\n{\"name\":");
+    structured::json_string(_line, e_._name);
+    char buf[160];
+    const int n = snprintf(buf, sizeof(buf),
+                           ",\"cat\":\"span\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,"
+                           "\"pid\":%ld,\"tid\":%ld}", ts, end - ts, _pid, tid_);
+    _line.append(buf, n > 0 ? static_cast<std::size_t>(n) : 0);
+    fwrite(_line.data(), 1, _line.size(), _out);
+  }
+};
+
+/**
+ * The tracer of the process, shared by every translation unit.
+ */
+inline tracer& get_tracer() {
+  get_instance();   // LOGGER, which disable() reports to, outlives the tracer
+  static tracer ins;
+  return ins;
+}
+
+#define TRACER anhthd::cpplibs::logger::lightweight::trace::get_tracer()
+
+/**
+ * RAII span, see TRACE_SPAN().
+ */
+class span
+{
+public:
+  template <std::size_t N>
+  explicit span(const char (&name_)[N]) noexcept:
+    _name{name_}, _begin{tracer::on() ? ticks() : 0} { }
+
+  ~span() {
+    if (_begin) TRACER.record(_begin, _name);
+  }
+
+  span(span&&) = delete;
+  span(const span&) = delete;
+  span& operator=(span&&) = delete;
+  span& operator=(const span&) = delete;
+
+private:
+  const char*   _name;
+  std::uint64_t _begin;   ///< 0 if tracing was disabled at open
+};
+};  // namespace trace
+
+/**
+ * Spans are compiled in unless -DLOG_TRACE_SPANS=0.
+ */
+#ifndef LOG_TRACE_SPANS
+#define LOG_TRACE_SPANS 1
+#endif
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+
+/**
+ * Trace the enclosing scope as a span named by a string literal.
+ */
+#if LOG_TRACE_SPANS
+#define TRACE_SPAN(name) \
+  const anhthd::cpplibs::logger::lightweight::trace::span \
+    TRACE_CONCAT(_trace_span_, __LINE__){name}
+#else
+#define TRACE_SPAN(name) \
+  do { } while (0)
+#endif
+
+/**
+ * Trace the enclosing function, named after it.
+ */
+#define TRACE_FUNCTION() TRACE_SPAN(__func__)
+};  // namespace lightweight
+};  // namespace logger
+};  // namespace cpplibs
+};  // namespace anhthd
+
+#endif /* LIGHTWEIGHT_TRACE_H_ */